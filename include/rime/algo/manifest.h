@@ -0,0 +1,75 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#ifndef RIME_MANIFEST_H_
+#define RIME_MANIFEST_H_
+
+#include <stdint.h>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rime {
+
+// size and modification time of a file
+struct FileStamp {
+  std::string file_name;
+  // -1 for a missing file
+  intmax_t size = -1;
+  std::time_t modified_time = 0;
+
+  static FileStamp Of(const std::string& file_name);
+
+  bool operator== (const FileStamp& other) const {
+    return file_name == other.file_name &&
+        size == other.size && modified_time == other.modified_time;
+  }
+};
+
+// remembers the files read and written in deployment, so that unchanged
+// files need not be read again to find out that there is nothing to do.
+class Manifest {
+ public:
+  explicit Manifest(const std::string& file_name);
+
+  bool Load();
+  // writes the manifest if modified
+  bool Save();
+
+  // combined checksum of the files, equal to what ChecksumComputer computes.
+  // the files are read only if changed since the checksum was recorded.
+  uint32_t Checksum(const std::vector<std::string>& file_names);
+  // records files that the result of a task depends on
+  void Record(const std::string& task_key,
+              const std::vector<std::string>& file_names);
+  // true if none of the files recorded for the task has changed
+  bool IsUpToDate(const std::string& task_key);
+
+  const std::string& file_name() const { return file_name_; }
+
+ private:
+  struct Entry {
+    uint32_t checksum = 0;
+    std::vector<FileStamp> files;
+  };
+
+  bool LoadIfNeeded();
+  Entry CreateEntry(const std::vector<std::string>& file_names) const;
+  bool IsUnchanged(const Entry& entry) const;
+
+  std::string file_name_;
+  std::map<std::string, Entry> entries_;
+  bool loaded_ = false;
+  bool modified_ = false;
+  // shared by tasks running in parallel
+  std::mutex mutex_;
+};
+
+}  // namespace rime
+
+#endif  // RIME_MANIFEST_H_
@@ -9,8 +9,8 @@
 #define RIME_SYLLABIFIER_H_
 
 #include <stdint.h>
-#include <map>
 #include <string>
+#include <vector>
 #include "spelling.h"
 
 namespace rime {
@@ -19,21 +19,145 @@ class Prism;
 
 using SyllableId = int32_t;
 
-using SpellingMap = std::map<SyllableId, SpellingProperties>;
-using VertexMap = std::map<size_t, SpellingType>;
-using EndVertexMap = std::map<size_t, SpellingMap>;
-using EdgeMap = std::map<size_t, EndVertexMap>;
+// a range of spellings of a syllable from a vertex, farther end positions
+// first.
+class SpellingPropertiesList {
+ public:
+  using const_iterator = const SpellingProperties*;
+
+  SpellingPropertiesList() = default;
+  SpellingPropertiesList(const_iterator begin, const_iterator end)
+      : begin_(begin), end_(end) {}
+
+  const_iterator begin() const { return begin_; }
+  const_iterator end() const { return end_; }
+  size_t size() const { return end_ - begin_; }
+  bool empty() const { return begin_ == end_; }
+  const SpellingProperties& operator[] (size_t i) const { return begin_[i]; }
+
+ private:
+  const_iterator begin_ = nullptr;
+  const_iterator end_ = nullptr;
+};
+
+// a syllable spelt from a vertex, by the spellings [begin, end) of the graph.
+struct SyllableSpellings {
+  SyllableId syllable_id;
+  uint32_t begin;
+  uint32_t end;
+};
+
+struct SpellingIndexEntry {
+  SyllableId first;
+  SpellingPropertiesList second;
+};
+
+// syllables spelt from a vertex, sorted by syllable id.
+class SpellingIndex {
+ public:
+  class const_iterator {
+   public:
+    const_iterator(const SyllableSpellings* syllable,
+                   const SpellingProperties* spellings)
+        : syllable_(syllable), spellings_(spellings) {}
+
+    SpellingIndexEntry operator* () const {
+      return {syllable_->syllable_id,
+              SpellingPropertiesList(spellings_ + syllable_->begin,
+                                     spellings_ + syllable_->end)};
+    }
+    const_iterator& operator++ () {
+      ++syllable_;
+      return *this;
+    }
+    bool operator== (const const_iterator& other) const {
+      return syllable_ == other.syllable_;
+    }
+    bool operator!= (const const_iterator& other) const {
+      return syllable_ != other.syllable_;
+    }
+
+   private:
+    const SyllableSpellings* syllable_;
+    const SpellingProperties* spellings_;
+  };
 
-using SpellingPropertiesList = std::vector<const SpellingProperties*>;
-using SpellingIndex = std::map<SyllableId, SpellingPropertiesList>;
-using SpellingIndices = std::map<size_t, SpellingIndex>;
+  SpellingIndex() = default;
+  SpellingIndex(const SyllableSpellings* begin,
+                const SyllableSpellings* end,
+                const SpellingProperties* spellings)
+      : begin_(begin), end_(end), spellings_(spellings) {}
 
+  const_iterator begin() const { return const_iterator(begin_, spellings_); }
+  const_iterator end() const { return const_iterator(end_, spellings_); }
+  size_t size() const { return end_ - begin_; }
+  bool empty() const { return begin_ == end_; }
+  const_iterator find(SyllableId syllable_id) const;
+  // an empty list if the syllable is not found
+  SpellingPropertiesList operator[] (SyllableId syllable_id) const;
+
+ private:
+  const SyllableSpellings* begin_ = nullptr;
+  const SyllableSpellings* end_ = nullptr;
+  const SpellingProperties* spellings_ = nullptr;
+};
+
+// the syllable graph in flat arrays, CSR-style: vertices are indexed by
+// input position, and the syllables spelt from each vertex take a range
+// of one array, their spellings a range of another.
 struct SyllableGraph {
   size_t input_length = 0;
   size_t interpreted_length = 0;
-  VertexMap vertices;
-  EdgeMap edges;
-  SpellingIndices indices;
+
+  // vertex types by position; kInvalidSpelling where there is no vertex
+  const std::vector<SpellingType>& vertices() const { return vertices_; }
+  SpellingType vertex_type(size_t pos) const {
+    return pos < vertices_.size() ? vertices_[pos] : kInvalidSpelling;
+  }
+  size_t num_vertices() const { return num_vertices_; }
+  // the type of the last vertex; kInvalidSpelling if there is none
+  SpellingType last_vertex_type() const;
+  // syllables spelt from the vertex at start_pos; empty if there are none
+  SpellingIndex spellings(size_t start_pos) const;
+  // number of vertices that syllables are spelt from
+  size_t num_spelt_vertices() const { return num_spelt_vertices_; }
+  void clear();
+
+ private:
+  friend class SyllableGraphBuilder;
+
+  std::vector<SpellingType> vertices_;
+  size_t num_vertices_ = 0;
+  size_t num_spelt_vertices_ = 0;
+  // syllables spelt from position i are syllables_[offsets_[i], offsets_[i+1])
+  std::vector<uint32_t> offsets_;
+  std::vector<SyllableSpellings> syllables_;
+  std::vector<SpellingProperties> spellings_;
+};
+
+// lays out a syllable graph from vertices and spellings given in any order.
+// of spellings of a syllable with the same start and end positions, only
+// the first given is kept.
+class SyllableGraphBuilder {
+ public:
+  void Reserve(size_t num_spellings) { spellings_.reserve(num_spellings); }
+  void AddVertex(size_t pos, SpellingType type);
+  // adds a spelling from start_pos to props.end_pos
+  void AddSpelling(size_t start_pos,
+                   SyllableId syllable_id,
+                   SpellingProperties props);
+  // replaces vertices and spellings of the graph, and starts over.
+  void Build(SyllableGraph* graph);
+
+ private:
+  struct Spelling {
+    size_t start_pos;
+    SyllableId syllable_id;
+    SpellingProperties properties;
+  };
+
+  std::vector<SpellingType> vertices_;
+  std::vector<Spelling> spellings_;
 };
 
 class Syllabifier {
@@ -52,10 +176,6 @@ class Syllabifier {
                          SyllableGraph *graph);
 
  protected:
-  void CheckOverlappedSpellings(SyllableGraph *graph,
-                                size_t start, size_t end);
-  void Transpose(SyllableGraph* graph);
-
   std::string delimiters_;
   bool enable_completion_ = false;
   bool strict_spelling_ = false;
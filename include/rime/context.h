@@ -55,6 +55,11 @@ class Context {
   bool ClearNonConfirmedComposition();
   bool RefreshNonConfirmedComposition();
 
+  // while updates are deferred, editing the input does not recompose until
+  // the composition is looked into, or updates are resumed.
+  void DeferUpdates();
+  void ResumeUpdates();
+
   void set_input(const std::string& value);
   const std::string& input() const { return input_; }
 
@@ -87,8 +92,13 @@ class Context {
   }
 
  private:
+  void NotifyUpdate();
+  void UpdateIfPending() const;
+
   std::string input_;
   size_t caret_pos_ = 0;
+  int deferred_updates_ = 0;
+  mutable bool update_pending_ = false;
   unique_ptr<Composition> composition_;
   CommitHistory commit_history_;
   std::map<std::string, bool> options_;
@@ -19,6 +19,7 @@
 namespace rime {
 
 class Deployer;
+class Manifest;
 
 using TaskInitializer = boost::any;
 
@@ -40,6 +41,21 @@ class Deployer : public Messenger {
   std::string distribution_name;
   std::string distribution_code_name;
   std::string distribution_version;
+  // number of worker threads compiling schemas; 0 for one per CPU core.
+  int max_parallel_jobs = 0;
+  // bytes of dictionary entries kept in memory while building a table,
+  // beyond which they are spilled to temporary files; 0 for the default.
+  // up to 2 GiB may be set in installation.yaml.
+  size_t max_table_build_memory = 0;
+  // whether tables are built with compact entries, for memory-constrained
+  // devices; weights lose some precision.
+  bool compact_tables = false;
+  // whether tables are built with keys of their indexes stored apart, for
+  // faster lookups; older versions of librime cannot read such tables.
+  bool keyed_table_index = false;
+  // seconds that records learnt by user dictionaries may wait in memory
+  // before written to the user db; 0 writes them at once.
+  int user_db_flush_interval = 5;
   // }
 
   Deployer();
@@ -63,10 +79,13 @@ class Deployer : public Messenger {
   void JoinMaintenanceThread();
 
   std::string user_data_sync_dir() const;
+  // files deployed to the user data dir, and what they were built from
+  Manifest* manifest();
 
  private:
   std::queue<shared_ptr<DeploymentTask>> pending_tasks_;
   std::mutex mutex_;
+  unique_ptr<Manifest> manifest_;
   std::future<void> work_;
   bool maintenance_mode_ = false;
 };
@@ -38,9 +38,28 @@ class DictCompiler {
 
   bool Compile(const std::string &schema_file);
   void set_options(int options) { options_ = options; }
+  // bytes of entries kept in memory while building the table
+  void set_memory_budget(size_t memory_budget) {
+    memory_budget_ = memory_budget;
+  }
+  // builds the table with compact entries, which take less memory at the
+  // cost of precision of weights
+  void set_compact_table(bool compact_table) {
+    compact_table_ = compact_table;
+  }
+  // builds the table with keys of its trunk indexes stored apart, for faster
+  // lookups; older versions of librime cannot read such a table.
+  void set_keyed_trunk_index(bool keyed_trunk_index) {
+    keyed_trunk_index_ = keyed_trunk_index;
+  }
+  // files the dictionary is compiled from
+  const std::vector<std::string>& source_files() const {
+    return source_files_;
+  }
 
  private:
   std::string FindDictFile(const std::string& dict_name);
+  double table_format_version() const;
   bool BuildTable(DictSettings* settings,
                   const std::vector<std::string>& dict_files,
                   uint32_t dict_file_checksum);
@@ -53,6 +72,10 @@ class DictCompiler {
   shared_ptr<Table> table_;
   int options_ = 0;
   DictFileFinder dict_file_finder_;
+  size_t memory_budget_;
+  bool compact_table_ = false;
+  bool keyed_trunk_index_ = false;
+  std::vector<std::string> source_files_;
 };
 
 }  // namespace rime
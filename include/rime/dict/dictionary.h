@@ -7,8 +7,9 @@
 #ifndef RIME_DICTIONARY_H_
 #define RIME_DICTIONARY_H_
 
-#include <list>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <rime/common.h>
@@ -21,33 +22,63 @@ namespace rime {
 
 namespace dictionary {
 
+// a run of entries in the mmapped table, sorted by weight.
+// codes are referenced rather than copied.
 struct Chunk {
-  Code code;
-  const table::Entry* entries = nullptr;
+  IndexCode index_code;
+  const table::Code* extra_code = nullptr;
+  table::EntryRun entries;
   size_t size = 0;
   size_t cursor = 0;
   std::string remaining_code;  // for predictive queries
   double credibility = 1.0;
 
   Chunk() = default;
-  Chunk(const Code& c, const table::Entry* e, double cr = 1.0)
-      : code(c), entries(e), size(1), cursor(0), credibility(cr) {}
+  Chunk(const IndexCode& c, const table::Code* extra, const table::Entry* e,
+        double cr = 1.0)
+      : index_code(c), extra_code(extra), entries(e), size(1), cursor(0),
+        credibility(cr) {}
   Chunk(const TableAccessor& a, double cr = 1.0)
       : Chunk(a, std::string(), cr) {}
   Chunk(const TableAccessor& a, const std::string& r, double cr = 1.0)
-      : code(a.index_code()), entries(a.entry()),
+      : index_code(a.index_code()), entries(a.remaining_entries()),
         size(a.remaining()), cursor(0), remaining_code(r), credibility(cr) {}
 };
 
-bool compare_chunk_by_leading_element(const Chunk& a, const Chunk& b);
+bool compare_chunk_by_head_element(const Chunk& a, const Chunk& b);
 
 }  // namespace dictionary
 
-class DictEntryIterator : protected std::list<dictionary::Chunk>,
-                          public DictEntryFilterBinder {
+// refers to the entry at the cursor of a chunk in the mmapped table,
+// along with the chunk's code and credibility.
+// valid until the iterator it is obtained from advances.
+class DictEntryView {
  public:
-  using Base = std::list<dictionary::Chunk>;
+  DictEntryView() = default;
+  DictEntryView(const dictionary::Chunk* chunk, Table* table)
+      : chunk_(chunk), table_(table) {}
+
+  explicit operator bool() const { return chunk_ && table_; }
+  std::string text() const;
+  double weight() const;
+  int remaining_code_length() const {
+    return static_cast<int>(chunk_->remaining_code.length());
+  }
+  // fills in every field of entry, reusing its memory
+  void Materialize(DictEntry* entry) const;
 
+ private:
+  const dictionary::Chunk* chunk_ = nullptr;
+  Table* table_ = nullptr;
+};
+
+// merges entries from chunks of dictionary entries, each sorted by weight.
+// once sorted, the chunks are organized as a binary heap with the chunk of
+// the next entry at the front.
+// a DictEntry is created for the next entry only when peeked, and is
+// recycled for the entry after it unless kept by someone else.
+class DictEntryIterator : public DictEntryFilterBinder {
+ public:
   DictEntryIterator();
   DictEntryIterator(const DictEntryIterator& other);
   DictEntryIterator& operator= (DictEntryIterator& other);
@@ -55,17 +86,35 @@ class DictEntryIterator : protected std::list<dictionary::Chunk>,
   void AddChunk(dictionary::Chunk&& chunk, Table* table);
   void Sort();
   shared_ptr<DictEntry> Peek();
+  // the next entry accepted by filters, without creating a DictEntry
+  // unless filters have to examine it
+  DictEntryView PeekView();
   bool Next();
   bool Skip(size_t num_entries);
   bool exhausted() const;
   size_t entry_count() const { return entry_count_; }
 
  protected:
-  void PrepareEntry();
+  void PrepareEntry(const DictEntryView& view);
+  // restores the order of chunks after the front chunk has advanced
+  void Reorder();
+  void PopChunk();
 
  private:
+  struct HeapNode {
+    dictionary::Chunk chunk;
+    // a greater order takes precedence among chunks of equal head elements
+    size_t order;
+  };
+  static bool HeapLess(const HeapNode& a, const HeapNode& b);
+
+  std::deque<HeapNode> chunks_;
+  bool sorted_ = false;
+  size_t last_order_ = 0;
   Table* table_;
   shared_ptr<DictEntry> entry_;
+  // whether entry_ holds the next entry
+  bool entry_ready_ = false;
   size_t entry_count_;
 };
 
@@ -88,9 +137,13 @@ class Dictionary : public Class<Dictionary, const Ticket&> {
   bool Remove();
   bool Load();
 
+  // if horizon is given, it receives the farthest position in the syllable
+  // graph the lookup has examined; results stay valid for another syllable
+  // graph that is identical up to (and including) that position.
   shared_ptr<DictEntryCollector> Lookup(const SyllableGraph& syllable_graph,
                                         size_t start_pos,
-                                        double initial_credibility = 1.0);
+                                        double initial_credibility = 1.0,
+                                        size_t* horizon = NULL);
   // if predictive is true, do an expand search with limit,
   // otherwise do an exact match.
   // return num of matching keys.
@@ -110,6 +163,8 @@ class Dictionary : public Class<Dictionary, const Ticket&> {
   std::string name_;
   shared_ptr<Table> table_;
   shared_ptr<Prism> prism_;
+  // working memory of Lookup(), cleared and reused by each query
+  TableQueryArena query_arena_;
 };
 
 class DictionaryComponent : public Dictionary::Component {
@@ -120,6 +175,8 @@ class DictionaryComponent : public Dictionary::Component {
                                        const std::string& prism_name);
 
  private:
+  // sessions in different threads may create dictionaries at a time
+  std::mutex mutex_;
   std::map<std::string, weak_ptr<Prism>> prism_map_;
   std::map<std::string, weak_ptr<Table>> table_map_;
 };
@@ -8,7 +8,6 @@
 #define RIME_ENTRY_COLLECTOR_H_
 
 #include <map>
-#include <queue>
 #include <set>
 #include <string>
 #include <vector>
@@ -30,10 +29,11 @@ using WeightMap = std::map<std::string, double>;
 // word -> { code -> weight }
 using WordMap = std::map<std::string, WeightMap>;
 // [ (word, weight), ... ]
-using EncodeQueue = std::queue<std::pair<std::string, std::string>>;
+using EncodeQueue = std::vector<std::pair<std::string, std::string>>;
 
 class PresetVocabulary;
 class DictSettings;
+class EntrySpool;
 
 class EntryCollector : public PhraseCollector {
  public:
@@ -41,13 +41,19 @@ class EntryCollector : public PhraseCollector {
   std::vector<RawDictEntry> entries;
   size_t num_entries = 0;
   ReverseLookupTable stems;
+  // number of threads encoding phrases; 0 for one per CPU core.
+  // entries are collected in the same order with any number of threads.
+  int num_threads = 0;
+  // if given, entries are put in the spool instead of kept in memory
+  EntrySpool* spool = nullptr;
 
  public:
   EntryCollector();
   ~EntryCollector();
 
   void Configure(DictSettings* settings);
-  void Collect(const std::vector<std::string>& dict_files);
+  // returns false if entries fail to be put in the spool
+  bool Collect(const std::vector<std::string>& dict_files);
 
   // export contents of table and prism to text files
   void Dump(const std::string& file_name) const;
@@ -63,14 +69,27 @@ class EntryCollector : public PhraseCollector {
   void Collect(const std::string &dict_file);
   // encode all collected entries
   void Finish();
+  // encode phrases with worker threads, creating entries in the given order.
+  // phrases of the preset vocabulary come with their weights.
+  void EncodePhrases(const EncodeQueue& phrases,
+                     const std::vector<double>* preset_weights = nullptr);
+  // creates an entry of a known weight
+  void CreateEntry(const std::string& word,
+                   const std::string& code_str,
+                   double weight);
+  size_t num_jobs() const;
 
  protected:
   unique_ptr<PresetVocabulary> preset_vocabulary;
   unique_ptr<Encoder> encoder;
   EncodeQueue encode_queue;
-  std::set<std::string/* word */> collection;
+  // preset phrases also defined in dict files, by phrase id; this takes
+  // memory in proportion to the preset vocabulary, not the dictionary.
+  std::vector<bool> defined_phrases;
   WordMap words;
   WeightMap total_weight;
+  // set when an entry fails to be put in the spool
+  bool spool_error = false;
 };
 
 }  // namespace rime
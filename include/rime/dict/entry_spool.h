@@ -0,0 +1,80 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#ifndef RIME_ENTRY_SPOOL_H_
+#define RIME_ENTRY_SPOOL_H_
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <rime/common.h>
+
+namespace rime {
+
+struct RawDictEntry;
+
+// holds dict entries for building a table within a memory budget.
+// entries exceeding the budget are spilled to temporary files as sorted runs,
+// which are merged as they are read back.
+class EntrySpool {
+ public:
+  static const size_t kDefaultMemoryBudget = 256 * 1024 * 1024;
+
+  // temporary files are named after the given prefix
+  EntrySpool(const std::string& file_prefix,
+             size_t memory_budget = kDefaultMemoryBudget);
+  ~EntrySpool();
+
+  // fails once entries cannot be spilled, taking no more entries
+  bool Put(const RawDictEntry& entry);
+  // ends putting entries, and starts reading them back ordered by their
+  // first syllables, then in the order put.
+  bool Rewind();
+  bool Get(RawDictEntry* entry);
+
+  size_t size() const { return size_; }
+  size_t num_runs() const { return runs_.size(); }
+
+ private:
+  struct Record {
+    std::string head;  // first syllable of code
+    uint64_t seq;
+    std::string code;
+    std::string text;
+    double weight;
+
+    bool operator< (const Record& other) const {
+      return head < other.head || (head == other.head && seq < other.seq);
+    }
+  };
+  struct Run {
+    std::string file_name;
+    std::ifstream in;
+    Record top;
+  };
+
+  bool SpillRun();
+  bool ReadRecord(std::istream& in, Record* record);
+  void RemoveRuns();
+
+  std::string file_prefix_;
+  size_t memory_budget_;
+  size_t memory_used_ = 0;
+  size_t size_ = 0;
+  std::vector<Record> buffer_;
+  std::vector<unique_ptr<Run>> runs_;
+  // while reading back: runs not yet exhausted, as a min-heap of their tops
+  std::vector<Run*> heap_;
+  size_t buffer_pos_ = 0;
+  bool reading_ = false;
+  // set when a run fails to spill
+  bool failed_ = false;
+};
+
+}  // namespace rime
+
+#endif  // RIME_ENTRY_SPOOL_H_
@@ -23,12 +23,12 @@ class OffsetPtr {
   OffsetPtr() = default;
   OffsetPtr(Offset offset) : offset_(offset) {}
   OffsetPtr(const T* ptr) : OffsetPtr(to_offset(ptr)) {}
-  OffsetPtr(const OffsetPtr<T>& ptr) : OffsetPtr(ptr.get()) {}
-  OffsetPtr<T>& operator= (const OffsetPtr<T>& ptr) {
+  OffsetPtr(const OffsetPtr& ptr) : OffsetPtr(ptr.get()) {}
+  OffsetPtr& operator= (const OffsetPtr& ptr) {
     offset_ = to_offset(ptr.get());
     return *this;
   }
-  OffsetPtr<T>& operator= (const T* ptr) {
+  OffsetPtr& operator= (const T* ptr) {
     offset_ = to_offset(ptr);
     return *this;
   }
@@ -72,10 +72,10 @@ struct Array {
   const T* end() const { return &at[0] + size; }
 };
 
-template <class T, class Size = uint32_t>
+template <class T, class Size = uint32_t, class Offset = int32_t>
 struct List {
   Size size;
-  OffsetPtr<T> at;
+  OffsetPtr<T, Offset> at;
   T* begin() { return &at[0]; }
   T* end() { return &at[0] + size; }
   const T* begin() const { return &at[0]; }
@@ -145,7 +145,9 @@ T* MappedFile::Allocate(size_t count) {
   size_t required_space = sizeof(T) * count;
   size_t file_size = capacity();
   if (used_space + required_space > file_size) {
-    // not enough space; grow the file
+    // not enough space; grow the file, remapping it at another address
+    LOG(WARNING) << "growing file '" << file_name_ << "' beyond capacity: "
+                 << file_size;
     size_t new_size = (std::max)(used_space + required_space, file_size * 2);
     if(!Resize(new_size) || !OpenReadWrite())
       return NULL;
@@ -156,6 +158,29 @@ T* MappedFile::Allocate(size_t count) {
   return ptr;
 }
 
+// measures the file size taken by a sequence of allocations, in the same way
+// as MappedFile does, so that a file can be created at its exact size and
+// never be remapped while being built.
+class MappedFileSizer {
+ public:
+  template <class T>
+  void Allocate(size_t count = 1) {
+    size_ = RIME_ALIGNED(size_, T) + sizeof(T) * count;
+  }
+  template <class T>
+  void CreateArray(size_t array_size) {
+    Allocate<char>(sizeof(Array<T>) + sizeof(T) * (array_size - 1));
+  }
+  void CopyString(const std::string& str) {
+    Allocate<char>(str.length() + 1);
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  size_t size_ = 0;
+};
+
 template <class T>
 T* MappedFile::Find(size_t offset) {
   if (!IsOpen() || offset > size_)
@@ -7,12 +7,56 @@
 #ifndef PRESET_VOCABULARY_H_
 #define PRESET_VOCABULARY_H_
 
+#include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 #include <rime/common.h>
+#include <rime/dict/mapped_file.h>
+#include <rime/dict/string_table.h>
 
 namespace rime {
 
-struct VocabularyDb;
+namespace vocabulary {
+
+struct Metadata {
+  static const int kFormatMaxLength = 32;
+  char format[kFormatMaxLength];
+  uint32_t source_file_checksum;
+  // string ids of phrases, sorted by text
+  List<StringId> phrases;
+  // phrase weights, indexed by string id
+  List<double> weights;
+  OffsetPtr<char> phrase_trie;
+  uint32_t phrase_trie_size;
+};
+
+}  // namespace vocabulary
+
+// the preset vocabulary compiled from essay.txt
+class VocabularyBin : public MappedFile {
+ public:
+  explicit VocabularyBin(const std::string& file_name);
+
+  bool Load();
+  bool Save();
+  // phrases should have been sorted by text
+  bool Build(const std::vector<std::pair<std::string, double>>& phrases,
+             uint32_t source_file_checksum);
+
+  bool GetWeight(const std::string& phrase, double* weight);
+  // ids of phrases are below size()
+  bool GetPhraseId(const std::string& phrase, StringId* id);
+  // gets the phrase at the index in order of text
+  bool GetPhrase(size_t index, std::string* phrase, double* weight);
+
+  size_t size() const;
+  uint32_t source_file_checksum() const;
+
+ private:
+  vocabulary::Metadata* metadata_ = nullptr;
+  unique_ptr<StringTable> phrase_trie_;
+};
 
 class PresetVocabulary {
  public:
@@ -21,9 +65,11 @@ class PresetVocabulary {
 
   // random access
   bool GetWeightForEntry(const std::string& key, double* weight);
+  bool GetPhraseId(const std::string& phrase, StringId* id);
+  size_t size() const;
   // traversing
   void Reset();
-  bool GetNextEntry(std::string* key, std::string* value);
+  bool GetNextEntry(std::string* key, double* weight);
   bool IsQualifiedPhrase(const std::string& phrase,
                          const std::string& weight_str);
 
@@ -31,9 +77,14 @@ class PresetVocabulary {
   void set_min_phrase_weight(double weight) { min_phrase_weight_ = weight; }
 
   static std::string DictFilePath();
+  // essay.bin, rebuilt from essay.txt whenever the latter changes
+  static std::string CompiledFilePath();
 
  protected:
-  unique_ptr<VocabularyDb> db_;
+  bool IsQualifiedPhrase(const std::string& phrase, double weight);
+
+  unique_ptr<VocabularyBin> bin_;
+  size_t next_entry_ = 0;
   int max_phrase_length_ = 0;
   double min_phrase_weight_ = 0.0;
 };
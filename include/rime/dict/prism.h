@@ -32,6 +32,23 @@ struct SpellingDescriptor {
 using SpellingMapItem = List<SpellingDescriptor>;
 using SpellingMap = Array<SpellingMapItem>;
 
+struct Completion {
+  SyllableId spelling_id;
+  uint32_t length;
+  float weight;
+};
+
+// completions of a spelling prefix, heavier ones first among spellings of
+// equal length, truncated at Prism::kMaxCompletions.
+struct CompletionIndexNode {
+  uint32_t node_pos;  // in the double array, where the prefix leads to
+  uint32_t num_completions;  // before truncation
+  List<Completion> completions;
+};
+
+// sorted by node_pos
+using CompletionIndex = Array<CompletionIndexNode>;
+
 struct Metadata {
   static const int kFormatMaxLength = 32;
   char format[kFormatMaxLength];
@@ -44,6 +61,8 @@ struct Metadata {
   // v1.0
   OffsetPtr<SpellingMap> spelling_map;
   char alphabet[256];
+  // v1.1
+  OffsetPtr<CompletionIndex> completion_index;
 };
 
 }  // namespace prism
@@ -68,18 +87,27 @@ class Prism : public MappedFile {
  public:
   using Match = Darts::DoubleArray::result_pair_type;
 
+  static const size_t kMaxCompletions = 512;
+
   explicit Prism(const std::string& file_name);
 
   bool Load();
   bool Save();
+  // a completion index is built if weights of syllables are given,
+  // indexed by syllable id.
   bool Build(const Syllabary& syllabary,
              const Script* script = NULL,
              uint32_t dict_file_checksum = 0,
-             uint32_t schema_file_checksum = 0);
+             uint32_t schema_file_checksum = 0,
+             const std::vector<double>* syllable_weights = NULL);
 
   bool HasKey(const std::string& key);
   bool GetValue(const std::string& key, int* value);
   void CommonPrefixSearch(const std::string& key, std::vector<Match>* result);
+  void CommonPrefixSearch(const char* key, size_t length,
+                          std::vector<Match>* result);
+  // finds keys that start with the given key, shorter keys first.
+  // with a completion index, keys of equal length are ordered by weight.
   void ExpandSearch(const std::string& key, std::vector<Match>* result, size_t limit);
   SpellingAccessor QuerySpelling(SyllableId spelling_id);
 
@@ -91,7 +119,11 @@ class Prism : public MappedFile {
  private:
   unique_ptr<Darts::DoubleArray> trie_;
   prism::Metadata* metadata_ = nullptr;
+  bool LookupCompletions(size_t node_pos,
+                         std::vector<Match>* result, size_t limit);
+
   prism::SpellingMap* spelling_map_ = nullptr;
+  prism::CompletionIndex* completion_index_ = nullptr;
   double format_ = 0.0;
 };
 
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <map>
+#include <mutex>
 #include <string>
 #include <rime/common.h>
 #include <rime/component.h>
@@ -50,6 +51,11 @@ class ReverseDb : public MappedFile {
              const Vocabulary& vocabulary,
              const ReverseLookupTable& stems,
              uint32_t dict_file_checksum);
+  // words maps text of each word to its syllables
+  bool Build(DictSettings* settings,
+             const ReverseLookupTable& words,
+             const ReverseLookupTable& stems,
+             uint32_t dict_file_checksum);
 
   uint32_t dict_file_checksum() const;
   reverse::Metadata* metadata() const { return metadata_; }
@@ -80,6 +86,7 @@ class ReverseLookupDictionaryComponent
   ReverseLookupDictionaryComponent();
   ReverseLookupDictionary* Create(const Ticket& ticket);
  private:
+  std::mutex mutex_;
   std::map<std::string, weak_ptr<ReverseDb>> db_pool_;
 };
 
@@ -8,6 +8,8 @@
 #ifndef RIME_STRING_TABLE_H_
 #define RIME_STRING_TABLE_H_
 
+#include <stdint.h>
+#include <atomic>
 #include <string>
 #include <utility>
 #include <vector>
@@ -20,11 +22,46 @@ using StringId = marisa::UInt32;
 
 const StringId kInvalidStringId = (StringId)(-1);
 
+// a bounded, direct-mapped cache of decoded strings, safe to share between
+// threads without locking.
+// a string that collides with a cached one takes its slot, unless the
+// cached string has been hit since; each hit buys a string another
+// collision, up to kMaxHits.
+class StringCache {
+ public:
+  // longer strings are not cached
+  static const size_t kMaxLength = 31;
+  static const uint8_t kMaxHits = 3;
+
+  explicit StringCache(size_t capacity);
+
+  bool Get(StringId string_id, std::string* value) const;
+  void Put(StringId string_id, const char* str, size_t length);
+
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  // the length byte followed by the string
+  static const size_t kNumWords = (kMaxLength + 1) / sizeof(uint64_t);
+
+  struct Slot {
+    // odd while the slot is being written; readers retry on change
+    std::atomic<uint32_t> sequence;
+    std::atomic<StringId> string_id;
+    std::atomic<uint8_t> hits;
+    std::atomic<uint64_t> words[kNumWords];
+  };
+
+  unique_ptr<Slot[]> slots_;
+  size_t mask_ = 0;
+};
+
 class StringTable {
  public:
   StringTable() = default;
   virtual ~StringTable() = default;
-  StringTable(const char* ptr, size_t size);
+  // a cache of decoded strings is created if cache_capacity is non-zero.
+  StringTable(const char* ptr, size_t size, size_t cache_capacity = 0);
 
   bool HasKey(const std::string& key);
   StringId Lookup(const std::string& key);
@@ -39,6 +76,7 @@ class StringTable {
 
  protected:
   marisa::Trie trie_;
+  unique_ptr<StringCache> cache_;
 };
 
 class StringTableBuilder: public StringTable {
@@ -9,6 +9,7 @@
 #define RIME_TABLE_H_
 
 #include <cstring>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -48,32 +49,123 @@ struct LongEntry {
   Entry entry;
 };
 
-union PhraseIndex;
+// Rime::Table/5.0
+// weights are quantized to the upper half of a float, keeping the sign,
+// the exponent and 7 bits of mantissa, which preserves their order.
+using CompactWeight = uint16_t;
+
+inline CompactWeight QuantizeWeight(double weight) {
+  float x = static_cast<float>(weight);
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  // round to nearest even
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return static_cast<CompactWeight>(bits >> 16);
+}
+
+inline Weight DequantizeWeight(CompactWeight weight) {
+  uint32_t bits = static_cast<uint32_t>(weight) << 16;
+  float x;
+  std::memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+// a run of entries of a code, stored as an array of Entry, or in the v5
+// format, as blocks of texts followed by quantized weights; the first few
+// entries of a code are in the hot region, the rest in the cold region.
+class EntryRun {
+ public:
+  EntryRun() = default;
+  EntryRun(const Entry* entries) : entries_(entries) {}
+  EntryRun(const StringType* hot_texts, const CompactWeight* hot_weights,
+           size_t hot_size,
+           const StringType* cold_texts, const CompactWeight* cold_weights)
+      : hot_texts_(hot_texts), hot_weights_(hot_weights),
+        cold_texts_(cold_texts), cold_weights_(cold_weights),
+        hot_size_(hot_size) {
+  }
+
+  explicit operator bool() const {
+    return entries_ || hot_texts_ || cold_texts_;
+  }
+  const StringType& text(size_t i) const {
+    if (entries_)
+      return entries_[i].text;
+    return i < hot_size_ ? hot_texts_[i] : cold_texts_[i - hot_size_];
+  }
+  Weight weight(size_t i) const {
+    if (entries_)
+      return entries_[i].weight;
+    return DequantizeWeight(i < hot_size_ ? hot_weights_[i] :
+                            cold_weights_[i - hot_size_]);
+  }
+  // the run of entries from the n-th on
+  EntryRun Skip(size_t n) const;
+  // entries stored as an array of Entry, or nullptr
+  const Entry* entries() const { return entries_; }
 
-struct HeadIndexNode {
-  List<Entry> entries;
-  OffsetPtr<PhraseIndex> next_level;
+ private:
+  const Entry* entries_ = nullptr;
+  const StringType* hot_texts_ = nullptr;
+  const CompactWeight* hot_weights_ = nullptr;
+  const StringType* cold_texts_ = nullptr;
+  const CompactWeight* cold_weights_ = nullptr;
+  size_t hot_size_ = 0;
 };
 
-using HeadIndex = Array<HeadIndexNode>;
+// index nodes are linked by offsets of 32 bits, or 64 bits in tables
+// beyond the reach of the former.
+template <class Offset>
+union BasicPhraseIndex;
 
-struct TrunkIndexNode {
-  SyllableId key;
-  List<Entry> entries;
-  OffsetPtr<PhraseIndex> next_level;
+template <class Offset>
+struct BasicHeadIndexNode {
+  List<Entry, uint32_t, Offset> entries;
+  OffsetPtr<BasicPhraseIndex<Offset>, Offset> next_level;
 };
 
-using TrunkIndex = Array<TrunkIndexNode>;
+template <class Offset>
+struct BasicTrunkIndexNode {
+  SyllableId key;
+  List<Entry, uint32_t, Offset> entries;
+  OffsetPtr<BasicPhraseIndex<Offset>, Offset> next_level;
+};
 
+// extra codes of long entries are allocated right after the tail index,
+// within reach of 32-bit offsets in either case.
 using TailIndex = Array<LongEntry>;
 
-union PhraseIndex {
-  TrunkIndex trunk;
+template <class Offset>
+union BasicPhraseIndex {
+  Array<BasicTrunkIndexNode<Offset>> trunk;
   TailIndex tail;
 };
 
+using HeadIndexNode = BasicHeadIndexNode<int32_t>;
+using HeadIndex = Array<HeadIndexNode>;
+using TrunkIndexNode = BasicTrunkIndexNode<int32_t>;
+using TrunkIndex = Array<TrunkIndexNode>;
+using PhraseIndex = BasicPhraseIndex<int32_t>;
 using Index = HeadIndex;
 
+// Rime::Table/3.0
+using HeadIndexNode64 = BasicHeadIndexNode<int64_t>;
+using HeadIndex64 = Array<HeadIndexNode64>;
+using TrunkIndexNode64 = BasicTrunkIndexNode<int64_t>;
+using TrunkIndex64 = Array<TrunkIndexNode64>;
+using PhraseIndex64 = BasicPhraseIndex<int64_t>;
+using Index64 = HeadIndex64;
+
+// Rime::Table/4.0
+// keys of a trunk index are stored apart from its nodes, in a contiguous
+// array that is searched a vector of keys at a time.
+struct KeyedTrunkIndex {
+  uint32_t size;
+  OffsetPtr<SyllableId> keys;
+  // entries and next levels, in the order of keys
+  OffsetPtr<HeadIndexNode> nodes;
+};
+
 struct Metadata {
   static const int kFormatMaxLength = 32;
   char format[kFormatMaxLength];
@@ -83,37 +175,84 @@ struct Metadata {
   OffsetPtr<Syllabary> syllabary;
   OffsetPtr<Index> index;
   // v2
-  int32_t reserved_1;
+  uint32_t num_hot_entries;  // v5
   int32_t reserved_2;
   OffsetPtr<char> string_table;
   uint32_t string_table_size;
 };
 
+// v3: tables larger than 2GB
+struct Metadata64 {
+  static const int kFormatMaxLength = 32;
+  char format[kFormatMaxLength];
+  uint32_t dict_file_checksum;
+  uint32_t num_syllables;
+  uint32_t num_entries;
+  uint32_t reserved;
+  OffsetPtr<Syllabary, int64_t> syllabary;
+  OffsetPtr<Index64, int64_t> index;
+  OffsetPtr<char, int64_t> string_table;
+  uint64_t string_table_size;
+};
+
 }  // namespace table
 
+// index code of limited length, stored inline to save heap allocations.
+class IndexCode {
+ public:
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const SyllableId* begin() const { return data_; }
+  const SyllableId* end() const { return data_ + size_; }
+  SyllableId operator[] (size_t i) const { return data_[i]; }
+  void push_back(SyllableId syllable_id) { data_[size_++] = syllable_id; }
+  void pop_back() { --size_; }
+  void clear() { size_ = 0; }
+  Code ToCode() const;
+
+ private:
+  SyllableId data_[Code::kIndexCodeMaxLength];
+  size_t size_ = 0;
+};
+
 class TableAccessor {
  public:
   TableAccessor() = default;
-  TableAccessor(const Code& index_code, const List<table::Entry>* entries,
+  template <class Offset>
+  TableAccessor(const IndexCode& index_code,
+                const List<table::Entry, uint32_t, Offset>* entries,
+                double credibility = 1.0)
+      : index_code_(index_code),
+        entries_(entries->at.get()),
+        size_(entries->size),
+        credibility_(credibility) {
+  }
+  TableAccessor(const IndexCode& index_code, const table::EntryRun& entries,
+                size_t size, double credibility = 1.0);
+  TableAccessor(const IndexCode& index_code, const Array<table::Entry>* entries,
                 double credibility = 1.0);
-  TableAccessor(const Code& index_code, const Array<table::Entry>* entries,
-                double credibility = 1.0);
-  TableAccessor(const Code& index_code, const table::TailIndex* code_map,
+  TableAccessor(const IndexCode& index_code, const table::TailIndex* code_map,
                 double credibility = 1.0);
 
   bool Next();
 
   bool exhausted() const;
   size_t remaining() const;
+  // the current entry, unless entries are compact
   const table::Entry* entry() const;
+  // the text and weight of the current entry, compact or not
+  const table::StringType* text() const;
+  table::Weight weight() const;
+  // entries from the current one on, excluding long entries
+  table::EntryRun remaining_entries() const;
   const table::Code* extra_code() const;
-  const Code& index_code() const { return index_code_; }
+  const IndexCode& index_code() const { return index_code_; }
   Code code() const;
   double credibility() const { return credibility_; }
 
  private:
-  Code index_code_;
-  const table::Entry* entries_ = nullptr;
+  IndexCode index_code_;
+  table::EntryRun entries_;
   const table::LongEntry* long_entries_ = nullptr;
   size_t size_ = 0;
   size_t cursor_ = 0;
@@ -122,11 +261,122 @@ class TableAccessor {
 
 using TableQueryResult = std::map<int, std::vector<TableAccessor>>;
 
+// state of walking down the table index, copied by value.
+class TableQuery {
+ public:
+  TableQuery(table::Index* index,
+             bool keyed_trunk_index = false,
+             size_t num_hot_entries = 0)
+      : keyed_(keyed_trunk_index),
+        num_hot_entries_(num_hot_entries),
+        lv1_index_(index) {
+    Reset();
+  }
+  TableQuery(table::Index64* index) : wide_(true), lv1_index_(index) {
+    Reset();
+  }
+
+  TableAccessor Access(SyllableId syllable_id,
+                       double credibility = 1.0) const;
+
+  // down to next level
+  bool Advance(SyllableId syllable_id, double credibility = 1.0);
+
+  // up one level
+  bool Backdate();
+
+  // back to root
+  void Reset();
+
+  size_t level() const { return level_; }
+
+ protected:
+  size_t level_ = 0;
+  IndexCode index_code_;
+  double credibility_[Code::kIndexCodeMaxLength + 1];
+
+ private:
+  bool Walk(SyllableId syllable_id);
+  template <class Offset>
+  bool WalkIndex(SyllableId syllable_id);
+  template <class Offset>
+  TableAccessor AccessIndex(SyllableId syllable_id, double credibility) const;
+  bool WalkKeyedIndex(SyllableId syllable_id);
+  TableAccessor AccessKeyedIndex(SyllableId syllable_id,
+                                 double credibility) const;
+  template <class Offset>
+  TableAccessor AccessEntries(
+      SyllableId syllable_id,
+      const List<table::Entry, uint32_t, Offset>* entries,
+      double credibility) const;
+
+  // whether the index is linked by 64-bit offsets
+  bool wide_ = false;
+  // whether trunk indexes are of table::KeyedTrunkIndex
+  bool keyed_ = false;
+  // number of compact entries of a code in the hot region; 0 if entries
+  // are not compact
+  size_t num_hot_entries_ = 0;
+  // head and trunk indexes, of either table::Index or table::Index64
+  const void* lv1_index_ = nullptr;
+  const void* lv2_index_ = nullptr;
+  const void* lv3_index_ = nullptr;
+  const table::TailIndex* lv4_index_ = nullptr;
+};
+
+// working memory of Table::Query(), which holds query results in a flat
+// buffer ordered by end position.
+// reusing an arena across queries saves most heap allocations.
+class TableQueryArena {
+ public:
+  struct Match {
+    size_t end_pos;
+    TableAccessor accessor;
+  };
+  using Matches = std::vector<Match>;
+
+  void Clear();
+
+  Matches& matches() { return matches_; }
+  const Matches& matches() const { return matches_; }
+
+ private:
+  friend class Table;
+  void SortMatches();
+
+  std::vector<std::pair<size_t, TableQuery>> queue_;
+  Matches found_;
+  Matches matches_;
+  std::vector<size_t> offsets_;
+};
+
 struct SyllableGraph;
-class TableQuery;
+
+// yields the vocabulary page of each head syllable, in ascending order of
+// syllable ids. pages are read twice, measuring then building the table.
+class VocabularyPageSource {
+ public:
+  virtual ~VocabularyPageSource() = default;
+  // starts over from the first page
+  virtual bool Rewind() = 0;
+  // returns false when there are no more pages
+  virtual bool Next(SyllableId* syllable_id, VocabularyPage* page) = 0;
+};
 
 class Table : public MappedFile {
  public:
+  static const size_t kDefaultStringCacheCapacity = 4096;
+  // the format read by all versions of librime since 1.0
+  static constexpr double kDefaultFormatVersion = 2.0;
+  // keys of trunk indexes stored apart speed up lookups in large tables
+  static constexpr double kKeyedTrunkFormatVersion = 4.0;
+  // compact entries save memory at the cost of precision of weights
+  static constexpr double kCompactFormatVersion = 5.0;
+  // number of compact entries of a code stored in the hot region
+  static const size_t kNumHotEntries = 10;
+  // the reach of 32-bit offsets
+  static const size_t kDefaultLargeTableThreshold = 0x7fffffff;
+
   Table(const std::string& file_name);
   virtual ~Table();
 
@@ -136,32 +386,80 @@ class Table : public MappedFile {
              const Vocabulary& vocabulary,
              size_t num_entries,
              uint32_t dict_file_checksum = 0);
+  // builds the table one head syllable at a time, so that the vocabulary
+  // needn't be in memory as a whole.
+  bool Build(const Syllabary& syllabary,
+             VocabularyPageSource* source,
+             size_t num_entries,
+             uint32_t dict_file_checksum = 0);
 
   bool GetSyllabary(Syllabary* syllabary);
   std::string GetSyllableById(int syllable_id);
   TableAccessor QueryWords(int syllable_id);
   TableAccessor QueryPhrases(const Code& code);
+  // if horizon is given, it receives the farthest position in the syllable
+  // graph the query has examined.
+  bool Query(const SyllableGraph& syll_graph,
+             size_t start_pos,
+             TableQueryArena* arena,
+             size_t* horizon = NULL);
   bool Query(const SyllableGraph& syll_graph,
              size_t start_pos,
-             TableQueryResult* result);
+             TableQueryResult* result,
+             size_t* horizon = NULL);
   std::string GetEntryText(const table::Entry& entry);
+  std::string GetEntryText(const table::StringType& text);
 
   uint32_t dict_file_checksum() const;
+  // version of the format of the loaded table
+  double format_version() const;
+
+  // capacity of the cache of decoded entry texts; 0 disables the cache.
+  // takes effect on next load.
+  void set_string_cache_capacity(size_t capacity) {
+    string_cache_capacity_ = capacity;
+  }
+  // file size beyond which a table is built in the v3 format,
+  // whose index is linked by 64-bit offsets.
+  void set_large_table_threshold(size_t threshold) {
+    large_table_threshold_ = threshold;
+  }
+  // format in which tables within the large table threshold are built;
+  // defaults to kDefaultFormatVersion.
+  void set_format_version(double format_version) {
+    format_version_ = format_version;
+  }
 
  private:
-  table::Index* BuildIndex(const Vocabulary& vocabulary,
-                           size_t num_syllables);
-  table::HeadIndex* BuildHeadIndex(const Vocabulary& vocabulary,
-                                   size_t num_syllables);
-  table::TrunkIndex* BuildTrunkIndex(const Code& prefix,
-                                     const Vocabulary& vocabulary);
+  template <class Metadata, class Offset>
+  bool BuildContents(Metadata* metadata,
+                     Array<table::BasicHeadIndexNode<Offset>>** index,
+                     const Syllabary& syllabary,
+                     VocabularyPageSource* source,
+                     size_t num_entries,
+                     uint32_t dict_file_checksum);
+  template <class Offset>
+  Array<table::BasicHeadIndexNode<Offset>>* BuildHeadIndex(
+      VocabularyPageSource* source, size_t num_syllables);
+  template <class Offset>
+  Array<table::BasicTrunkIndexNode<Offset>>* BuildTrunkIndex(
+      const Code& prefix, const Vocabulary& vocabulary);
+  table::KeyedTrunkIndex* BuildKeyedTrunkIndex(const Code& prefix,
+                                               const Vocabulary& vocabulary);
   table::TailIndex* BuildTailIndex(const Code& prefix,
                                    const Vocabulary& vocabulary);
   bool BuildPhraseIndex(Code code, const Vocabulary& vocabulary,
                         std::map<std::string, int>* index_data);
   Array<table::Entry>* BuildEntryArray(const DictEntryList& entries);
-  bool BuildEntryList(const DictEntryList& src, List<table::Entry>* dest);
+  template <class Offset>
+  bool BuildEntryList(const DictEntryList& src,
+                      List<table::Entry, uint32_t, Offset>* dest);
   bool BuildEntry(const DictEntry& dict_entry, table::Entry* entry);
+  template <class Offset>
+  bool BuildCompactEntryList(const DictEntryList& src,
+                             List<table::Entry, uint32_t, Offset>* dest);
+  bool BuildCompactEntries(const DictEntryList& src,
+                           size_t first, size_t count, char* block);
 
   std::string GetString_v1(const table::StringType& x);
   bool AddString_v1(const std::string& src, table::StringType* dest,
@@ -174,13 +472,27 @@ class Table : public MappedFile {
   bool OnBuildStart_v2();
   bool OnBuildFinish_v2();
   bool OnLoad_v2();
+  char* SaveStringTable(size_t* image_size);
+
+  // v3
+  bool OnBuildFinish_v3();
+  bool OnLoad_v3();
+
+  // v5
+  bool OnBuildFinish_v5();
+  bool OnLoad_v5();
+  bool CreateEntryRegions(size_t hot_region_size, size_t cold_region_size);
 
   void SelectTableFormat(double format_version);
+  TableQuery NewQuery() const;
 
  protected:
   table::Metadata* metadata_ = nullptr;
   table::Syllabary* syllabary_ = nullptr;
   table::Index* index_ = nullptr;
+  // v3
+  table::Metadata64* metadata64_ = nullptr;
+  table::Index64* index64_ = nullptr;
 
   struct TableFormat {
     const char* format_name;
@@ -192,11 +504,27 @@ class Table : public MappedFile {
     bool (Table::*OnBuildStart)();
     bool (Table::*OnBuildFinish)();
     bool (Table::*OnLoad)();
+
+    bool keyed_trunk_index;
+    bool compact_entries;
   } format_;
 
   // v2
   unique_ptr<StringTable> string_table_;
   unique_ptr<StringTableBuilder> string_table_builder_;
+  // ids of strings in the order they are added, found in the first pass
+  std::deque<StringId> string_ids_;
+  size_t next_string_ = 0;
+  // v5
+  size_t num_hot_entries_ = 0;
+  // where compact entries are allocated next, while building
+  char* hot_region_ = nullptr;
+  char* hot_region_end_ = nullptr;
+  char* cold_region_ = nullptr;
+  char* cold_region_end_ = nullptr;
+  size_t string_cache_capacity_ = kDefaultStringCacheCapacity;
+  size_t large_table_threshold_ = kDefaultLargeTableThreshold;
+  double format_version_ = kDefaultFormatVersion;
 };
 
 }  // namespace rime
@@ -10,11 +10,41 @@
 #include <functional>
 #include <string>
 #include <vector>
+#include <boost/range/iterator_range.hpp>
+#include <rime/common.h>
 
 namespace rime {
 
 using Tsv = std::vector<std::string>;
 
+// a view of characters in a file read by TsvScanner
+using TsvField = boost::iterator_range<const char*>;
+
+// reads lines of tab separated fields from a file read into memory at once,
+// without copying them. the file is not memory mapped, for users could edit
+// it meanwhile, and a mapped file truncated underneath crashes the reader.
+class TsvScanner {
+ public:
+  explicit TsvScanner(const std::string& path);
+  ~TsvScanner();
+
+  // gets the next line, with trailing white space trimmed.
+  // the line is valid during the lifetime of the scanner.
+  bool GetLine(TsvField* line);
+  // splits a line at tabs
+  static void Split(const TsvField& line, std::vector<TsvField>* fields);
+
+  bool ok() const { return ok_; }
+  int line_no() const { return line_no_; }
+
+ private:
+  std::string buffer_;
+  const char* pos_ = nullptr;
+  const char* end_ = nullptr;
+  bool ok_ = false;
+  int line_no_ = 0;
+};
+
 using TsvParser = std::function<bool (const Tsv& row,
                                       std::string* key,
                                       std::string* value)>;
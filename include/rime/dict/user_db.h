@@ -15,6 +15,8 @@ namespace rime {
 
 using TickCount = uint64_t;
 
+class Db;
+
 struct UserDbValue {
   int commits = 0;
   double dee = 0.0;
@@ -23,10 +25,22 @@ struct UserDbValue {
   UserDbValue() = default;
   UserDbValue(const std::string& value);
 
-  std::string Pack() const;
+  // the text layout reads 'c=<commits> d=<dee> t=<tick>';
+  // the binary layout is a version byte followed by little-endian
+  // int32 commits, float64 dee and uint64 tick.
+  std::string Pack(bool binary = false) const;
+  // accepts either layout
   bool Unpack(const std::string& value);
+
+  static bool IsBinary(const std::string& value);
+
+  static const char kBinaryVersion = 1;
+  static const size_t kBinarySize = 1 + 4 + 8 + 8;
 };
 
+// whether the db stores values in the binary layout.
+bool UsesBinaryValues(Db* db);
+
 template <class BaseDb>
 class UserDb : public BaseDb {
  public:
@@ -43,6 +57,7 @@ class UserDb : public BaseDb {
 
   static const std::string extension;
   static const std::string snapshot_extension;
+  static const std::string value_format;
 };
 
 class UserDbMerger : public Sink {
@@ -57,6 +72,7 @@ class UserDbMerger : public Sink {
 
  protected:
   Db* db_;
+  bool binary_values_;
   TickCount our_tick_;
   TickCount their_tick_;
   TickCount max_tick_;
@@ -72,6 +88,7 @@ class UserDbImporter : public Sink {
 
  protected:
   Db* db_;
+  bool binary_values_;
 };
 
 }  // namespace rime
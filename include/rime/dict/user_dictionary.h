@@ -8,8 +8,15 @@
 #define RIME_USER_DICTIONARY_H_
 
 #include <time.h>
+#include <condition_variable>
+#include <future>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <rime/common.h>
 #include <rime/component.h>
 #include <rime/dict/user_db.h>
@@ -46,24 +53,159 @@ class Schema;
 class Table;
 class Prism;
 class Db;
+class DbAccessor;
 struct SyllableGraph;
 struct DfsState;
 struct Ticket;
 
+// an in-memory copy of user db entries in a trie keyed by syllable ids,
+// saving UserDictionary::Lookup() the string building and db cursor seeks.
+// it is built for the syllabary of one table, and shared among dictionaries
+// writing to the same user db.
+class UserDictIndex {
+ public:
+  struct Record {
+    std::string text;
+    UserDbValue value;
+  };
+  struct Node {
+    // sorted by syllable id; second is the offset of the child node
+    std::vector<std::pair<SyllableId, size_t>> children;
+    // sorted by text, in the same order as the records in user db
+    std::vector<Record> records;
+  };
+
+  UserDictIndex() = default;
+
+  // whether the index is usable with the table, ie. either not built or
+  // built for the table. an index built for a table no longer in use is
+  // dropped, to be rebuilt for the current one.
+  bool Accepts(const shared_ptr<Table>& table);
+  bool Build(DbAccessor* records, const shared_ptr<Table>& table);
+  // keeps a built index in sync with an updated user db record.
+  // returns false if the key is not made of syllables in the table.
+  bool Update(const std::string& key, const UserDbValue& value);
+  void Clear();
+
+  const Node* Find(const Node* node, SyllableId syllable_id) const;
+  const Node* root() const { return built() ? &nodes_[0] : nullptr; }
+  bool built() const { return !nodes_.empty(); }
+  size_t size() const { return num_records_; }
+  // to be held while looking up in or updating the index, which may be
+  // shared by dictionaries of sessions in different threads.
+  std::mutex& mutex() { return mutex_; }
+
+ protected:
+  bool ParseCode(const std::string& code_str, Code* code) const;
+
+  std::vector<Node> nodes_;
+  size_t num_records_ = 0;
+  std::unordered_map<std::string, SyllableId> syllable_ids_;
+  weak_ptr<Table> table_;
+  std::mutex mutex_;
+};
+
+// keeps records learnt by user dictionaries in memory, and writes them to
+// the user db in batches, in a background thread.
+// it is shared among dictionaries writing to the same user db, where the
+// db supports concurrent access.
+class UserDbWriteQueue {
+ public:
+  // records pending to be written, by key
+  using Records = std::map<std::string, std::string>;
+
+  static const size_t kMaxPendingRecords = 100;
+  static const time_t kDefaultFlushInterval = 5;  // seconds
+
+  // committed records are written at most flush_interval seconds later,
+  // by a timer, even if the user stays idle.
+  explicit UserDbWriteQueue(const shared_ptr<Db>& db,
+                            time_t flush_interval = kDefaultFlushInterval);
+  ~UserDbWriteQueue();
+
+  bool Fetch(const std::string& key, std::string* value);
+  void Update(const std::string& key, const std::string& value);
+  bool FetchTick(TickCount* tick);
+  void UpdateTick(TickCount tick);
+  // wraps an accessor to the db with pending records merged in.
+  shared_ptr<DbAccessor> Merge(const shared_ptr<DbAccessor>& accessor,
+                               const std::string& prefix);
+
+  // changes made in a transaction are not written until committed.
+  void BeginTransaction();
+  bool AbortTransaction();
+  void CommitTransaction();
+  bool in_transaction();
+
+  // flushes when enough records are pending, or flush_interval seconds
+  // after the last flush.
+  void FlushIfDue();
+  // writes committed records to the db. unless waiting for the result,
+  // it returns at once, or does nothing if the last flush is still going.
+  void Flush(bool wait);
+  size_t size();
+  time_t flush_interval() const { return flush_interval_; }
+
+ private:
+  struct Record {
+    std::string value;
+    uint64_t version;
+  };
+  struct Batch {
+    std::vector<std::pair<std::string, Record>> records;
+    bool has_tick = false;
+    TickCount tick = 0;
+  };
+  // requires flush_mutex_
+  void StartFlush(bool wait);
+  void Write(const Batch& batch);
+  void RunTimer();
+
+  shared_ptr<Db> db_;
+  time_t flush_interval_;
+  std::mutex mutex_;
+  std::map<std::string, Record> records_;
+  uint64_t last_version_ = 0;
+  // records changed in the transaction; second.first tells if there was
+  // a pending record before the transaction.
+  std::map<std::string, std::pair<bool, Record>> journal_;
+  bool in_transaction_ = false;
+  bool has_tick_ = false;
+  TickCount tick_ = 0;
+  bool had_tick_ = false;
+  TickCount tick_before_ = 0;
+  shared_ptr<Records> snapshot_;
+  // guards the following, for dictionaries flushing from different threads
+  std::mutex flush_mutex_;
+  std::future<void> work_;
+  time_t last_flush_time_ = 0;
+  // wakes up every flush_interval_ to flush records committed since
+  std::thread timer_;
+  std::mutex timer_mutex_;
+  std::condition_variable timer_stopped_;
+  bool stopping_ = false;
+};
+
 class UserDictionary : public Class<UserDictionary, const Ticket&> {
  public:
-  explicit UserDictionary(const shared_ptr<Db>& db);
+  explicit UserDictionary(const shared_ptr<Db>& db,
+                          const shared_ptr<UserDictIndex>& index = nullptr,
+                          const shared_ptr<UserDbWriteQueue>& queue = nullptr);
   virtual ~UserDictionary();
 
   void Attach(const shared_ptr<Table>& table, const shared_ptr<Prism>& prism);
   bool Load();
   bool loaded() const;
   bool readonly() const;
+  // looks up phrases in the in-memory index rather than the user db.
+  void EnableIndex(bool enable) { index_enabled_ = enable; }
 
+  // see Dictionary::Lookup() for the meaning of horizon.
   shared_ptr<UserDictEntryCollector> Lookup(const SyllableGraph& syllable_graph,
                                             size_t start_pos,
                                             size_t depth_limit = 0,
-                                            double initial_credibility = 1.0);
+                                            double initial_credibility = 1.0,
+                                            size_t* horizon = NULL);
   size_t LookupWords(UserDictEntryIterator* result,
                      const std::string& input,
                      bool predictive,
@@ -90,14 +232,24 @@ class UserDictionary : public Class<UserDictionary, const Ticket&> {
  protected:
   bool Initialize();
   bool FetchTickCount();
+  shared_ptr<DbAccessor> Query(const std::string& key);
+  shared_ptr<DbAccessor> QueryAll();
+  bool PrepareIndex();
   bool TranslateCodeToString(const Code& code, std::string* result);
   void DfsLookup(const SyllableGraph& syll_graph, size_t current_pos,
                  const std::string& current_prefix,
                  DfsState* state);
+  void IndexLookup(const SyllableGraph& syll_graph, size_t current_pos,
+                   const UserDictIndex::Node* node,
+                   DfsState* state);
 
  private:
   std::string name_;
   shared_ptr<Db> db_;
+  shared_ptr<UserDictIndex> index_;
+  shared_ptr<UserDbWriteQueue> queue_;
+  bool index_enabled_ = false;
+  bool binary_values_ = false;
   shared_ptr<Table> table_;
   shared_ptr<Prism> prism_;
   TickCount tick_ = 0;
@@ -109,7 +261,11 @@ class UserDictionaryComponent : public UserDictionary::Component {
   UserDictionaryComponent();
   UserDictionary* Create(const Ticket& ticket);
  private:
+  // sessions in different threads may create dictionaries at a time
+  std::mutex mutex_;
   std::map<std::string, weak_ptr<Db>> db_pool_;
+  std::map<std::string, weak_ptr<UserDictIndex>> index_pool_;
+  std::map<std::string, weak_ptr<UserDbWriteQueue>> queue_pool_;
 };
 
 }  // namespace rime
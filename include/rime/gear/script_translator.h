@@ -23,12 +23,21 @@ struct DictEntryCollector;
 class Dictionary;
 class UserDictionary;
 struct SyllableGraph;
+struct ScriptLookupCache;
+class ScriptTranslation;
 
 class ScriptTranslator : public Translator,
                          public Memory,
                          public TranslatorOptions {
  public:
+  struct LookupStats {
+    size_t lookups = 0;
+    // of which made for a previous input
+    size_t reused = 0;
+  };
+
   ScriptTranslator(const Ticket& ticket);
+  virtual ~ScriptTranslator();
 
   virtual shared_ptr<Translation> Query(const std::string& input,
                                         const Segment& segment,
@@ -40,9 +49,26 @@ class ScriptTranslator : public Translator,
 
   // options
   int spelling_hints() const { return spelling_hints_; }
+  bool enable_incremental_lookup() const {
+    return enable_incremental_lookup_;
+  }
+  const LookupStats& lookup_stats() const { return lookup_stats_; }
 
  protected:
+  friend class ScriptTranslation;
+  void ClearLookupCache();
+  void OnLookup(bool reused);
+
   int spelling_hints_ = 0;
+  bool enable_incremental_lookup_ = false;
+  // dictionary lookups from the last query, reused as the input is edited
+  shared_ptr<ScriptLookupCache> lookup_cache_;
+  LookupStats lookup_stats_;
+
+ private:
+  connection commit_connection_;
+  connection delete_connection_;
+  connection unhandled_key_connection_;
 };
 
 }  // namespace rime
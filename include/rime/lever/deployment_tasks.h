@@ -8,6 +8,7 @@
 #define RIME_DEPLOYMENT_TASKS_H_
 
 #include <string>
+#include <vector>
 #include <rime/deployer.h>
 
 namespace rime {
@@ -25,6 +26,13 @@ class WorkspaceUpdate : public DeploymentTask {
   WorkspaceUpdate(TaskInitializer arg = TaskInitializer()) {}
   bool Run(Deployer* deployer);
 
+  // runs SchemaUpdate tasks, in parallel with Deployer::max_parallel_jobs
+  // threads, adding up results.
+  static void RunSchemaUpdates(Deployer* deployer,
+                               const std::vector<std::string>& schema_files,
+                               int* success,
+                               int* failure);
+
  protected:
   std::string GetSchemaPath(Deployer* deployer,
                             const std::string& schema_id,
@@ -13,6 +13,7 @@
 
 namespace rime {
 
+class Db;
 class Deployer;
 
 using UserDictList = std::vector<std::string>;
@@ -36,6 +37,8 @@ class UserDictManager {
   bool SynchronizeAll();
 
  protected:
+  bool ConvertToBinaryValues(Db* db);
+
   Deployer* deployer_;
   boost::filesystem::path path_;
 };
@@ -40,6 +40,8 @@ class Menu {
   // CAVEAT: returns the number of candidates currently obtained,
   // rather than the total number of available candidates.
   size_t candidate_count() const { return candidates_.size(); }
+  // whether there are no more candidates to obtain than candidate_count()
+  bool exhausted() const { return translations_.empty(); }
 
   bool empty() const {
     return translations_.empty() && candidates_.empty();
@@ -9,9 +9,13 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <map>
 #include <mutex>
+#include <string>
+#include <vector>
 #include <rime/common.h>
 #include <rime/deployer.h>
 
@@ -28,14 +32,45 @@ using NotificationHandler = std::function<void (SessionId session_id,
 class Context;
 class Engine;
 class KeyEvent;
+class KeySequence;
 class Schema;
 
+// memory for the output lent to the client by the api, valid until reset.
+// the blocks used before a reset are merged, so that once warmed up, it
+// serves every call from a single block.
+class OutputArena {
+ public:
+  void Reset();
+  template <class T>
+  T* Allocate(size_t count = 1);
+  char* CopyString(const std::string& str);
+  // bytes held in all blocks
+  size_t capacity() const;
+
+ private:
+  char* AllocateBytes(size_t size, size_t alignment);
+
+  std::vector<std::pair<unique_ptr<char[]>, size_t>> blocks_;
+  size_t used_ = 0;
+};
+
+template <class T>
+T* OutputArena::Allocate(size_t count) {
+  char* ptr = AllocateBytes(sizeof(T) * count, alignof(T));
+  std::fill(ptr, ptr + sizeof(T) * count, 0);
+  return reinterpret_cast<T*>(ptr);
+}
+
 class Session {
  public:
   static const int kLifeSpan = 5 * 60;  // seconds
 
   Session();
   bool ProcessKey(const KeyEvent& key_event);
+  // processes keys in a batch, composing only when the composition is needed
+  // and after the last key. returns the number of keys handled; if told to,
+  // stops after the first key not handled.
+  size_t ProcessKeys(const KeySequence& keys, bool stop_at_unhandled_key);
   void Activate();
   void ResetCommitText();
   bool CommitComposition();
@@ -46,13 +81,24 @@ class Session {
   Schema* schema() const;
   time_t last_active_time() const { return last_active_time_; }
   const std::string& commit_text() const { return commit_text_; }
+  // hands over the commit text, which is kept until the next time.
+  const std::string& TakeCommitText();
+  OutputArena& context_arena() { return context_arena_; }
+  OutputArena& candidate_arena() { return candidate_arena_; }
+  // to be held while calling the session, which may be shared by threads.
+  // it is recursive since notification handlers may call back into the api.
+  std::recursive_mutex& mutex() { return mutex_; }
 
  private:
   void OnCommit(const std::string& commit_text);
 
   unique_ptr<Engine> engine_;
-  time_t last_active_time_ = 0;
+  std::atomic<time_t> last_active_time_{0};
   std::string commit_text_;
+  std::string taken_commit_text_;
+  OutputArena context_arena_;
+  OutputArena candidate_arena_;
+  std::recursive_mutex mutex_;
 };
 
 class Service {
@@ -83,11 +129,20 @@ class Service {
   Service();
 
   using SessionMap = std::map<SessionId, shared_ptr<Session>>;
-  SessionMap sessions_;
+  // sessions are spread over shards, each guarded by its own mutex,
+  // so that threads working on different sessions seldom contend.
+  struct SessionShard {
+    std::mutex mutex;
+    SessionMap sessions;
+  };
+  static const size_t kNumSessionShards = 16;
+  SessionShard& shard(SessionId session_id);
+
+  SessionShard session_shards_[kNumSessionShards];
   Deployer deployer_;
   NotificationHandler notification_handler_;
-  std::mutex mutex_;
-  bool started_ = false;
+  std::recursive_mutex notification_mutex_;
+  std::atomic<bool> started_{false};
 };
 
 }  // namespace rime
@@ -164,6 +164,11 @@ typedef struct rime_schema_list_t {
   RimeSchemaListItem* list;
 } RimeSchemaList;
 
+typedef struct rime_key_event_t {
+  int keycode;
+  int mask;
+} RimeKeyEvent;
+
 typedef void (*RimeNotificationHandler)(void* context_object,
                                         RimeSessionId session_id,
                                         const char* message_type,
@@ -199,6 +204,13 @@ RIME_API void RimeSetupLogging(const char* app_name);
  *   handler will be called with context_object as the first parameter
  *   every time an event occurs in librime, until RimeFinalize() is called.
  *   when handler is NULL, notification is disabled.
+ *
+ *   threading: calls to handler are serialized, even when sessions are
+ *   driven from several threads. it runs on the thread that caused the
+ *   event, and may call back into the API on that thread. it should not
+ *   wait for another thread that is using the API, or it may deadlock.
+ *   once RimeSetNotificationHandler(NULL, NULL) or RimeFinalize() has
+ *   returned, handler is no longer called and context_object may be freed.
  */
 RIME_API void RimeSetNotificationHandler(RimeNotificationHandler handler,
                                          void* context_object);
@@ -236,6 +248,22 @@ RIME_API void RimeCleanupAllSessions();
 // Input
 
 RIME_API Bool RimeProcessKey(RimeSessionId session_id, int keycode, int mask);
+//! Process a batch of keys, eg. replayed from an input buffer
+/*!
+ *  keys are processed in order, until one of them is not handled by librime;
+ *  the front end should pass that key on to the application, then call again
+ *  with the keys after it.
+ *  the input is only composed after the last key, or when a processor needs
+ *  the candidates.
+ *  returns the number of keys handled. if it is less than num_keys, the key
+ *  at that index has been processed but not handled.
+ *  if context is not NULL, it receives the resulting context as if by
+ *  RimeGetContext(), and should be freed with RimeFreeContext().
+ */
+RIME_API size_t RimeProcessKeys(RimeSessionId session_id,
+                                const RimeKeyEvent* keys,
+                                size_t num_keys,
+                                RimeContext* context);
 /*!
  * return True if there is unread commit text
  */
@@ -251,6 +279,29 @@ RIME_API Bool RimeFreeContext(RimeContext* context);
 RIME_API Bool RimeGetStatus(RimeSessionId session_id, RimeStatus* status);
 RIME_API Bool RimeFreeStatus(RimeStatus* status);
 
+//! Output lent by the session, without copying
+/*!
+ *  the peek functions fill in the same structures as their get counterparts,
+ *  but the data pointed to is kept by the session and must not be freed.
+ *  it stays valid until the next call to the same function for the session,
+ *  or to any function that modifies the session, eg. RimeProcessKey().
+ *  once warmed up, these functions make no memory allocation per call.
+ */
+RIME_API Bool RimePeekContext(RimeSessionId session_id, RimeContext* context);
+//! takes the commit text, as RimeGetCommit() does
+RIME_API Bool RimePeekCommit(RimeSessionId session_id, RimeCommit* commit);
+RIME_API Bool RimePeekStatus(RimeSessionId session_id, RimeStatus* status);
+//! candidates of the current segment, without paging
+/*!
+ *  fills in candidates[0..n) with the candidates at start_index onwards,
+ *  where n is at most max_count, and returns n.
+ *  candidates are obtained from the translators as far as needed.
+ */
+RIME_API size_t RimePeekCandidates(RimeSessionId session_id,
+                                   size_t start_index,
+                                   size_t max_count,
+                                   RimeCandidate* candidates);
+
 // Runtime options
 
 RIME_API void RimeSetOption(RimeSessionId session_id, const char* option, Bool value);
@@ -486,6 +537,19 @@ typedef struct rime_api_t {
   //! select a candidate from current page
   Bool (*select_candidate)(RimeSessionId session_id, size_t index);
 
+  size_t (*process_keys)(RimeSessionId session_id,
+                         const RimeKeyEvent* keys,
+                         size_t num_keys,
+                         RimeContext* context);
+
+  Bool (*peek_context)(RimeSessionId session_id, RimeContext* context);
+  Bool (*peek_commit)(RimeSessionId session_id, RimeCommit* commit);
+  Bool (*peek_status)(RimeSessionId session_id, RimeStatus* status);
+  size_t (*peek_candidates)(RimeSessionId session_id,
+                            size_t start_index,
+                            size_t max_count,
+                            RimeCandidate* candidates);
+
 } RimeApi;
 
 //! API entry
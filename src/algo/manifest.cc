@@ -0,0 +1,174 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <fstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <rime_version.h>
+#include <rime/common.h>
+#include <rime/algo/manifest.h>
+#include <rime/algo/utilities.h>
+
+namespace rime {
+
+static const char* kChecksumKeyPrefix = "checksum:";
+
+FileStamp FileStamp::Of(const std::string& file_name) {
+  FileStamp stamp;
+  stamp.file_name = file_name;
+  boost::system::error_code ec;
+  auto size = boost::filesystem::file_size(file_name, ec);
+  if (ec)
+    return stamp;
+  auto modified_time = boost::filesystem::last_write_time(file_name, ec);
+  if (ec)
+    return stamp;
+  stamp.size = static_cast<intmax_t>(size);
+  stamp.modified_time = modified_time;
+  return stamp;
+}
+
+Manifest::Manifest(const std::string& file_name) : file_name_(file_name) {
+}
+
+// the manifest is a text file, each line of which records an entry:
+// key, checksum, then file name, size and modified time of each file,
+// all separated by tabs.
+bool Manifest::Load() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  loaded_ = false;
+  return LoadIfNeeded();
+}
+
+bool Manifest::LoadIfNeeded() {
+  if (loaded_)
+    return true;
+  loaded_ = true;
+  entries_.clear();
+  std::ifstream fin(file_name_.c_str());
+  if (!fin)
+    return false;
+  std::string line;
+  if (!getline(fin, line) || line != std::string("#@rime_version\t") +
+      RIME_VERSION) {
+    // recorded by another version, which may build different files
+    LOG(INFO) << "discarding manifest: " << file_name_;
+    return false;
+  }
+  std::vector<std::string> row;
+  while (getline(fin, line)) {
+    boost::algorithm::split(row, line, boost::algorithm::is_any_of("\t"));
+    if (row.size() < 2 || (row.size() - 2) % 3 != 0)
+      continue;
+    Entry entry;
+    try {
+      entry.checksum = boost::lexical_cast<uint32_t>(row[1]);
+      for (size_t i = 2; i < row.size(); i += 3) {
+        FileStamp stamp;
+        stamp.file_name = row[i];
+        stamp.size = boost::lexical_cast<intmax_t>(row[i + 1]);
+        stamp.modified_time = boost::lexical_cast<std::time_t>(row[i + 2]);
+        entry.files.push_back(stamp);
+      }
+    }
+    catch (...) {
+      LOG(WARNING) << "invalid manifest entry: " << row[0];
+      continue;
+    }
+    entries_[row[0]] = entry;
+  }
+  return true;
+}
+
+bool Manifest::Save() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!modified_)
+    return true;
+  LOG(INFO) << "saving manifest: " << file_name_;
+  std::ofstream fout(file_name_.c_str());
+  fout << "#@rime_version\t" << RIME_VERSION << std::endl;
+  for (const auto& x : entries_) {
+    fout << x.first << '\t' << x.second.checksum;
+    for (const auto& stamp : x.second.files) {
+      fout << '\t' << stamp.file_name
+           << '\t' << stamp.size
+           << '\t' << stamp.modified_time;
+    }
+    fout << std::endl;
+  }
+  fout.close();
+  if (!fout) {
+    LOG(ERROR) << "error saving manifest: " << file_name_;
+    return false;
+  }
+  modified_ = false;
+  return true;
+}
+
+Manifest::Entry Manifest::CreateEntry(
+    const std::vector<std::string>& file_names) const {
+  Entry entry;
+  // a file modified as late as now could change again within the same
+  // second, unnoticed; such stamps are made not to match next time.
+  std::time_t now = std::time(NULL);
+  for (const auto& file_name : file_names) {
+    auto stamp = FileStamp::Of(file_name);
+    if (stamp.size != -1 && stamp.modified_time >= now - 1)
+      stamp.modified_time = -1;
+    entry.files.push_back(stamp);
+  }
+  return entry;
+}
+
+bool Manifest::IsUnchanged(const Entry& entry) const {
+  for (const auto& stamp : entry.files) {
+    if (stamp.modified_time == -1 || !(FileStamp::Of(stamp.file_name) == stamp))
+      return false;
+  }
+  return true;
+}
+
+uint32_t Manifest::Checksum(const std::vector<std::string>& file_names) {
+  std::string key(kChecksumKeyPrefix + boost::algorithm::join(file_names, "|"));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LoadIfNeeded();
+    auto found = entries_.find(key);
+    if (found != entries_.end() && IsUnchanged(found->second))
+      return found->second.checksum;
+  }
+  // stamp the files before reading them, so that any change in the course
+  // would be detected next time.
+  Entry entry(CreateEntry(file_names));
+  ChecksumComputer cc;
+  for (const auto& file_name : file_names) {
+    cc.ProcessFile(file_name);
+  }
+  entry.checksum = cc.Checksum();
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[key] = entry;
+  modified_ = true;
+  return entry.checksum;
+}
+
+void Manifest::Record(const std::string& task_key,
+                      const std::vector<std::string>& file_names) {
+  Entry entry(CreateEntry(file_names));
+  std::lock_guard<std::mutex> lock(mutex_);
+  LoadIfNeeded();
+  entries_[task_key] = entry;
+  modified_ = true;
+}
+
+bool Manifest::IsUpToDate(const std::string& task_key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LoadIfNeeded();
+  auto found = entries_.find(task_key);
+  return found != entries_.end() && IsUnchanged(found->second);
+}
+
+}  // namespace rime
@@ -5,15 +5,226 @@
 // 2011-07-12 Zou Xu <zouivex@gmail.com>
 // 2012-02-11 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
 #include <queue>
 #include <utility>
 #include <vector>
-#include <boost/range/adaptor/reversed.hpp>
 #include <rime/dict/prism.h>
 #include <rime/algo/syllabifier.h>
 
 namespace rime {
 
+SpellingIndex::const_iterator
+SpellingIndex::find(SyllableId syllable_id) const {
+  auto it = std::lower_bound(
+      begin_, end_, syllable_id,
+      [](const SyllableSpellings& syllable, SyllableId id) {
+        return syllable.syllable_id < id;
+      });
+  if (it == end_ || it->syllable_id != syllable_id)
+    it = end_;
+  return const_iterator(it, spellings_);
+}
+
+SpellingPropertiesList
+SpellingIndex::operator[] (SyllableId syllable_id) const {
+  auto it = find(syllable_id);
+  return it != end() ? (*it).second : SpellingPropertiesList();
+}
+
+SpellingType SyllableGraph::last_vertex_type() const {
+  for (auto it = vertices_.rbegin(); it != vertices_.rend(); ++it) {
+    if (*it != kInvalidSpelling)
+      return *it;
+  }
+  return kInvalidSpelling;
+}
+
+SpellingIndex SyllableGraph::spellings(size_t start_pos) const {
+  if (start_pos + 1 >= offsets_.size())
+    return SpellingIndex();
+  return SpellingIndex(syllables_.data() + offsets_[start_pos],
+                       syllables_.data() + offsets_[start_pos + 1],
+                       spellings_.data());
+}
+
+void SyllableGraph::clear() {
+  input_length = 0;
+  interpreted_length = 0;
+  vertices_.clear();
+  num_vertices_ = 0;
+  num_spelt_vertices_ = 0;
+  offsets_.clear();
+  syllables_.clear();
+  spellings_.clear();
+}
+
+void SyllableGraphBuilder::AddVertex(size_t pos, SpellingType type) {
+  if (pos >= vertices_.size())
+    vertices_.resize(pos + 1, kInvalidSpelling);
+  vertices_[pos] = type;
+}
+
+void SyllableGraphBuilder::AddSpelling(size_t start_pos,
+                                       SyllableId syllable_id,
+                                       SpellingProperties props) {
+  spellings_.push_back({start_pos, syllable_id, std::move(props)});
+}
+
+void SyllableGraphBuilder::Build(SyllableGraph* graph) {
+  size_t num_positions = vertices_.size();
+  for (const Spelling& x : spellings_) {
+    num_positions = (std::max)(num_positions, x.start_pos + 1);
+  }
+  // spellings are bucketed by start position, then sorted by syllable id
+  // and farther end positions first; keys are sorted rather than the
+  // spellings, which are moved once.
+  struct Key {
+    SyllableId syllable_id;
+    size_t end_pos;
+    uint32_t index;
+    bool operator< (const Key& other) const {
+      if (syllable_id != other.syllable_id)
+        return syllable_id < other.syllable_id;
+      if (end_pos != other.end_pos)
+        return end_pos > other.end_pos;
+      return index < other.index;
+    }
+  };
+  std::vector<uint32_t> buckets(num_positions + 1);
+  for (const Spelling& x : spellings_) {
+    ++buckets[x.start_pos + 1];
+  }
+  for (size_t pos = 0; pos < num_positions; ++pos) {
+    buckets[pos + 1] += buckets[pos];
+  }
+  std::vector<Key> keys(spellings_.size());
+  {
+    std::vector<uint32_t> next(buckets.begin(), buckets.end() - 1);
+    for (uint32_t i = 0; i < spellings_.size(); ++i) {
+      const Spelling& x(spellings_[i]);
+      keys[next[x.start_pos]++] = {x.syllable_id, x.properties.end_pos, i};
+    }
+  }
+  graph->vertices_.swap(vertices_);
+  graph->vertices_.resize(num_positions, kInvalidSpelling);
+  graph->num_vertices_ = std::count_if(
+      graph->vertices_.begin(), graph->vertices_.end(),
+      [](SpellingType type) { return type != kInvalidSpelling; });
+  graph->num_spelt_vertices_ = 0;
+  graph->offsets_.assign(num_positions + 1, 0);
+  graph->syllables_.clear();
+  graph->syllables_.reserve(spellings_.size());
+  graph->spellings_.clear();
+  graph->spellings_.reserve(spellings_.size());
+  for (size_t pos = 0; pos < num_positions; ++pos) {
+    graph->offsets_[pos] = graph->syllables_.size();
+    auto first = keys.begin() + buckets[pos];
+    auto last = keys.begin() + buckets[pos + 1];
+    if (first == last)
+      continue;
+    ++graph->num_spelt_vertices_;
+    std::sort(first, last);
+    for (auto key = first; key != last; ++key) {
+      if (key != first && key[-1].syllable_id == key->syllable_id &&
+          key[-1].end_pos == key->end_pos)
+        continue;  // a duplicate
+      if (key == first || key[-1].syllable_id != key->syllable_id) {
+        uint32_t next = graph->spellings_.size();
+        graph->syllables_.push_back({key->syllable_id, next, next});
+      }
+      graph->spellings_.push_back(
+          std::move(spellings_[key->index].properties));
+      ++graph->syllables_.back().end;
+    }
+  }
+  graph->offsets_[num_positions] = graph->syllables_.size();
+  vertices_.clear();
+  spellings_.clear();
+}
+
+namespace {
+
+// the graph while the syllabifier builds and prunes it.
+// edges from a vertex take a range of edges, in order of end positions;
+// the spellings of an edge take a range of spellings.
+struct DraftEdge {
+  size_t end_pos;
+  size_t begin;
+  size_t end;
+  bool removed;
+};
+
+struct DraftSpelling {
+  SyllableId syllable_id;
+  SpellingProperties properties;
+};
+
+struct SyllableGraphDraft {
+  // by position
+  std::vector<SpellingType> vertices;
+  std::vector<std::pair<size_t, size_t>> edge_ranges;
+  std::vector<DraftEdge> edges;
+  std::vector<DraftSpelling> spellings;
+  // by syllable id, 1 + the edge the syllable was last spelt on
+  std::vector<size_t> spelt_on;
+
+  explicit SyllableGraphDraft(size_t input_length)
+      : vertices(input_length + 1, kInvalidSpelling),
+        edge_ranges(input_length + 1) {}
+  DraftEdge* edges_begin(size_t pos) {
+    return edges.data() + edge_ranges[pos].first;
+  }
+  DraftEdge* edges_end(size_t pos) {
+    return edges.data() + edge_ranges[pos].second;
+  }
+  // whether the syllable is not yet spelt on the edge to be added next;
+  // keeps the first spelling of a syllable on each edge.
+  bool FirstSpelling(SyllableId syllable_id) {
+    if (syllable_id >= spelt_on.size())
+      spelt_on.resize(syllable_id + 1);
+    if (spelt_on[syllable_id] == edges.size() + 1)
+      return false;
+    spelt_on[syllable_id] = edges.size() + 1;
+    return true;
+  }
+  bool has_edges(size_t pos) {
+    for (auto e = edges_begin(pos); e != edges_end(pos); ++e) {
+      if (!e->removed)
+        return true;
+    }
+    return false;
+  }
+};
+
+}  // namespace
+
+// a spelling removed from the draft
+static const SpellingType kRemovedSpelling = kInvalidSpelling;
+
+static void CheckOverlappedSpellings(SyllableGraphDraft* draft,
+                                     size_t start, size_t end) {
+  // TODO: more cases to handle...
+  // if "Z" = "YX", mark the vertex between Y and X an ambiguous syllable joint
+  // enumerate Ys
+  for (auto y = draft->edges_begin(start); y != draft->edges_end(start); ++y) {
+    if (y->removed) continue;
+    size_t joint = y->end_pos;
+    if (joint >= end) break;
+    // test X
+    for (auto x = draft->edges_begin(joint);
+         x != draft->edges_end(joint); ++x) {
+      if (x->removed) continue;
+      if (x->end_pos < end) continue;
+      if (x->end_pos == end) {
+        draft->vertices[joint] = kAmbiguousSpelling;
+        DLOG(INFO) << "ambiguous syllable joint at position " << joint << ".";
+      }
+      break;
+    }
+  }
+}
+
 using Vertex = std::pair<size_t, SpellingType>;
 using VertexQueue = std::priority_queue<Vertex,
                                         std::vector<Vertex>,
@@ -26,8 +237,10 @@ int Syllabifier::BuildSyllableGraph(const std::string &input,
     return 0;
 
   size_t farthest = 0;
+  SyllableGraphDraft draft(input.length());
   VertexQueue queue;
   queue.push(Vertex{0, kNormalSpelling});  // start
+  std::vector<Prism::Match> matches;
 
   while (!queue.empty()) {
     Vertex vertex(queue.top());
@@ -35,120 +248,133 @@ int Syllabifier::BuildSyllableGraph(const std::string &input,
     size_t current_pos = vertex.first;
 
     // record a visit to the vertex
-    if (graph->vertices.find(current_pos) == graph->vertices.end())
-      graph->vertices.insert(vertex);  // preferred spelling type comes first
-    else
-      continue;  // discard worse spelling types
+    // preferred spelling type comes first; discard worse spelling types
+    if (draft.vertices[current_pos] != kInvalidSpelling)
+      continue;
+    draft.vertices[current_pos] = vertex.second;
 
     if (current_pos > farthest)
       farthest = current_pos;
     DLOG(INFO) << "current_pos: " << current_pos;
 
     // see where we can go by advancing a syllable
-    std::vector<Prism::Match> matches;
-    prism.CommonPrefixSearch(input.substr(current_pos), &matches);
-    if (!matches.empty()) {
-      auto& end_vertices(graph->edges[current_pos]);
-      for (const auto& m : matches) {
-        if (m.length == 0) continue;
-        size_t end_pos = current_pos + m.length;
-        // consume trailing delimiters
-        while (end_pos < input.length() &&
-               delimiters_.find(input[end_pos]) != std::string::npos)
-          ++end_pos;
-        DLOG(INFO) << "end_pos: " << end_pos;
-        bool matches_input = (current_pos == 0 && end_pos == input.length());
-        SpellingMap spellings;
-        SpellingType end_vertex_type = kInvalidSpelling;
-        // when spelling algebra is enabled,
-        // a spelling evaluates to a set of syllables;
-        // otherwise, it resembles exactly the syllable itself.
-        SpellingAccessor accessor(prism.QuerySpelling(m.value));
-        while (!accessor.exhausted()) {
-          SyllableId syllable_id = accessor.syllable_id();
-          SpellingProperties props = accessor.properties();
-          if (strict_spelling_ &&
-              matches_input &&
-              props.type != kNormalSpelling) {
-            // disqualify fuzzy spelling or abbreviation as single word
-          }
-          else {
-            props.end_pos = end_pos;
-            // add a syllable with properties to the edge's
-            // spelling-to-syllable map
-            spellings.insert({syllable_id, props});
-            // let end_vertex_type be the best (smaller) type of spelling
-            // that ends at the vertex
-            if (end_vertex_type > props.type) {
-              end_vertex_type = props.type;
-            }
-          }
-          accessor.Next();
-        }
-        if (spellings.empty()) {
-          DLOG(INFO) << "not spelt.";
-          continue;
+    matches.clear();
+    prism.CommonPrefixSearch(input.c_str() + current_pos,
+                             input.length() - current_pos,
+                             &matches);
+    // vertices are visited in order of position, so edges of a vertex
+    // are added after those of all vertices before it.
+    size_t first_edge = draft.edges.size();
+    for (const auto& m : matches) {
+      if (m.length == 0) continue;
+      size_t end_pos = current_pos + m.length;
+      // consume trailing delimiters
+      while (end_pos < input.length() &&
+             delimiters_.find(input[end_pos]) != std::string::npos)
+        ++end_pos;
+      DLOG(INFO) << "end_pos: " << end_pos;
+      bool matches_input = (current_pos == 0 && end_pos == input.length());
+      size_t first_spelling = draft.spellings.size();
+      SpellingType end_vertex_type = kInvalidSpelling;
+      // when spelling algebra is enabled,
+      // a spelling evaluates to a set of syllables;
+      // otherwise, it resembles exactly the syllable itself.
+      SpellingAccessor accessor(prism.QuerySpelling(m.value));
+      while (!accessor.exhausted()) {
+        SyllableId syllable_id = accessor.syllable_id();
+        SpellingProperties props = accessor.properties();
+        if (strict_spelling_ &&
+            matches_input &&
+            props.type != kNormalSpelling) {
+          // disqualify fuzzy spelling or abbreviation as single word
         }
-        end_vertices[end_pos].swap(spellings);
-        // find the best common type in a path up to the end vertex
-        // eg. pinyin "shurfa" has vertex type kNormalSpelling at position 3,
-        // kAbbreviation at position 4 and kAbbreviation at position 6
-        if (end_vertex_type < vertex.second) {
-          end_vertex_type = vertex.second;
+        else if (draft.FirstSpelling(syllable_id)) {
+          props.end_pos = end_pos;
+          // let end_vertex_type be the best (smaller) type of spelling
+          // that ends at the vertex
+          if (end_vertex_type > props.type) {
+            end_vertex_type = props.type;
+          }
+          // add a syllable with properties to the edge's spellings
+          draft.spellings.push_back({syllable_id, std::move(props)});
         }
-        queue.push(Vertex{end_pos, end_vertex_type});
-        DLOG(INFO) << "added to syllable graph, edge: ["
-                   << current_pos << ", " << end_pos << ")";
+        accessor.Next();
+      }
+      if (draft.spellings.size() == first_spelling) {
+        DLOG(INFO) << "not spelt.";
+        continue;
+      }
+      // an edge to the same end vertex is replaced
+      for (size_t i = first_edge; i < draft.edges.size(); ++i) {
+        if (draft.edges[i].end_pos == end_pos)
+          draft.edges[i].removed = true;
+      }
+      draft.edges.push_back(
+          {end_pos, first_spelling, draft.spellings.size(), false});
+      // find the best common type in a path up to the end vertex
+      // eg. pinyin "shurfa" has vertex type kNormalSpelling at position 3,
+      // kAbbreviation at position 4 and kAbbreviation at position 6
+      if (end_vertex_type < vertex.second) {
+        end_vertex_type = vertex.second;
       }
+      queue.push(Vertex{end_pos, end_vertex_type});
+      DLOG(INFO) << "added to syllable graph, edge: ["
+                 << current_pos << ", " << end_pos << ")";
     }
+    std::stable_sort(draft.edges.begin() + first_edge, draft.edges.end(),
+                     [](const DraftEdge& a, const DraftEdge& b) {
+                       return a.end_pos < b.end_pos;
+                     });
+    draft.edge_ranges[current_pos] = {first_edge, draft.edges.size()};
   }
 
   DLOG(INFO) << "remove stale vertices and edges";
-  std::set<int> good;
-  good.insert(farthest);
+  std::vector<bool> good(farthest + 1);
+  good[farthest] = true;
   // fuzzy spellings are immune to invalidation by normal spellings
-  SpellingType last_type = (std::max)(graph->vertices[farthest],
+  SpellingType last_type = (std::max)(draft.vertices[farthest],
                                       kFuzzySpelling);
   for (int i = farthest - 1; i >= 0; --i) {
-    if (graph->vertices.find(i) == graph->vertices.end())
+    if (draft.vertices[i] == kInvalidSpelling)
       continue;
     // remove stale edges
-    for (auto j = graph->edges[i].begin(); j != graph->edges[i].end(); ) {
-      if (good.find(j->first) == good.end()) {
+    for (auto j = draft.edges_begin(i); j != draft.edges_end(i); ++j) {
+      if (j->removed)
+        continue;
+      if (!good[j->end_pos]) {
         // not connected
-        graph->edges[i].erase(j++);
+        j->removed = true;
         continue;
       }
       // remove disqualified syllables (eg. matching abbreviated spellings)
       // when there is a path of more favored type
       SpellingType edge_type = kInvalidSpelling;
-      for (auto k = j->second.begin(); k != j->second.end(); ) {
-        if (k->second.type > last_type) {
-          j->second.erase(k++);
+      for (size_t k = j->begin; k < j->end; ++k) {
+        SpellingType& type(draft.spellings[k].properties.type);
+        if (type > last_type) {
+          type = kRemovedSpelling;
         }
-        else {
-          if (k->second.type < edge_type)
-            edge_type = k->second.type;
-          ++k;
+        else if (type < edge_type) {
+          edge_type = type;
         }
       }
-      if (j->second.empty()) {
-        graph->edges[i].erase(j++);
+      if (edge_type == kInvalidSpelling) {
+        j->removed = true;
       }
-      else {
-        if (edge_type < kAbbreviation)
-          CheckOverlappedSpellings(graph, i, j->first);
-        ++j;
+      else if (edge_type < kAbbreviation) {
+        CheckOverlappedSpellings(&draft, i, j->end_pos);
       }
     }
-    if (graph->vertices[i] > last_type || graph->edges[i].empty()) {
+    if (draft.vertices[i] > last_type || !draft.has_edges(i)) {
       DLOG(INFO) << "remove stale vertex at " << i;
-      graph->vertices.erase(i);
-      graph->edges.erase(i);
+      draft.vertices[i] = kInvalidSpelling;
+      for (auto j = draft.edges_begin(i); j != draft.edges_end(i); ++j) {
+        j->removed = true;
+      }
       continue;
     }
     // keep the valid vetex
-    good.insert(i);
+    good[i] = true;
   }
 
   if (enable_completion_ && farthest < input.length()) {
@@ -160,8 +386,7 @@ int Syllabifier::BuildSyllableGraph(const std::string &input,
       size_t current_pos = farthest;
       size_t end_pos = input.length();
       size_t code_length = end_pos - current_pos;
-      auto& end_vertices(graph->edges[current_pos]);
-      auto& spellings(end_vertices[end_pos]);
+      size_t first_spelling = draft.spellings.size();
       for (const auto& m : keys) {
         if (m.length < code_length) continue;
         // when spelling algebra is enabled,
@@ -171,22 +396,26 @@ int Syllabifier::BuildSyllableGraph(const std::string &input,
         while (!accessor.exhausted()) {
           SyllableId syllable_id = accessor.syllable_id();
           SpellingProperties props = accessor.properties();
-          if (props.type < kAbbreviation) {
+          if (props.type < kAbbreviation &&
+              draft.FirstSpelling(syllable_id)) {
             props.type = kCompletion;
             props.credibility *= 0.5;
             props.end_pos = end_pos;
-            // add a syllable with properties to the edge's
-            // spelling-to-syllable map
-            spellings.insert({syllable_id, props});
+            // add a syllable with properties to the edge's spellings
+            draft.spellings.push_back({syllable_id, std::move(props)});
           }
           accessor.Next();
         }
       }
-      if (spellings.empty()) {
+      if (draft.spellings.size() == first_spelling) {
         DLOG(INFO) << "no completion could be made.";
-        end_vertices.erase(end_pos);
       }
       else {
+        // the farthest vertex has no edges of its own
+        size_t first_edge = draft.edges.size();
+        draft.edges.push_back(
+            {end_pos, first_spelling, draft.spellings.size(), false});
+        draft.edge_ranges[current_pos] = {first_edge, draft.edges.size()};
         DLOG(INFO) << "added to syllable graph, completion: ["
                    << current_pos << ", " << end_pos << ")";
         farthest = end_pos;
@@ -194,52 +423,31 @@ int Syllabifier::BuildSyllableGraph(const std::string &input,
     }
   }
 
+  // lay out the graph in flat arrays
+  SyllableGraphBuilder builder;
+  builder.Reserve(draft.spellings.size());
+  for (size_t i = 0; i < draft.vertices.size(); ++i) {
+    if (draft.vertices[i] == kInvalidSpelling)
+      continue;
+    builder.AddVertex(i, draft.vertices[i]);
+    for (auto j = draft.edges_begin(i); j != draft.edges_end(i); ++j) {
+      if (j->removed)
+        continue;
+      for (size_t k = j->begin; k < j->end; ++k) {
+        auto& spelling(draft.spellings[k]);
+        if (spelling.properties.type != kRemovedSpelling)
+          builder.AddSpelling(i, spelling.syllable_id,
+                              std::move(spelling.properties));
+      }
+    }
+  }
+  builder.Build(graph);
   graph->input_length = input.length();
   graph->interpreted_length = farthest;
   DLOG(INFO) << "input length: " << graph->input_length;
   DLOG(INFO) << "syllabified length: " << graph->interpreted_length;
 
-  Transpose(graph);
-
   return farthest;
 }
 
-void Syllabifier::CheckOverlappedSpellings(SyllableGraph *graph,
-                                           size_t start, size_t end) {
-  // TODO: more cases to handle...
-  if (!graph || graph->edges.find(start) == graph->edges.end())
-    return;
-  // if "Z" = "YX", mark the vertex between Y and X an ambiguous syllable joint
-  auto& y_end_vertices(graph->edges[start]);
-  // enumerate Ys
-  for (const auto& y : y_end_vertices) {
-    size_t joint = y.first;
-    if (joint >= end) break;
-    // test X
-    if (graph->edges.find(joint) == graph->edges.end())
-      continue;
-    auto& x_end_vertices(graph->edges[joint]);
-    for (const auto& x : x_end_vertices) {
-      if (x.first < end) continue;
-      if (x.first == end) {
-        graph->vertices[joint] = kAmbiguousSpelling;
-        DLOG(INFO) << "ambiguous syllable joint at position " << joint << ".";
-      }
-      break;
-    }
-  }
-}
-
-void Syllabifier::Transpose(SyllableGraph* graph) {
-  for (const auto& start : graph->edges) {
-    auto& index(graph->indices[start.first]);
-    for (const auto& end : boost::adaptors::reverse(start.second)) {
-      for (const auto& spelling : end.second) {
-        SyllableId syll_id = spelling.first;
-        index[syll_id].push_back(&spelling.second);
-      }
-    }
-  }
-}
-
 }  // namespace rime
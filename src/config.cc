@@ -8,6 +8,7 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <mutex>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
@@ -54,6 +55,9 @@ class ConfigDataManager : public std::map<std::string, weak_ptr<ConfigData>> {
 
  private:
   ConfigDataManager() = default;
+
+  // config files are also loaded by deployment tasks in worker threads
+  std::mutex mutex_;
 };
 
 // ConfigValue members
@@ -606,15 +610,13 @@ Config* ConfigComponent::Create(const std::string& config_id) {
 // ConfigDataManager memebers
 
 ConfigDataManager& ConfigDataManager::instance() {
-  static unique_ptr<ConfigDataManager> s_instance;
-  if (!s_instance) {
-    s_instance.reset(new ConfigDataManager);
-  }
+  static unique_ptr<ConfigDataManager> s_instance(new ConfigDataManager);
   return *s_instance;
 }
 
 shared_ptr<ConfigData>
 ConfigDataManager::GetConfigData(const std::string& config_file_path) {
+  std::lock_guard<std::mutex> lock(mutex_);
   shared_ptr<ConfigData> sp;
   // keep a weak reference to the shared config data in the manager
   weak_ptr<ConfigData>& wp((*this)[config_file_path]);
@@ -630,6 +632,7 @@ ConfigDataManager::GetConfigData(const std::string& config_file_path) {
 }
 
 bool ConfigDataManager::ReloadConfigData(const std::string& config_file_path) {
+  std::lock_guard<std::mutex> lock(mutex_);
   iterator it = find(config_file_path);
   if (it == end()) {  // never loaded
     return false;
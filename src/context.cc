@@ -29,16 +29,19 @@ bool Context::Commit() {
 }
 
 std::string Context::GetCommitText() const {
+  UpdateIfPending();
   if (get_option("dumb"))
     return std::string();
   return composition_->GetCommitText();
 }
 
 std::string Context::GetScriptText() const {
+  UpdateIfPending();
   return composition_->GetScriptText();
 }
 
 void Context::GetPreedit(Preedit* preedit, bool soft_cursor) const {
+  UpdateIfPending();
   composition_->GetPreedit(preedit);
   preedit->caret_pos = preedit->text.length();
   if (IsComposing()) {
@@ -57,6 +60,10 @@ bool Context::IsComposing() const {
 }
 
 bool Context::HasMenu() const {
+  // no input, no menu after all
+  if (update_pending_ && !IsComposing())
+    return false;
+  UpdateIfPending();
   if (composition_->empty())
     return false;
   const auto& menu(composition_->back().menu);
@@ -72,7 +79,7 @@ bool Context::PushInput(char ch) {
     input_.insert(caret_pos_, 1, ch);
     ++caret_pos_;
   }
-  update_notifier_(this);
+  NotifyUpdate();
   return true;
 }
 
@@ -85,7 +92,7 @@ bool Context::PushInput(const std::string& str) {
     input_.insert(caret_pos_, str);
     caret_pos_ += str.length();
   }
-  update_notifier_(this);
+  NotifyUpdate();
   return true;
 }
 
@@ -94,7 +101,7 @@ bool Context::PopInput(size_t len) {
     return false;
   caret_pos_ -= len;
   input_.erase(caret_pos_, len);
-  update_notifier_(this);
+  NotifyUpdate();
   return true;
 }
 
@@ -102,7 +109,7 @@ bool Context::DeleteInput(size_t len) {
   if (caret_pos_ + len > input_.length())
     return false;
   input_.erase(caret_pos_, len);
-  update_notifier_(this);
+  NotifyUpdate();
   return true;
 }
 
@@ -110,10 +117,11 @@ void Context::Clear() {
   input_.clear();
   caret_pos_ = 0;
   composition_->clear();
-  update_notifier_(this);
+  NotifyUpdate();
 }
 
 bool Context::Select(size_t index) {
+  UpdateIfPending();
   if (composition_->empty())
     return false;
   Segment& seg(composition_->back());
@@ -128,6 +136,7 @@ bool Context::Select(size_t index) {
 }
 
 bool Context::DeleteCurrentSelection() {
+  UpdateIfPending();
   if (composition_->empty())
     return false;
   Segment& seg(composition_->back());
@@ -141,6 +150,7 @@ bool Context::DeleteCurrentSelection() {
 }
 
 bool Context::ConfirmCurrentSelection() {
+  UpdateIfPending();
   if (composition_->empty())
     return false;
   Segment& seg(composition_->back());
@@ -161,7 +171,20 @@ bool Context::ConfirmCurrentSelection() {
 }
 
 bool Context::ConfirmPreviousSelection() {
+  // segments selected are kept by a pending update, unless the input they
+  // cover is changed. so the update is left pending; segments that it would
+  // dispose of are passed over.
+  size_t kept_pos = std::string::npos;
+  if (update_pending_) {
+    const std::string& last_input(composition_->input());
+    kept_pos = 0;
+    while (kept_pos < last_input.length() && kept_pos < caret_pos_ &&
+           last_input[kept_pos] == input_[kept_pos])
+      ++kept_pos;
+  }
   for (auto it = composition_->rbegin(); it != composition_->rend(); ++it) {
+    if (it->end > kept_pos)
+      continue;
     if (it->status > Segment::kSelected) {
       return false;
     }
@@ -174,18 +197,20 @@ bool Context::ConfirmPreviousSelection() {
 }
 
 bool Context::ReopenPreviousSegment() {
+  UpdateIfPending();
   if (composition_->Trim()) {
     if (!composition_->empty() &&
         composition_->back().status >= Segment::kSelected) {
       composition_->back().status = Segment::kVoid;
     }
-    update_notifier_(this);
+    NotifyUpdate();
     return true;
   }
   return false;
 }
 
 bool Context::ClearPreviousSegment() {
+  UpdateIfPending();
   if (composition_->empty())
     return false;
   size_t where = composition_->back().start;
@@ -196,6 +221,7 @@ bool Context::ClearPreviousSegment() {
 }
 
 bool Context::ReopenPreviousSelection() {
+  UpdateIfPending();
   for (auto it = composition_->rbegin(); it != composition_->rend(); ++it) {
     if (it->status > Segment::kSelected)
       return false;
@@ -204,7 +230,7 @@ bool Context::ReopenPreviousSelection() {
       while (it != composition_->rbegin()) {
         composition_->pop_back();
       }
-      update_notifier_(this);
+      NotifyUpdate();
       return true;
     }
   }
@@ -212,6 +238,7 @@ bool Context::ReopenPreviousSelection() {
 }
 
 bool Context::ClearNonConfirmedComposition() {
+  UpdateIfPending();
   bool reverted = false;
   while (!composition_->empty() &&
          composition_->back().status < Segment::kSelected) {
@@ -227,7 +254,7 @@ bool Context::ClearNonConfirmedComposition() {
 
 bool Context::RefreshNonConfirmedComposition() {
   if (ClearNonConfirmedComposition()) {
-    update_notifier_(this);
+    NotifyUpdate();
     return true;
   }
   return false;
@@ -238,9 +265,36 @@ void Context::set_caret_pos(size_t caret_pos) {
     caret_pos_ = input_.length();
   else
     caret_pos_ = caret_pos;
+  NotifyUpdate();
+}
+
+void Context::DeferUpdates() {
+  ++deferred_updates_;
+}
+
+void Context::ResumeUpdates() {
+  if (deferred_updates_ > 0)
+    --deferred_updates_;
+  if (deferred_updates_ == 0)
+    UpdateIfPending();
+}
+
+void Context::NotifyUpdate() {
+  if (deferred_updates_ > 0) {
+    update_pending_ = true;
+    return;
+  }
   update_notifier_(this);
 }
 
+// the composition is brought up to date before being looked into.
+void Context::UpdateIfPending() const {
+  if (!update_pending_)
+    return;
+  update_pending_ = false;
+  update_notifier_(const_cast<Context*>(this));
+}
+
 void Context::set_composition(Composition* comp) {
   if (composition_.get() != comp)
     composition_.reset(comp);
@@ -250,14 +304,16 @@ void Context::set_composition(Composition* comp) {
 void Context::set_input(const std::string& value) {
   input_ = value;
   caret_pos_ = input_.length();
-  update_notifier_(this);
+  NotifyUpdate();
 }
 
 Composition* Context::composition() {
+  UpdateIfPending();
   return composition_.get();
 }
 
 const Composition* Context::composition() const {
+  UpdateIfPending();
   return composition_.get();
 }
 
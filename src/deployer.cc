@@ -9,6 +9,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <rime/deployer.h>
+#include <rime/algo/manifest.h>
 
 namespace rime {
 
@@ -28,6 +29,16 @@ std::string Deployer::user_data_sync_dir() const {
   return p.string();
 }
 
+Manifest* Deployer::manifest() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!manifest_) {
+    boost::filesystem::path p(user_data_dir);
+    p /= "deployment.manifest";
+    manifest_.reset(new Manifest(p.string()));
+  }
+  return manifest_.get();
+}
+
 bool Deployer::RunTask(const std::string& task_name, TaskInitializer arg) {
   auto c = DeploymentTask::Require(task_name);
   if (!c) {
@@ -39,7 +50,10 @@ bool Deployer::RunTask(const std::string& task_name, TaskInitializer arg) {
     LOG(ERROR) << "error creating deployment task: " << task_name;
     return false;
   }
-  return t->Run(this);
+  bool success = t->Run(this);
+  if (manifest_)
+    manifest_->Save();
+  return success;
 }
 
 bool Deployer::ScheduleTask(const std::string& task_name, TaskInitializer arg) {
@@ -92,6 +106,8 @@ bool Deployer::Run() {
         ++failure;
       //boost::this_thread::interruption_point();
     }
+    if (manifest_)
+      manifest_->Save();
     LOG(INFO) << success + failure << " tasks ran: "
               << success << " success, " << failure << " failure.";
     message_sink_("deploy", !failure ? "success" : "failure");
@@ -4,16 +4,19 @@
 //
 // 2011-11-27 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
 #include <fstream>
 #include <map>
 #include <set>
 #include <boost/filesystem.hpp>
+#include <rime/service.h>
 #include <rime/algo/algebra.h>
-#include <rime/algo/utilities.h>
+#include <rime/algo/manifest.h>
 #include <rime/dict/dictionary.h>
 #include <rime/dict/dict_compiler.h>
 #include <rime/dict/dict_settings.h>
 #include <rime/dict/entry_collector.h>
+#include <rime/dict/entry_spool.h>
 #include <rime/dict/preset_vocabulary.h>
 #include <rime/dict/prism.h>
 #include <rime/dict/table.h>
@@ -26,7 +29,15 @@ DictCompiler::DictCompiler(Dictionary *dictionary, DictFileFinder finder)
     : dict_name_(dictionary->name()),
       prism_(dictionary->prism()),
       table_(dictionary->table()),
-      dict_file_finder_(finder) {
+      dict_file_finder_(finder),
+      memory_budget_(EntrySpool::kDefaultMemoryBudget) {
+}
+
+// tells if an existing table is built in the requested format.
+// tables beyond the large table threshold are built in v3 regardless.
+static bool is_requested_format(double existing, double requested) {
+  int major = static_cast<int>(existing);
+  return major == static_cast<int>(requested) || major == 3;
 }
 
 bool DictCompiler::Compile(const std::string &schema_file) {
@@ -57,19 +68,18 @@ bool DictCompiler::Compile(const std::string &schema_file) {
       return false;
     dict_files.push_back(dict_file);
   }
+  // checksums are recorded in the manifest, and reused until files change
+  Manifest* manifest = Service::instance().deployer().manifest();
+  source_files_ = dict_files;
   uint32_t dict_file_checksum = 0;
   if (!dict_files.empty()) {
-    ChecksumComputer cc;
-    for (const auto& file_name : dict_files) {
-      cc.ProcessFile(file_name);
-    }
     if (settings.use_preset_vocabulary()) {
-      cc.ProcessFile(PresetVocabulary::DictFilePath());
+      source_files_.push_back(PresetVocabulary::DictFilePath());
     }
-    dict_file_checksum = cc.Checksum();
+    dict_file_checksum = manifest->Checksum(source_files_);
   }
   uint32_t schema_file_checksum =
-      schema_file.empty() ? 0 : Checksum(schema_file);
+      schema_file.empty() ? 0 : manifest->Checksum({schema_file});
   bool rebuild_table = true;
   bool rebuild_prism = true;
   if (table_->Exists() && table_->Load()) {
@@ -80,6 +90,14 @@ bool DictCompiler::Compile(const std::string &schema_file) {
     if (table_->dict_file_checksum() == dict_file_checksum) {
       rebuild_table = false;
     }
+    // as the options of the table format change
+    if (build_table_from_source &&
+        !is_requested_format(table_->format_version(),
+                             table_format_version())) {
+      LOG(INFO) << "table format changed: " << table_->format_version()
+                << " -> " << table_format_version();
+      rebuild_table = true;
+    }
     table_->Close();
   }
   else if (!build_table_from_source) {
@@ -125,6 +143,12 @@ bool DictCompiler::Compile(const std::string &schema_file) {
   return true;
 }
 
+double DictCompiler::table_format_version() const {
+  return compact_table_ ? Table::kCompactFormatVersion :
+      keyed_trunk_index_ ? Table::kKeyedTrunkFormatVersion :
+      Table::kDefaultFormatVersion;
+}
+
 std::string DictCompiler::FindDictFile(const std::string& dict_name) {
   std::string dict_file(dict_name + ".dict.yaml");
   if (dict_file_finder_) {
@@ -133,19 +157,117 @@ std::string DictCompiler::FindDictFile(const std::string& dict_name) {
   return dict_file;
 }
 
+namespace {
+
+// reads pages of the vocabulary from an entry spool, which yields entries
+// grouped by their first syllables, so that only a page of the vocabulary
+// is in memory at a time.
+class SpooledVocabulary : public VocabularyPageSource {
+ public:
+  SpooledVocabulary(EntrySpool* spool,
+                    std::map<std::string, SyllableId>& syllable_to_id,
+                    bool sort_homophones,
+                    ReverseLookupTable* words)
+      : spool_(spool),
+        syllable_to_id_(syllable_to_id),
+        sort_homophones_(sort_homophones),
+        words_(words) {
+  }
+  virtual bool Rewind();
+  virtual bool Next(SyllableId* head_id, VocabularyPage* page);
+
+ private:
+  EntrySpool* spool_;
+  std::map<std::string, SyllableId>& syllable_to_id_;
+  bool sort_homophones_;
+  // text -> syllables of words, collected while reading
+  ReverseLookupTable* words_;
+  RawDictEntry r_;
+  bool has_entry_ = false;
+};
+
+bool SpooledVocabulary::Rewind() {
+  if (!spool_->Rewind())
+    return false;
+  words_->clear();
+  has_entry_ = spool_->Get(&r_);
+  return true;
+}
+
+bool SpooledVocabulary::Next(SyllableId* head_id, VocabularyPage* page) {
+  Vocabulary vocabulary;
+  std::string head;
+  for (; has_entry_; has_entry_ = spool_->Get(&r_)) {
+    if (r_.raw_code.empty()) {
+      LOG(ERROR) << "Error locating entries in vocabulary.";
+      continue;
+    }
+    if (vocabulary.empty()) {
+      head = r_.raw_code[0];
+    }
+    else if (r_.raw_code[0] != head) {
+      break;
+    }
+    Code code;
+    for (const auto& s : r_.raw_code) {
+      code.push_back(syllable_to_id_[s]);
+    }
+    DictEntryList* ls = vocabulary.LocateEntries(code);
+    if (!ls) {
+      LOG(ERROR) << "Error locating entries in vocabulary.";
+      continue;
+    }
+    auto e = New<DictEntry>();
+    e->code.swap(code);
+    e->text.swap(r_.text);
+    e->weight = r_.weight;
+    ls->push_back(e);
+  }
+  if (vocabulary.empty())
+    return false;
+  if (sort_homophones_) {
+    vocabulary.SortHomophones();
+  }
+  *head_id = vocabulary.begin()->first;
+  *page = vocabulary.begin()->second;
+  for (const auto& e : page->entries) {
+    (*words_)[e->text].insert(head);
+  }
+  return true;
+}
+
+}  // namespace
+
 bool DictCompiler::BuildTable(DictSettings* settings,
                               const std::vector<std::string>& dict_files,
                               uint32_t dict_file_checksum) {
   LOG(INFO) << "building table...";
   EntryCollector collector;
   collector.Configure(settings);
-  collector.Collect(dict_files);
+  // entries beyond the memory budget are spilled to temporary files;
+  // those to be dumped are kept in memory until then.
+  EntrySpool spool(table_->file_name() + ".spool", memory_budget_);
+  if (!(options_ & kDump)) {
+    collector.spool = &spool;
+  }
+  if (!collector.Collect(dict_files)) {
+    LOG(ERROR) << "error collecting entries.";
+    return false;
+  }
   if (options_ & kDump) {
     boost::filesystem::path path(table_->file_name());
     path.replace_extension(".txt");
     collector.Dump(path.string());
+    for (const RawDictEntry& r : collector.entries) {
+      if (!spool.Put(r)) {
+        LOG(ERROR) << "error spooling entries.";
+        return false;
+      }
+    }
+    std::vector<RawDictEntry>().swap(collector.entries);
   }
-  Vocabulary vocabulary;
+  // text -> syllables of words, for reverse lookup
+  ReverseLookupTable words;
   // build .table.bin
   {
     std::map<std::string, SyllableId> syllable_to_id;
@@ -153,27 +275,11 @@ bool DictCompiler::BuildTable(DictSettings* settings,
     for (const auto& s : collector.syllabary) {
       syllable_to_id[s] = syllable_id++;
     }
-    for (RawDictEntry& r : collector.entries) {
-      Code code;
-      for (const auto& s : r.raw_code) {
-        code.push_back(syllable_to_id[s]);
-      }
-      DictEntryList* ls = vocabulary.LocateEntries(code);
-      if (!ls) {
-        LOG(ERROR) << "Error locating entries in vocabulary.";
-        continue;
-      }
-      auto e = New<DictEntry>();
-      e->code.swap(code);
-      e->text.swap(r.text);
-      e->weight = r.weight;
-      ls->push_back(e);
-    }
-    if (settings->sort_order() != "original") {
-      vocabulary.SortHomophones();
-    }
+    SpooledVocabulary source(&spool, syllable_to_id,
+                             settings->sort_order() != "original", &words);
     table_->Remove();
-    if (!table_->Build(collector.syllabary, vocabulary, collector.num_entries,
+    table_->set_format_version(table_format_version());
+    if (!table_->Build(collector.syllabary, &source, collector.num_entries,
                        dict_file_checksum) ||
         !table_->Save()) {
       return false;
@@ -182,8 +288,7 @@ bool DictCompiler::BuildTable(DictSettings* settings,
   // build .reverse.bin
   ReverseDb reverse_db(dict_name_);
   if (!reverse_db.Build(settings,
-                        collector.syllabary,
-                        vocabulary,
+                        words,
                         collector.stems,
                         dict_file_checksum)) {
     LOG(ERROR) << "error building reversedb.";
@@ -219,11 +324,21 @@ bool DictCompiler::BuildPrism(const std::string &schema_file,
     path.replace_extension(".txt");
     script.Dump(path.string());
   }
+  // weigh syllables by their heaviest words, for the completion index
+  std::vector<double> syllable_weights(syllabary.size());
+  for (size_t i = 0; i < syllable_weights.size(); ++i) {
+    TableAccessor a(table_->QueryWords(static_cast<SyllableId>(i)));
+    for (; !a.exhausted(); a.Next()) {
+      syllable_weights[i] = (std::max)(syllable_weights[i],
+                                       double(a.weight()));
+    }
+  }
   // build .prism.bin
   {
     prism_->Remove();
     if (!prism_->Build(syllabary, script.empty() ? NULL : &script,
-                       dict_file_checksum, schema_file_checksum) ||
+                       dict_file_checksum, schema_file_checksum,
+                       &syllable_weights) ||
         !prism_->Save()) {
       return false;
     }
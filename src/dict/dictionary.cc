@@ -4,6 +4,8 @@
 //
 // 2011-07-05 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
+#include <mutex>
 #include <utility>
 #include <boost/filesystem.hpp>
 #include <rime/common.h>
@@ -22,27 +24,29 @@ bool compare_chunk_by_head_element(const Chunk& a, const Chunk& b) {
   if (!b.entries || b.cursor >= b.size) return true;
   if (a.remaining_code.length() != b.remaining_code.length())
     return a.remaining_code.length() < b.remaining_code.length();
-  return a.credibility * a.entries[a.cursor].weight >
-         b.credibility * b.entries[b.cursor].weight;  // by weight desc
+  return a.credibility * a.entries.weight(a.cursor) >
+         b.credibility * b.entries.weight(b.cursor);  // by weight desc
 }
 
 size_t match_extra_code(const table::Code* extra_code, size_t depth,
-                        const SyllableGraph& syll_graph, size_t current_pos) {
+                        const SyllableGraph& syll_graph, size_t current_pos,
+                        size_t* horizon) {
   if (!extra_code || depth >= extra_code->size)
     return current_pos;  // success
   if (current_pos >= syll_graph.interpreted_length)
     return 0;  // failure (possibly success for completion in the future)
-  auto index = syll_graph.indices.find(current_pos);
-  if (index == syll_graph.indices.end())
-    return 0;
   SyllableId current_syll_id = extra_code->at[depth];
-  auto spellings = index->second.find(current_syll_id);
-  if (spellings == index->second.end())
+  SpellingPropertiesList spellings =
+      syll_graph.spellings(current_pos)[current_syll_id];
+  if (spellings.empty())
     return 0;
   size_t best_match = 0;
-  for (const SpellingProperties* props : spellings->second) {
+  for (const SpellingProperties& props : spellings) {
+    if (horizon && props.end_pos > *horizon)
+      *horizon = props.end_pos;
     size_t match_end_pos = match_extra_code(extra_code, depth + 1,
-                                            syll_graph, props->end_pos);
+                                            syll_graph, props.end_pos,
+                                            horizon);
     if (!match_end_pos) continue;
     if (match_end_pos > best_match)
       best_match = match_end_pos;
@@ -52,93 +56,175 @@ size_t match_extra_code(const table::Code* extra_code, size_t depth,
 
 }  // namespace dictionary
 
+std::string DictEntryView::text() const {
+  return table_->GetEntryText(chunk_->entries.text(chunk_->cursor));
+}
+
+double DictEntryView::weight() const {
+  const double kS = 1e8;
+  return (chunk_->entries.weight(chunk_->cursor) + 1) / kS *
+      chunk_->credibility;
+}
+
+void DictEntryView::Materialize(DictEntry* entry) const {
+  entry->text = text();
+  entry->preedit.clear();
+  entry->weight = weight();
+  entry->commit_count = 0;
+  const auto& index_code(chunk_->index_code);
+  entry->code.assign(index_code.begin(), index_code.end());
+  if (const auto* extra_code = chunk_->extra_code) {
+    entry->code.insert(entry->code.end(),
+                       extra_code->begin(), extra_code->end());
+  }
+  entry->custom_code.clear();
+  entry->remaining_code_length = remaining_code_length();
+  if (chunk_->remaining_code.empty()) {
+    entry->comment.clear();
+  }
+  else {
+    entry->comment = "~" + chunk_->remaining_code;
+  }
+}
+
 DictEntryIterator::DictEntryIterator()
-    : Base(), table_(NULL), entry_(), entry_count_(0) {
+    : table_(NULL), entry_(), entry_count_(0) {
 }
 
 DictEntryIterator::DictEntryIterator(const DictEntryIterator& other)
-    : Base(other), table_(other.table_), entry_(other.entry_),
+    : chunks_(other.chunks_), sorted_(other.sorted_),
+      last_order_(other.last_order_), table_(other.table_),
+      entry_(other.entry_), entry_ready_(other.entry_ready_),
       entry_count_(other.entry_count_) {
 }
 
 DictEntryIterator& DictEntryIterator::operator= (DictEntryIterator& other) {
   DLOG(INFO) << "swapping iterator contents.";
-  swap(other);
+  chunks_.swap(other.chunks_);
+  sorted_ = other.sorted_;
+  last_order_ = other.last_order_;
   table_ = other.table_;
   entry_ = other.entry_;
+  entry_ready_ = other.entry_ready_;
   entry_count_ = other.entry_count_;
   return *this;
 }
 
 bool DictEntryIterator::exhausted() const {
-  return empty();
+  return chunks_.empty();
 }
 
 void DictEntryIterator::AddChunk(dictionary::Chunk&& chunk, Table* table) {
-  push_back(std::move(chunk));
   entry_count_ += chunk.size;
+  chunks_.push_back({std::move(chunk), 0});
+  if (sorted_) {
+    std::push_heap(chunks_.begin(), chunks_.end(), HeapLess);
+  }
   table_ = table;
 }
 
+bool DictEntryIterator::HeapLess(const HeapNode& a, const HeapNode& b) {
+  if (dictionary::compare_chunk_by_head_element(b.chunk, a.chunk))
+    return true;
+  if (dictionary::compare_chunk_by_head_element(a.chunk, b.chunk))
+    return false;
+  return a.order < b.order;
+}
+
 void DictEntryIterator::Sort() {
-  sort(dictionary::compare_chunk_by_head_element);
+  // ties are resolved in favor of the chunk added first, as in stable sort
+  last_order_ = chunks_.size();
+  size_t order = last_order_;
+  for (auto& node : chunks_) {
+    node.order = order--;
+  }
+  std::make_heap(chunks_.begin(), chunks_.end(), HeapLess);
+  sorted_ = true;
 }
 
-void DictEntryIterator::PrepareEntry() {
-  if (empty() || !table_) {
+void DictEntryIterator::Reorder() {
+  if (!sorted_) {
+    Sort();
     return;
   }
-  const auto& chunk(front());
-  entry_ = New<DictEntry>();
-  const auto& e(chunk.entries[chunk.cursor]);
-  DLOG(INFO) << "creating temporary dict entry '"
-             << table_->GetEntryText(e) << "'.";
-  entry_->code = chunk.code;
-  entry_->text = table_->GetEntryText(e);
-  const double kS = 1e8;
-  entry_->weight = (e.weight + 1) / kS * chunk.credibility;
-  if (!chunk.remaining_code.empty()) {
-    entry_->comment = "~" + chunk.remaining_code;
-    entry_->remaining_code_length = chunk.remaining_code.length();
+  // the advanced chunk precedes other chunks of equal head elements
+  chunks_.front().order = ++last_order_;
+  std::pop_heap(chunks_.begin(), chunks_.end(), HeapLess);
+  std::push_heap(chunks_.begin(), chunks_.end(), HeapLess);
+}
+
+void DictEntryIterator::PopChunk() {
+  if (sorted_) {
+    std::pop_heap(chunks_.begin(), chunks_.end(), HeapLess);
+    chunks_.pop_back();
+  }
+  else {
+    chunks_.pop_front();
   }
 }
 
-shared_ptr<DictEntry> DictEntryIterator::Peek() {
-  while (!entry_ && !empty()) {
-    PrepareEntry();
-    if (filter_ && !filter_(entry_)) {
-      Next();
-    }
+void DictEntryIterator::PrepareEntry(const DictEntryView& view) {
+  // the last entry can be reused if no one else has kept it
+  if (!entry_ || entry_.use_count() > 1) {
+    entry_ = New<DictEntry>();
   }
+  view.Materialize(entry_.get());
+  DLOG(INFO) << "prepared dict entry '" << entry_->text << "'.";
+  entry_ready_ = true;
+}
+
+DictEntryView DictEntryIterator::PeekView() {
+  while (!chunks_.empty() && table_) {
+    DictEntryView view(&chunks_.front().chunk, table_);
+    if (!filter_ || entry_ready_)
+      return view;
+    PrepareEntry(view);
+    if (filter_(entry_))
+      return view;
+    Next();
+  }
+  return DictEntryView();
+}
+
+shared_ptr<DictEntry> DictEntryIterator::Peek() {
+  DictEntryView view(PeekView());
+  if (!view)
+    return nullptr;
+  if (!entry_ready_)
+    PrepareEntry(view);
   return entry_;
 }
 
 bool DictEntryIterator::Next() {
-  entry_.reset();
-  if (empty()) {
+  entry_ready_ = false;
+  if (chunks_.empty()) {
     return false;
   }
-  auto& chunk(front());
+  auto& chunk(chunks_.front().chunk);
   if (++chunk.cursor >= chunk.size) {
-    pop_front();
+    PopChunk();
   }
   else {
     // reorder chunks since front() has got a new head element
-    Sort();
+    Reorder();
   }
-  return !empty();
+  return !chunks_.empty();
 }
 
 bool DictEntryIterator::Skip(size_t num_entries) {
+  if (num_entries > 0)
+    entry_ready_ = false;
   while (num_entries > 0) {
-    if (empty()) return false;
-    auto& chunk(front());
+    if (chunks_.empty()) return false;
+    auto& chunk(chunks_.front().chunk);
     if (chunk.cursor + num_entries < chunk.size) {
       chunk.cursor += num_entries;
+      if (sorted_)
+        Reorder();
       return true;
     }
     num_entries -= (chunk.size - chunk.cursor);
-    pop_front();
+    PopChunk();
   }
   return true;
 }
@@ -158,32 +244,31 @@ Dictionary::~Dictionary() {
 shared_ptr<DictEntryCollector>
 Dictionary::Lookup(const SyllableGraph& syllable_graph,
                    size_t start_pos,
-                   double initial_credibility) {
+                   double initial_credibility,
+                   size_t* horizon) {
   if (!loaded())
     return nullptr;
-  TableQueryResult result;
-  if (!table_->Query(syllable_graph, start_pos, &result)) {
+  if (!table_->Query(syllable_graph, start_pos, &query_arena_, horizon)) {
     return nullptr;
   }
   auto collector = New<DictEntryCollector>();
   // copy result
-  for (auto& v : result) {
-    size_t end_pos = v.first;
-    for (TableAccessor& a : v.second) {
-      double cr = initial_credibility * a.credibility();
-      if (a.extra_code()) {
-        do {
-          size_t actual_end_pos = dictionary::match_extra_code(
-              a.extra_code(), 0, syllable_graph, end_pos);
-          if (actual_end_pos == 0) continue;
-          (*collector)[actual_end_pos].AddChunk(
-              {a.code(), a.entry(), cr}, table_.get());
-        }
-        while (a.Next());
-      }
-      else {
-        (*collector)[end_pos].AddChunk({a, cr}, table_.get());
+  for (auto& match : query_arena_.matches()) {
+    size_t end_pos = match.end_pos;
+    TableAccessor& a(match.accessor);
+    double cr = initial_credibility * a.credibility();
+    if (a.extra_code()) {
+      do {
+        size_t actual_end_pos = dictionary::match_extra_code(
+            a.extra_code(), 0, syllable_graph, end_pos, horizon);
+        if (actual_end_pos == 0) continue;
+        (*collector)[actual_end_pos].AddChunk(
+            {a.index_code(), a.extra_code(), a.entry(), cr}, table_.get());
       }
+      while (a.Next());
+    }
+    else {
+      (*collector)[end_pos].AddChunk({a, cr}, table_.get());
     }
   }
   // sort each group of equal code length
@@ -262,6 +347,10 @@ bool Dictionary::Remove() {
 
 bool Dictionary::Load() {
   LOG(INFO) << "loading dictionary '" << name_ << "'.";
+  // tables and prisms are shared by dictionaries of sessions in different
+  // threads; load each file only once.
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
   if (!table_ || (!table_->IsOpen() && !table_->Load())) {
     LOG(ERROR) << "Error loading table for dictionary '" << name_ << "'.";
     return false;
@@ -306,6 +395,7 @@ DictionaryComponent::CreateDictionaryWithName(const std::string& dict_name,
                                               const std::string& prism_name) {
   // obtain prism and table objects
   boost::filesystem::path path(Service::instance().deployer().user_data_dir);
+  std::lock_guard<std::mutex> lock(mutex_);
   auto table = table_map_[dict_name].lock();
   if (!table) {
     table = New<Table>((path / dict_name).string() + ".table.bin");
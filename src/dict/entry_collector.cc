@@ -4,15 +4,110 @@
 //
 // 2011-11-27 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <sstream>
+#include <thread>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <rime/dict/dict_settings.h>
 #include <rime/dict/entry_collector.h>
+#include <rime/dict/entry_spool.h>
 #include <rime/dict/preset_vocabulary.h>
+#include <rime/dict/tsv.h>
 
 namespace rime {
 
+// number of lines or phrases a worker thread takes at a time
+static const size_t kChunkSize = 256;
+// lines split into columns in parallel at a time
+static const size_t kParseBatchSize = 65536;
+// phrases encoded from one snapshot of collected words
+static const size_t kEncodeBatchSize = 8192;
+
+// calls work(thread_index, i) for every i in [begin, end),
+// with a number of threads taking chunks in turn.
+template <class Work>
+static void ParallelFor(size_t begin, size_t end, size_t num_threads,
+                        const Work& work) {
+  num_threads = (std::min)(num_threads,
+                           (end - begin + kChunkSize - 1) / kChunkSize);
+  std::atomic<size_t> next(begin);
+  auto run = [&](size_t thread_index) {
+    for (size_t i; (i = next.fetch_add(kChunkSize)) < end; ) {
+      for (size_t j = i; j < (std::min)(i + kChunkSize, end); ++j) {
+        work(thread_index, j);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t k = 1; k < num_threads; ++k) {
+    threads.emplace_back(run, k);
+  }
+  run(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// columns of a dict entry, copied out of a line
+struct EntryColumns {
+  std::string word;
+  std::string code_str;
+  std::string weight_str;
+  std::string stem_str;
+};
+
+static inline void CopyColumn(const std::vector<TsvField>& row, int column,
+                              std::string* value) {
+  if (column != -1 && static_cast<int>(row.size()) > column)
+    value->assign(row[column].begin(), row[column].end());
+}
+
+// what an encoder did with a phrase
+struct EncodeResult {
+  bool ok = false;
+  // code of each entry created, in order
+  std::vector<std::string> codes;
+  // words translated while encoding
+  std::vector<std::string> lookups;
+};
+
+// records entries created by an encoder rather than collecting them, so that
+// phrases can be encoded concurrently, then collected in the original order.
+class EncodeRecorder : public PhraseCollector {
+ public:
+  EncodeRecorder(EntryCollector* collector) : collector_(collector) {}
+
+  void CreateEntry(const std::string& phrase,
+                   const std::string& code_str,
+                   const std::string& value) {
+    result_->codes.push_back(code_str);
+  }
+  bool TranslateWord(const std::string& word,
+                     std::vector<std::string>* code) {
+    result_->lookups.push_back(word);
+    return collector_->TranslateWord(word, code);
+  }
+
+  void set_result(EncodeResult* result) { result_ = result; }
+
+ private:
+  EntryCollector* collector_;
+  EncodeResult* result_ = nullptr;
+};
+
+static Encoder* CloneEncoder(Encoder* encoder) {
+  if (auto table_encoder = dynamic_cast<TableEncoder*>(encoder)) {
+    return new TableEncoder(*table_encoder);
+  }
+  if (auto script_encoder = dynamic_cast<ScriptEncoder*>(encoder)) {
+    return new ScriptEncoder(*script_encoder);
+  }
+  return nullptr;
+}
+
 EntryCollector::EntryCollector() {
 }
 
@@ -33,11 +128,14 @@ void EntryCollector::Configure(DictSettings* settings) {
   encoder->LoadSettings(settings);
 }
 
-void EntryCollector::Collect(const std::vector<std::string>& dict_files) {
+bool EntryCollector::Collect(const std::vector<std::string>& dict_files) {
   for (const std::string& dict_file : dict_files) {
     Collect(dict_file);
+    if (spool_error)
+      return false;
   }
   Finish();
+  return !spool_error;
 }
 
 void EntryCollector::LoadPresetVocabulary(DictSettings* settings) {
@@ -49,14 +147,24 @@ void EntryCollector::LoadPresetVocabulary(DictSettings* settings) {
     if (settings->min_phrase_weight() > 0)
       preset_vocabulary->set_min_phrase_weight(settings->min_phrase_weight());
   }
+  defined_phrases.assign(preset_vocabulary->size(), false);
 }
 
 void EntryCollector::Collect(const std::string& dict_file) {
   LOG(INFO) << "collecting entries from " << dict_file;
   // read table
-  std::ifstream fin(dict_file.c_str());
+  TsvScanner scanner(dict_file);
+  TsvField line;
+  std::stringstream header;
+  while (scanner.GetLine(&line)) {
+    header.write(line.begin(), line.size());
+    header << std::endl;
+    if (boost::equals(line, "...")) {  // yaml doc ending
+      break;
+    }
+  }
   DictSettings settings;
-  if (!settings.LoadDictHeader(fin)) {
+  if (!scanner.ok() || !settings.LoadDictHeader(header)) {
     LOG(ERROR) << "missing dict settings.";
     return;
   }
@@ -69,95 +177,183 @@ void EntryCollector::Collect(const std::string& dict_file) {
     LOG(ERROR) << "missing text column definition.";
     return;
   }
+  size_t jobs = num_jobs();
+  // scratch space of each worker thread
+  std::vector<std::vector<TsvField>> fields(jobs);
+  std::vector<TsvField> lines;
+  std::vector<EntryColumns> rows;
   bool enable_comment = true;
-  std::string line;
-  while (getline(fin, line)) {
-    boost::algorithm::trim_right(line);
-    // skip empty lines and comments
-    if (line.empty()) continue;
-    if (enable_comment && line[0] == '#') {
-      if (line == "# no comment") {
-        // a "# no comment" line disables further comments
-        enable_comment = false;
+  for (bool more = true; more && !spool_error; ) {
+    lines.clear();
+    while (lines.size() < kParseBatchSize && (more = scanner.GetLine(&line))) {
+      // skip empty lines and comments
+      if (line.empty()) continue;
+      if (enable_comment && line.front() == '#') {
+        if (boost::equals(line, "# no comment")) {
+          // a "# no comment" line disables further comments
+          enable_comment = false;
+        }
+        continue;
+      }
+      lines.push_back(line);
+    }
+    // split a batch of lines into columns in parallel
+    rows.assign(lines.size(), EntryColumns());
+    ParallelFor(0, lines.size(), jobs, [&](size_t k, size_t i) {
+      std::vector<TsvField>& row(fields[k]);
+      TsvScanner::Split(lines[i], &row);
+      CopyColumn(row, text_column, &rows[i].word);
+      CopyColumn(row, code_column, &rows[i].code_str);
+      CopyColumn(row, weight_column, &rows[i].weight_str);
+      CopyColumn(row, stem_column, &rows[i].stem_str);
+    });
+    for (const auto& row : rows) {
+      // read a dict entry
+      if (row.word.empty()) {
+        LOG(WARNING) << "Missing entry text at #" << num_entries << ".";
+        continue;
+      }
+      // collect entry
+      if (preset_vocabulary) {
+        StringId phrase_id;
+        if (preset_vocabulary->GetPhraseId(row.word, &phrase_id))
+          defined_phrases[phrase_id] = true;
+      }
+      if (!row.code_str.empty()) {
+        CreateEntry(row.word, row.code_str, row.weight_str);
       }
-      continue;
-    }
-    // read a dict entry
-    std::vector<std::string> row;
-    boost::algorithm::split(row, line,
-                            boost::algorithm::is_any_of("\t"));
-    int num_columns = static_cast<int>(row.size());
-    if (num_columns <= text_column || row[text_column].empty()) {
-      LOG(WARNING) << "Missing entry text at #" << num_entries << ".";
-      continue;
-    }
-    const auto& word(row[text_column]);
-    std::string code_str;
-    std::string weight_str;
-    std::string stem_str;
-    if (code_column != -1 &&
-        num_columns > code_column && !row[code_column].empty())
-      code_str = row[code_column];
-    if (weight_column != -1 &&
-        num_columns > weight_column && !row[weight_column].empty())
-      weight_str = row[weight_column];
-    if (stem_column != -1 &&
-        num_columns > stem_column && !row[stem_column].empty())
-      stem_str = row[stem_column];
-    // collect entry
-    collection.insert(word);
-    if (!code_str.empty()) {
-      CreateEntry(word, code_str, weight_str);
-    }
-    else {
-      encode_queue.push({word, weight_str});
-    }
-    if (!stem_str.empty() && !code_str.empty()) {
-      DLOG(INFO) << "add stem '" << word << "': "
-                 << "[" << code_str << "] = [" << stem_str << "]";
-      stems[word].insert(stem_str);
-    }
-  }
-  fin.close();
+      else {
+        encode_queue.push_back({row.word, row.weight_str});
+      }
+      if (!row.stem_str.empty() && !row.code_str.empty()) {
+        DLOG(INFO) << "add stem '" << row.word << "': "
+                   << "[" << row.code_str << "] = [" << row.stem_str << "]";
+        stems[row.word].insert(row.stem_str);
+      }
+    }
+  }
   LOG(INFO) << "Pass 1: total " << num_entries << " entries collected.";
   LOG(INFO) << "num unique syllables: " << syllabary.size();
   LOG(INFO) << "num of entries to encode: " << encode_queue.size();
 }
 
 void EntryCollector::Finish() {
-  while (!encode_queue.empty()) {
-    const auto& phrase(encode_queue.front().first);
-    const auto& weight_str(encode_queue.front().second);
-    if (!encoder->EncodePhrase(phrase, weight_str)) {
-      LOG(ERROR) << "Encode failure: '" << phrase << "'.";
-    }
-    encode_queue.pop();
-  }
+  EncodeQueue phrases;
+  phrases.swap(encode_queue);
+  EncodePhrases(phrases);
   LOG(INFO) << "Pass 2: total " << num_entries << " entries collected.";
-  if (preset_vocabulary) {
+  if (preset_vocabulary && !spool_error) {
+    phrases.clear();
+    std::vector<double> weights;
     preset_vocabulary->Reset();
-    std::string phrase, weight_str;
-    while (preset_vocabulary->GetNextEntry(&phrase, &weight_str)) {
-      if (collection.find(phrase) != collection.end())
+    std::string phrase;
+    double weight = 0.0;
+    while (preset_vocabulary->GetNextEntry(&phrase, &weight)) {
+      StringId phrase_id;
+      if (preset_vocabulary->GetPhraseId(phrase, &phrase_id) &&
+          defined_phrases[phrase_id])
         continue;
-      if (!encoder->EncodePhrase(phrase, weight_str)) {
+      phrases.push_back({phrase, std::string()});
+      weights.push_back(weight);
+    }
+    EncodePhrases(phrases, &weights);
+  }
+  LOG(INFO) << "Pass 3: total " << num_entries << " entries collected.";
+}
+
+size_t EntryCollector::num_jobs() const {
+  return num_threads > 0 ? num_threads :
+      (std::max)(std::thread::hardware_concurrency(), 1u);
+}
+
+void EntryCollector::EncodePhrases(const EncodeQueue& phrases,
+                                   const std::vector<double>* preset_weights) {
+  // creates the entries recorded for the i-th phrase
+  auto create_entries = [&](size_t i, const EncodeResult& result) {
+    const std::string& phrase(phrases[i].first);
+    for (const auto& code_str : result.codes) {
+      if (preset_weights)
+        CreateEntry(phrase, code_str, (*preset_weights)[i]);
+      else
+        CreateEntry(phrase, code_str, phrases[i].second);
+    }
+    if (!result.ok) {
+      if (preset_weights)
         LOG(WARNING) << "Encode failure: '" << phrase << "'.";
+      else
+        LOG(ERROR) << "Encode failure: '" << phrase << "'.";
+    }
+  };
+  size_t jobs = phrases.size() > kChunkSize ? num_jobs() : 1;
+  std::vector<unique_ptr<Encoder>> encoders;
+  std::vector<unique_ptr<EncodeRecorder>> recorders;
+  for (size_t k = 0; k < jobs && jobs > 1; ++k) {
+    unique_ptr<Encoder> clone(CloneEncoder(encoder.get()));
+    if (!clone) {
+      jobs = 1;
+      break;
+    }
+    recorders.emplace_back(new EncodeRecorder(this));
+    clone->set_collector(recorders.back().get());
+    encoders.push_back(std::move(clone));
+  }
+  if (jobs <= 1) {
+    EncodeRecorder recorder(this);
+    encoder->set_collector(&recorder);
+    for (size_t i = 0; i < phrases.size() && !spool_error; ++i) {
+      EncodeResult result;
+      recorder.set_result(&result);
+      result.ok = encoder->EncodePhrase(phrases[i].first, phrases[i].second);
+      create_entries(i, result);
+    }
+    encoder->set_collector(this);
+    return;
+  }
+  for (size_t begin = 0; begin < phrases.size() && !spool_error;
+       begin += kEncodeBatchSize) {
+    size_t end = (std::min)(begin + kEncodeBatchSize, phrases.size());
+    // encode a batch of phrases with words collected before the batch
+    std::vector<EncodeResult> results(end - begin);
+    ParallelFor(begin, end, jobs, [&](size_t k, size_t i) {
+      recorders[k]->set_result(&results[i - begin]);
+      results[i - begin].ok =
+          encoders[k]->EncodePhrase(phrases[i].first, phrases[i].second);
+    });
+    // create entries in order. a phrase that translated some word defined
+    // earlier in the batch is encoded again, as in a serial run.
+    std::set<std::string> new_words;
+    for (size_t i = begin; i < end; ++i) {
+      EncodeResult& result(results[i - begin]);
+      bool stale = std::any_of(
+          result.lookups.begin(), result.lookups.end(),
+          [&](const std::string& word) {
+            return new_words.find(word) != new_words.end();
+          });
+      if (stale) {
+        result = EncodeResult();
+        recorders[0]->set_result(&result);
+        result.ok = encoders[0]->EncodePhrase(phrases[i].first,
+                                              phrases[i].second);
+      }
+      for (const auto& code_str : result.codes) {
+        RawCode code;
+        code.FromString(code_str);
+        if (code.size() == 1)
+          new_words.insert(phrases[i].first);
       }
+      create_entries(i, result);
+      result = EncodeResult();
     }
   }
-  LOG(INFO) << "Pass 3: total " << num_entries << " entries collected.";
 }
 
 void EntryCollector::CreateEntry(const std::string &word,
                                  const std::string &code_str,
                                  const std::string &weight_str) {
-  RawDictEntry e;
-  e.raw_code.FromString(code_str);
-  e.text = word;
-  e.weight = 0.0;
+  double weight = 0.0;
   bool scaled = boost::ends_with(weight_str, "%");
   if ((weight_str.empty() || scaled) && preset_vocabulary) {
-    preset_vocabulary->GetWeightForEntry(e.text, &e.weight);
+    preset_vocabulary->GetWeightForEntry(word, &weight);
   }
   if (scaled) {
     double percentage = 100.0;
@@ -169,17 +365,27 @@ void EntryCollector::CreateEntry(const std::string &word,
       LOG(WARNING) << "invalid entry definition at #" << num_entries << ".";
       percentage = 100.0;
     }
-    e.weight *= percentage / 100.0;
+    weight *= percentage / 100.0;
   }
   else if (!weight_str.empty()) {  // absolute weight
     try {
-      e.weight = boost::lexical_cast<double>(weight_str);
+      weight = boost::lexical_cast<double>(weight_str);
     }
     catch (...) {
       LOG(WARNING) << "invalid entry definition at #" << num_entries << ".";
-      e.weight = 0.0;
+      weight = 0.0;
     }
   }
+  CreateEntry(word, code_str, weight);
+}
+
+void EntryCollector::CreateEntry(const std::string &word,
+                                 const std::string &code_str,
+                                 double weight) {
+  RawDictEntry e;
+  e.raw_code.FromString(code_str);
+  e.text = word;
+  e.weight = weight;
   // learn new syllables
   for (const std::string& s : e.raw_code) {
     if (syllabary.find(s) == syllabary.end())
@@ -196,7 +402,15 @@ void EntryCollector::CreateEntry(const std::string &word,
     words[e.text][code_str] += e.weight;
     total_weight[e.text] += e.weight;
   }
-  entries.push_back(e);
+  if (spool) {
+    if (!spool->Put(e)) {
+      spool_error = true;
+      return;
+    }
+  }
+  else {
+    entries.push_back(e);
+  }
   ++num_entries;
 }
 
@@ -213,7 +427,8 @@ bool EntryCollector::TranslateWord(const std::string& word,
   if (w != words.end()) {
     for (const auto& v : w->second) {
       const double kMinimalWeight = 0.05;  // 5%
-      double min_weight = total_weight[word] * kMinimalWeight;
+      // read only; words are translated by concurrent encoders
+      double min_weight = total_weight.find(word)->second * kMinimalWeight;
       if (v.second < min_weight)
         continue;
       result->push_back(v.first);
@@ -0,0 +1,175 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <rime/dict/entry_collector.h>
+#include <rime/dict/entry_spool.h>
+
+namespace rime {
+
+static std::string HeadOf(const std::string& code) {
+  return code.substr(0, code.find(' '));
+}
+
+EntrySpool::EntrySpool(const std::string& file_prefix, size_t memory_budget)
+    : file_prefix_(file_prefix), memory_budget_(memory_budget) {
+}
+
+EntrySpool::~EntrySpool() {
+  RemoveRuns();
+}
+
+bool EntrySpool::Put(const RawDictEntry& entry) {
+  if (reading_) {
+    LOG(ERROR) << "entry spool is being read.";
+    return false;
+  }
+  if (failed_)
+    return false;
+  Record record;
+  record.code = entry.raw_code.ToString();
+  record.head = HeadOf(record.code);
+  record.seq = size_++;
+  record.text = entry.text;
+  record.weight = entry.weight;
+  memory_used_ += sizeof(Record) +
+      record.head.size() + record.code.size() + record.text.size();
+  buffer_.push_back(std::move(record));
+  if (memory_used_ > memory_budget_) {
+    return SpillRun();
+  }
+  return true;
+}
+
+bool EntrySpool::SpillRun() {
+  if (buffer_.empty())
+    return true;
+  std::sort(buffer_.begin(), buffer_.end());
+  unique_ptr<Run> run(new Run);
+  run->file_name = file_prefix_ + "." + std::to_string(runs_.size());
+  {
+    std::ofstream out(run->file_name.c_str(),
+                      std::ios::out | std::ios::binary | std::ios::trunc);
+    for (const Record& r : buffer_) {
+      uint32_t code_size = r.code.size();
+      uint32_t text_size = r.text.size();
+      out.write(reinterpret_cast<const char*>(&r.seq), sizeof(r.seq));
+      out.write(reinterpret_cast<const char*>(&r.weight), sizeof(r.weight));
+      out.write(reinterpret_cast<const char*>(&code_size), sizeof(code_size));
+      out.write(r.code.data(), code_size);
+      out.write(reinterpret_cast<const char*>(&text_size), sizeof(text_size));
+      out.write(r.text.data(), text_size);
+    }
+    if (!out) {
+      LOG(ERROR) << "error writing entry spool file '" << run->file_name
+                 << "'.";
+      boost::system::error_code ec;
+      boost::filesystem::remove(run->file_name, ec);
+      std::vector<Record>().swap(buffer_);
+      memory_used_ = 0;
+      failed_ = true;
+      return false;
+    }
+  }
+  DLOG(INFO) << "spilled " << buffer_.size() << " entries to '"
+             << run->file_name << "'.";
+  runs_.push_back(std::move(run));
+  std::vector<Record>().swap(buffer_);
+  memory_used_ = 0;
+  return true;
+}
+
+bool EntrySpool::ReadRecord(std::istream& in, Record* record) {
+  uint32_t code_size = 0;
+  uint32_t text_size = 0;
+  if (!in.read(reinterpret_cast<char*>(&record->seq), sizeof(record->seq)) ||
+      !in.read(reinterpret_cast<char*>(&record->weight),
+               sizeof(record->weight)) ||
+      !in.read(reinterpret_cast<char*>(&code_size), sizeof(code_size)))
+    return false;
+  record->code.resize(code_size);
+  if (code_size && !in.read(&record->code[0], code_size))
+    return false;
+  if (!in.read(reinterpret_cast<char*>(&text_size), sizeof(text_size)))
+    return false;
+  record->text.resize(text_size);
+  if (text_size && !in.read(&record->text[0], text_size))
+    return false;
+  record->head = HeadOf(record->code);
+  return true;
+}
+
+bool EntrySpool::Rewind() {
+  if (failed_)
+    return false;
+  reading_ = true;
+  buffer_pos_ = 0;
+  heap_.clear();
+  if (runs_.empty()) {
+    // everything fits in memory
+    std::sort(buffer_.begin(), buffer_.end());
+    return true;
+  }
+  if (!SpillRun())
+    return false;
+  for (const auto& run : runs_) {
+    run->in.close();
+    run->in.clear();
+    run->in.open(run->file_name.c_str(), std::ios::in | std::ios::binary);
+    if (!run->in) {
+      LOG(ERROR) << "error opening entry spool file '" << run->file_name
+                 << "'.";
+      return false;
+    }
+    if (ReadRecord(run->in, &run->top))
+      heap_.push_back(run.get());
+  }
+  // keeps the run with the least top record at the front of the heap
+  auto after = [](const Run* a, const Run* b) { return b->top < a->top; };
+  std::make_heap(heap_.begin(), heap_.end(), after);
+  return true;
+}
+
+bool EntrySpool::Get(RawDictEntry* entry) {
+  if (!reading_)
+    return false;
+  if (runs_.empty()) {
+    if (buffer_pos_ >= buffer_.size())
+      return false;
+    const Record& r(buffer_[buffer_pos_++]);
+    entry->raw_code.FromString(r.code);
+    entry->text = r.text;
+    entry->weight = r.weight;
+    return true;
+  }
+  if (heap_.empty())
+    return false;
+  auto after = [](const Run* a, const Run* b) { return b->top < a->top; };
+  std::pop_heap(heap_.begin(), heap_.end(), after);
+  Run* run = heap_.back();
+  entry->raw_code.FromString(run->top.code);
+  entry->text.swap(run->top.text);
+  entry->weight = run->top.weight;
+  if (ReadRecord(run->in, &run->top)) {
+    std::push_heap(heap_.begin(), heap_.end(), after);
+  }
+  else {
+    heap_.pop_back();
+  }
+  return true;
+}
+
+void EntrySpool::RemoveRuns() {
+  for (const auto& run : runs_) {
+    run->in.close();
+    boost::system::error_code ec;
+    boost::filesystem::remove(run->file_name, ec);
+  }
+  runs_.clear();
+}
+
+}  // namespace rime
@@ -4,18 +4,24 @@
 //
 // 2011-11-27 GONG Chen <chen.sst@gmail.com>
 //
+#include <mutex>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <utf8.h>
 #include <rime/service.h>
+#include <rime/algo/manifest.h>
 #include <rime/dict/preset_vocabulary.h>
 #include <rime/dict/text_db.h>
 
 namespace rime {
 
+const char kVocabularyFormat[] = "Rime::Vocabulary/1.0";
+
+const char kVocabularyFormatPrefix[] = "Rime::Vocabulary/";
+const size_t kVocabularyFormatPrefixLen = sizeof(kVocabularyFormatPrefix) - 1;
+
 struct VocabularyDb : public TextDb {
   VocabularyDb(const std::string& path);
-  shared_ptr<DbAccessor> cursor;
   static const TextFormat format;
 };
 
@@ -49,55 +55,244 @@ const TextFormat VocabularyDb::format = {
   "Rime vocabulary",
 };
 
+VocabularyBin::VocabularyBin(const std::string& file_name)
+    : MappedFile(file_name) {
+}
+
+bool VocabularyBin::Load() {
+  LOG(INFO) << "loading vocabulary: " << file_name();
+
+  if (IsOpen())
+    Close();
+
+  if (!OpenReadOnly()) {
+    LOG(ERROR) << "Error opening vocabulary '" << file_name() << "'.";
+    return false;
+  }
+
+  metadata_ = Find<vocabulary::Metadata>(0);
+  if (!metadata_) {
+    LOG(ERROR) << "metadata not found.";
+    Close();
+    return false;
+  }
+  if (strncmp(metadata_->format,
+              kVocabularyFormatPrefix, kVocabularyFormatPrefixLen)) {
+    LOG(ERROR) << "invalid metadata.";
+    metadata_ = nullptr;
+    Close();
+    return false;
+  }
+
+  phrase_trie_.reset(new StringTable(metadata_->phrase_trie.get(),
+                                     metadata_->phrase_trie_size));
+  return true;
+}
+
+bool VocabularyBin::Save() {
+  LOG(INFO) << "saving vocabulary: " << file_name();
+  if (!metadata_) {
+    LOG(ERROR) << "the vocabulary has not been built!";
+    return false;
+  }
+  return ShrinkToFit();
+}
+
+bool VocabularyBin::Build(
+    const std::vector<std::pair<std::string, double>>& phrases,
+    uint32_t source_file_checksum) {
+  LOG(INFO) << "building vocabulary...";
+  StringTableBuilder phrase_trie_builder;
+  std::vector<StringId> phrase_ids(phrases.size());
+  for (size_t i = 0; i < phrases.size(); ++i) {
+    phrase_trie_builder.Add(phrases[i].first, 1.0, &phrase_ids[i]);
+  }
+  phrase_trie_builder.Build();
+
+  // creating vocabulary file
+  size_t phrase_trie_image_size = phrase_trie_builder.BinarySize();
+  MappedFileSizer sizer;
+  sizer.Allocate<vocabulary::Metadata>();
+  sizer.Allocate<StringId>(phrases.size());
+  sizer.Allocate<double>(phrases.size());
+  sizer.Allocate<char>(phrase_trie_image_size);
+  if (!Create(sizer.size())) {
+    LOG(ERROR) << "Error creating vocabulary file '" << file_name() << "'.";
+    return false;
+  }
+
+  // create metadata
+  metadata_ = Allocate<vocabulary::Metadata>();
+  if (!metadata_) {
+    LOG(ERROR) << "Error creating metadata in file '" << file_name() << "'.";
+    return false;
+  }
+  metadata_->source_file_checksum = source_file_checksum;
+
+  auto ids = Allocate<StringId>(phrases.size());
+  auto weights = Allocate<double>(phrases.size());
+  if (!ids || !weights) {
+    return false;
+  }
+  for (size_t i = 0; i < phrases.size(); ++i) {
+    ids[i] = phrase_ids[i];
+    weights[phrase_ids[i]] = phrases[i].second;
+  }
+  metadata_->phrases.size = phrases.size();
+  metadata_->phrases.at = ids;
+  metadata_->weights.size = phrases.size();
+  metadata_->weights.at = weights;
+
+  // save phrase trie image
+  char* phrase_trie_image = Allocate<char>(phrase_trie_image_size);
+  if (!phrase_trie_image) {
+    LOG(ERROR) << "Error creating phrase trie image.";
+    return false;
+  }
+  phrase_trie_builder.Dump(phrase_trie_image, phrase_trie_image_size);
+  metadata_->phrase_trie = phrase_trie_image;
+  metadata_->phrase_trie_size = phrase_trie_image_size;
+
+  // at last, complete the metadata
+  std::strncpy(metadata_->format, kVocabularyFormat,
+               vocabulary::Metadata::kFormatMaxLength);
+  return true;
+}
+
+bool VocabularyBin::GetWeight(const std::string& phrase, double* weight) {
+  if (!phrase_trie_)
+    return false;
+  StringId phrase_id = phrase_trie_->Lookup(phrase);
+  if (phrase_id == kInvalidStringId || phrase_id >= metadata_->weights.size)
+    return false;
+  *weight = metadata_->weights.at[phrase_id];
+  return true;
+}
+
+bool VocabularyBin::GetPhraseId(const std::string& phrase, StringId* id) {
+  if (!phrase_trie_)
+    return false;
+  StringId phrase_id = phrase_trie_->Lookup(phrase);
+  if (phrase_id == kInvalidStringId || phrase_id >= metadata_->weights.size)
+    return false;
+  *id = phrase_id;
+  return true;
+}
+
+bool VocabularyBin::GetPhrase(size_t index,
+                              std::string* phrase,
+                              double* weight) {
+  if (!phrase_trie_ || index >= metadata_->phrases.size)
+    return false;
+  StringId phrase_id = metadata_->phrases.at[index];
+  *phrase = phrase_trie_->GetString(phrase_id);
+  *weight = metadata_->weights.at[phrase_id];
+  return true;
+}
+
+size_t VocabularyBin::size() const {
+  return metadata_ ? metadata_->phrases.size : 0;
+}
+
+uint32_t VocabularyBin::source_file_checksum() const {
+  return metadata_ ? metadata_->source_file_checksum : 0;
+}
+
 std::string PresetVocabulary::DictFilePath() {
   boost::filesystem::path path(Service::instance().deployer().shared_data_dir);
   path /= "essay.txt";
   return path.string();
 }
 
+std::string PresetVocabulary::CompiledFilePath() {
+  boost::filesystem::path path(Service::instance().deployer().user_data_dir);
+  path /= "essay.bin";
+  return path.string();
+}
+
+static bool CompileVocabulary(const std::string& source_file,
+                              uint32_t source_file_checksum,
+                              VocabularyBin* bin) {
+  VocabularyDb db(source_file);
+  if (!db.OpenReadOnly()) {
+    return false;
+  }
+  std::vector<std::pair<std::string, double>> phrases;
+  auto accessor = db.QueryAll();
+  std::string phrase, weight_str;
+  while (accessor->GetNextRecord(&phrase, &weight_str)) {
+    double weight = 0.0;
+    try {
+      weight = boost::lexical_cast<double>(weight_str);
+    }
+    catch (...) {
+      LOG(WARNING) << "invalid weight for phrase '" << phrase << "'.";
+    }
+    phrases.push_back({phrase, weight});
+  }
+  accessor.reset();
+  db.Close();
+  return bin->Build(phrases, source_file_checksum) && bin->Save();
+}
+
 PresetVocabulary::PresetVocabulary() {
-  db_.reset(new VocabularyDb(DictFilePath()));
-  if (db_ && db_->OpenReadOnly()) {
-    db_->cursor = db_->QueryAll();
+  // dictionaries may be compiled in parallel; build essay.bin only once.
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string source_file(DictFilePath());
+  uint32_t source_file_checksum =
+      Service::instance().deployer().manifest()->Checksum({source_file});
+  bin_.reset(new VocabularyBin(CompiledFilePath()));
+  if (bin_->Exists() && bin_->Load() &&
+      bin_->source_file_checksum() == source_file_checksum) {
+    return;
+  }
+  bin_->Close();
+  if (!CompileVocabulary(source_file, source_file_checksum, bin_.get()) ||
+      !bin_->Load()) {
+    LOG(ERROR) << "error compiling preset vocabulary.";
+    bin_.reset();
   }
 }
 
 PresetVocabulary::~PresetVocabulary() {
-  if (db_)
-    db_->Close();
+  if (bin_)
+    bin_->Close();
 }
 
 bool PresetVocabulary::GetWeightForEntry(const std::string &key, double *weight) {
-  std::string weight_str;
-  if (!db_ || !db_->Fetch(key, &weight_str))
-    return false;
-  try {
-    *weight = boost::lexical_cast<double>(weight_str);
-  }
-  catch (...) {
-    return false;
-  }
-  return true;
+  return bin_ && bin_->GetWeight(key, weight);
+}
+
+bool PresetVocabulary::GetPhraseId(const std::string& phrase, StringId* id) {
+  return bin_ && bin_->GetPhraseId(phrase, id);
+}
+
+size_t PresetVocabulary::size() const {
+  return bin_ ? bin_->size() : 0;
 }
 
 void PresetVocabulary::Reset() {
-  if (db_ && db_->cursor)
-    db_->cursor->Reset();
+  next_entry_ = 0;
 }
 
-bool PresetVocabulary::GetNextEntry(std::string *key, std::string *value) {
-  if (!db_ || !db_->cursor)
+bool PresetVocabulary::GetNextEntry(std::string *key, double *weight) {
+  if (!bin_)
     return false;
-  bool got = false;
-  do {
-    got = db_->cursor->GetNextRecord(key, value);
+  while (bin_->GetPhrase(next_entry_++, key, weight)) {
+    if (IsQualifiedPhrase(*key, *weight))
+      return true;
   }
-  while (got && !IsQualifiedPhrase(*key, *value));
-  return got;
+  return false;
 }
 
 bool PresetVocabulary::IsQualifiedPhrase(const std::string& phrase,
                                          const std::string& weight_str) {
+  return IsQualifiedPhrase(phrase, boost::lexical_cast<double>(weight_str));
+}
+
+bool PresetVocabulary::IsQualifiedPhrase(const std::string& phrase,
+                                         double weight) {
   if (max_phrase_length_ > 0) {
     size_t length = utf8::unchecked::distance(phrase.c_str(),
                                               phrase.c_str() + phrase.length());
@@ -105,7 +300,6 @@ bool PresetVocabulary::IsQualifiedPhrase(const std::string& phrase,
       return false;
   }
   if (min_phrase_weight_ > 0.0) {
-    double weight = boost::lexical_cast<double>(weight_str);
     if (weight < min_phrase_weight_)
       return false;
   }
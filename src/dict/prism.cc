@@ -6,7 +6,9 @@
 // 2012-01-26 GONG Chen <chen.sst@gmail.com>  spelling algebra support
 //
 #include <cfloat>
+#include <algorithm>
 #include <cstring>
+#include <map>
 #include <queue>
 #include <rime/algo/algebra.h>
 #include <rime/dict/prism.h>
@@ -22,7 +24,7 @@ struct node_t {
 
 namespace rime {
 
-const char kPrismFormat[] = "Rime::Prism/1.0";
+const char kPrismFormat[] = "Rime::Prism/1.1";
 
 const char kPrismFormatPrefix[] = "Rime::Prism/";
 const size_t kPrismFormatPrefixLen = sizeof(kPrismFormatPrefix) - 1;
@@ -69,6 +71,8 @@ SpellingProperties SpellingAccessor::properties() const {
   return props;
 }
 
+const size_t Prism::kMaxCompletions;
+
 Prism::Prism(const std::string& file_name)
   : MappedFile(file_name), trie_(new Darts::DoubleArray) {
 }
@@ -111,6 +115,10 @@ bool Prism::Load() {
   if (format_ > 1.0 - DBL_EPSILON) {
     spelling_map_ = metadata_->spelling_map.get();
   }
+  completion_index_ = NULL;
+  if (format_ > 1.1 - DBL_EPSILON) {
+    completion_index_ = metadata_->completion_index.get();
+  }
   return true;
 }
 
@@ -123,20 +131,28 @@ bool Prism::Save() {
   return ShrinkToFit();
 }
 
+static bool completion_less(const prism::Completion& a,
+                            const prism::Completion& b) {
+  if (a.length != b.length)
+    return a.length < b.length;
+  if (a.weight != b.weight)
+    return a.weight > b.weight;
+  return a.spelling_id < b.spelling_id;
+}
+
 bool Prism::Build(const Syllabary& syllabary,
                   const Script* script,
                   uint32_t dict_file_checksum,
-                  uint32_t schema_file_checksum) {
+                  uint32_t schema_file_checksum,
+                  const std::vector<double>* syllable_weights) {
   // building double-array trie
   size_t num_syllables = syllabary.size();
   size_t num_spellings = script ? script->size() : syllabary.size();
   std::vector<const char*> keys(num_spellings);
   size_t key_id = 0;
-  size_t map_size = 0;
   if (script) {
     for (auto it = script->begin(); it != script->end(); ++it, ++key_id) {
       keys[key_id] = it->first.c_str();
-      map_size += it->second.size();
     }
   }
   else {
@@ -148,14 +164,79 @@ bool Prism::Build(const Syllabary& syllabary,
     LOG(ERROR) << "Error building double-array trie.";
     return false;
   }
-  // creating prism file
+  // collecting completions of each spelling prefix
+  std::map<size_t, std::vector<prism::Completion>> completions;
+  std::map<std::string, SyllableId> syllable_to_id;
+  if (script) {
+    SyllableId syll_id = 0;
+    for (auto it = syllabary.begin(); it != syllabary.end(); ++it) {
+      syllable_to_id[*it] = syll_id++;
+    }
+  }
+  if (syllable_weights) {
+    auto syllable_weight = [&](SyllableId id) {
+      return id >= 0 && id < static_cast<SyllableId>(syllable_weights->size())
+          ? (*syllable_weights)[id] : 0.0;
+    };
+    std::vector<double> spelling_weights(num_spellings);
+    if (script) {
+      key_id = 0;
+      for (auto it = script->begin(); it != script->end(); ++it, ++key_id) {
+        for (const Spelling& spelling : it->second) {
+          double weight = syllable_weight(syllable_to_id[spelling.str]) *
+              spelling.properties.credibility;
+          spelling_weights[key_id] = (std::max)(spelling_weights[key_id],
+                                                weight);
+        }
+      }
+    }
+    else {
+      for (key_id = 0; key_id < num_spellings; ++key_id) {
+        spelling_weights[key_id] = syllable_weight(key_id);
+      }
+    }
+    for (key_id = 0; key_id < num_spellings; ++key_id) {
+      const char* key = keys[key_id];
+      size_t length = std::strlen(key);
+      prism::Completion completion{static_cast<SyllableId>(key_id),
+                                   static_cast<uint32_t>(length),
+                                   static_cast<float>(
+                                       spelling_weights[key_id])};
+      size_t node_pos = 0;
+      for (size_t key_pos = 0; key_pos < length; ) {
+        trie_->traverse(key, node_pos, key_pos, key_pos + 1);
+        completions[node_pos].push_back(completion);
+      }
+    }
+    for (auto& x : completions) {
+      std::sort(x.second.begin(), x.second.end(), completion_less);
+    }
+  }
+  // measuring prism file
   size_t array_size = trie_->size();
   size_t image_size = trie_->total_size();
-  const size_t kDescriptorExtraSize = 12;
-  size_t estimated_map_size = num_spellings * 12 +
-      map_size * (4 + sizeof(prism::SpellingDescriptor) + kDescriptorExtraSize);
-  const size_t kReservedSize = 1024;
-  if (!Create(image_size + estimated_map_size + kReservedSize)) {
+  MappedFileSizer sizer;
+  sizer.Allocate<prism::Metadata>();
+  sizer.Allocate<char>(image_size);
+  if (script) {
+    sizer.CreateArray<prism::SpellingMapItem>(num_spellings);
+    for (const auto& v : *script) {
+      sizer.Allocate<prism::SpellingDescriptor>(v.second.size());
+      for (const Spelling& spelling : v.second) {
+        if (!spelling.properties.tips.empty())
+          sizer.CopyString(spelling.properties.tips);
+      }
+    }
+  }
+  if (!completions.empty()) {
+    sizer.CreateArray<prism::CompletionIndexNode>(completions.size());
+    for (const auto& x : completions) {
+      sizer.Allocate<prism::Completion>(
+          (std::min)(x.second.size(), kMaxCompletions));
+    }
+  }
+  // creating prism file
+  if (!Create(sizer.size())) {
     LOG(ERROR) << "Error creating prism file '" << file_name() << "'.";
     return false;
   }
@@ -193,11 +274,6 @@ bool Prism::Build(const Syllabary& syllabary,
   metadata->double_array_size = array_size;
   // building spelling map
   if (script) {
-    std::map<std::string, SyllableId> syllable_to_id;
-    SyllableId syll_id = 0;
-    for (auto it = syllabary.begin(); it != syllabary.end(); ++it) {
-      syllable_to_id[*it] = syll_id++;
-    }
     auto spelling_map = CreateArray<prism::SpellingMapItem>(num_spellings);
     if (!spelling_map) {
       LOG(ERROR) << "Error creating spelling map.";
@@ -229,6 +305,31 @@ bool Prism::Build(const Syllabary& syllabary,
     metadata->spelling_map = spelling_map;
     spelling_map_ = spelling_map;
   }
+  // building completion index
+  if (!completions.empty()) {
+    auto index = CreateArray<prism::CompletionIndexNode>(completions.size());
+    if (!index) {
+      LOG(ERROR) << "Error creating completion index.";
+      return false;
+    }
+    auto node = index->begin();
+    for (const auto& x : completions) {
+      size_t list_size = (std::min)(x.second.size(), kMaxCompletions);
+      node->node_pos = static_cast<uint32_t>(x.first);
+      node->num_completions = static_cast<uint32_t>(x.second.size());
+      node->completions.size = list_size;
+      node->completions.at = Allocate<prism::Completion>(list_size);
+      if (!node->completions.at) {
+        LOG(ERROR) << "Error creating completion list.";
+        return false;
+      }
+      std::copy(x.second.begin(), x.second.begin() + list_size,
+                node->completions.begin());
+      ++node;
+    }
+    metadata->completion_index = index;
+    completion_index_ = index;
+  }
   // at last, complete the metadata
   std::strncpy(metadata->format, kPrismFormat,
                prism::Metadata::kFormatMaxLength);
@@ -253,12 +354,17 @@ bool Prism::GetValue(const std::string& key, int* value) {
 // a common prefix with that key.
 void Prism::CommonPrefixSearch(const std::string& key,
                                std::vector<Match>* result) {
-  if (!result || key.empty())
+  CommonPrefixSearch(key.c_str(), key.length(), result);
+}
+
+void Prism::CommonPrefixSearch(const char* key, size_t length,
+                               std::vector<Match>* result) {
+  if (!result || length == 0)
     return;
-  size_t len = key.length();
-  result->resize(len);
-  size_t num_results = trie_->commonPrefixSearch(key.c_str(),
-                                                 &result->front(), len, len);
+  result->resize(length);
+  size_t num_results = trie_->commonPrefixSearch(key,
+                                                 &result->front(),
+                                                 length, length);
   result->resize(num_results);
 }
 
@@ -275,6 +381,8 @@ void Prism::ExpandSearch(const std::string& key,
   //key is not a valid path
   if (ret == -2)
     return;
+  if (LookupCompletions(node_pos, result, limit))
+    return;
   if (ret != -1) {
     result->push_back(Match{ret, key_pos});
     if (limit && ++count >= limit)
@@ -308,6 +416,34 @@ void Prism::ExpandSearch(const std::string& key,
   }
 }
 
+bool Prism::LookupCompletions(size_t node_pos,
+                              std::vector<Match>* result, size_t limit) {
+  if (!completion_index_ || node_pos == 0)
+    return false;
+  prism::CompletionIndexNode target;
+  target.node_pos = static_cast<uint32_t>(node_pos);
+  auto node = std::lower_bound(
+      completion_index_->begin(), completion_index_->end(), target,
+      [](const prism::CompletionIndexNode& a,
+         const prism::CompletionIndexNode& b) {
+        return a.node_pos < b.node_pos;
+      });
+  if (node == completion_index_->end() ||
+      node->node_pos != static_cast<uint32_t>(node_pos))
+    return false;
+  size_t size = node->completions.size;
+  bool truncated = node->num_completions > size;
+  if (truncated && (!limit || limit > size))
+    return false;  // fall back to the full search
+  if (limit && limit < size)
+    size = limit;
+  for (size_t i = 0; i < size; ++i) {
+    const auto& completion(node->completions.at[i]);
+    result->push_back(Match{completion.spelling_id, completion.length});
+  }
+  return true;
+}
+
 SpellingAccessor Prism::QuerySpelling(SyllableId spelling_id) {
   return SpellingAccessor(spelling_map_, spelling_id);
 }
@@ -5,6 +5,7 @@
 // 2012-01-05 GONG Chen <chen.sst@gmail.com>
 // 2014-07-06 GONG Chen <chen.sst@gmail.com> redesigned binary file format.
 //
+#include <mutex>
 #include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
@@ -84,7 +85,6 @@ bool ReverseDb::Build(DictSettings* settings,
                       const Vocabulary& vocabulary,
                       const ReverseLookupTable& stems,
                       uint32_t dict_file_checksum) {
-  LOG(INFO) << "building reversedb...";
   ReverseLookupTable rev_table;
   int syllable_id = 0;
   for (const std::string& syllable : syllabary) {
@@ -96,6 +96,14 @@ bool ReverseDb::Build(DictSettings* settings,
       rev_table[e->text].insert(syllable);
     }
   }
+  return Build(settings, rev_table, stems, dict_file_checksum);
+}
+
+bool ReverseDb::Build(DictSettings* settings,
+                      const ReverseLookupTable& rev_table,
+                      const ReverseLookupTable& stems,
+                      uint32_t dict_file_checksum) {
+  LOG(INFO) << "building reversedb...";
   StringTableBuilder key_trie_builder;
   StringTableBuilder value_trie_builder;
   size_t entry_count = rev_table.size() + stems.size();
@@ -130,14 +138,17 @@ bool ReverseDb::Build(DictSettings* settings,
   }
 
   // creating reversedb file
-  const size_t kReservedSize = 1024;
   size_t key_trie_image_size = key_trie_builder.BinarySize();
   size_t value_trie_image_size = value_trie_builder.BinarySize();
-  size_t estimated_data_size = kReservedSize +
-      dict_settings.length() +
-      entry_count * sizeof(StringId) +
-      key_trie_image_size + value_trie_image_size;
-  if (!Create(estimated_data_size)) {
+  MappedFileSizer sizer;
+  sizer.Allocate<reverse::Metadata>();
+  if (!dict_settings.empty()) {
+    sizer.CopyString(dict_settings);
+  }
+  sizer.Allocate<StringId>(entry_count);
+  sizer.Allocate<char>(key_trie_image_size);
+  sizer.Allocate<char>(value_trie_image_size);
+  if (!Create(sizer.size())) {
     LOG(ERROR) << "Error creating prism file '" << file_name() << "'.";
     return false;
   }
@@ -177,7 +188,7 @@ bool ReverseDb::Build(DictSettings* settings,
   metadata_->key_trie_size = key_trie_image_size;
 
   // save value trie image
-  char* value_trie_image = Allocate<char>();
+  char* value_trie_image = Allocate<char>(value_trie_image_size);
   if (!value_trie_image) {
     LOG(ERROR) << "Error creating value trie image.";
     return false;
@@ -205,6 +216,9 @@ ReverseLookupDictionary::ReverseLookupDictionary(const std::string& dict_name)
 }
 
 bool ReverseLookupDictionary::Load() {
+  // reverse dbs are shared by sessions in different threads
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
   return db_ && (db_->IsOpen() || db_->Load());
 }
 
@@ -246,6 +260,7 @@ ReverseLookupDictionaryComponent::Create(const Ticket& ticket) {
     // missing!
     return NULL;
   }
+  std::lock_guard<std::mutex> lock(mutex_);
   auto db = db_pool_[dict_name].lock();
   if (!db) {
     db = New<ReverseDb>(dict_name);
@@ -5,6 +5,7 @@
 // 2014-07-04 GONG Chen <chen.sst@gmail.com>
 //
 
+#include <cstring>
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <rime/common.h>
@@ -12,8 +13,78 @@
 
 namespace rime {
 
-StringTable::StringTable(const char* ptr, size_t size) {
+StringCache::StringCache(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  slots_.reset(new Slot[size]);
+  for (size_t i = 0; i < size; ++i) {
+    Slot& slot(slots_[i]);
+    slot.sequence.store(0, std::memory_order_relaxed);
+    slot.string_id.store(kInvalidStringId, std::memory_order_relaxed);
+    slot.hits.store(0, std::memory_order_relaxed);
+    for (auto& word : slot.words)
+      word.store(0, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+}
+
+bool StringCache::Get(StringId string_id, std::string* value) const {
+  Slot& slot(slots_[string_id & mask_]);
+  uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+  if (sequence & 1)
+    return false;
+  if (slot.string_id.load(std::memory_order_relaxed) != string_id)
+    return false;
+  uint64_t words[kNumWords];
+  for (size_t i = 0; i < kNumWords; ++i)
+    words[i] = slot.words[i].load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+    return false;  // replaced while reading
+  const char* bytes = reinterpret_cast<const char*>(words);
+  value->assign(bytes + 1, static_cast<uint8_t>(bytes[0]));
+  uint8_t hits = slot.hits.load(std::memory_order_relaxed);
+  if (hits < kMaxHits)
+    slot.hits.store(hits + 1, std::memory_order_relaxed);
+  return true;
+}
+
+void StringCache::Put(StringId string_id, const char* str, size_t length) {
+  if (string_id == kInvalidStringId || length > kMaxLength)
+    return;
+  Slot& slot(slots_[string_id & mask_]);
+  if (slot.string_id.load(std::memory_order_relaxed) == string_id)
+    return;
+  // the cached string resists as many collisions as it has been hit
+  uint8_t hits = slot.hits.load(std::memory_order_relaxed);
+  if (hits > 0) {
+    slot.hits.store(hits - 1, std::memory_order_relaxed);
+    return;
+  }
+  uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) ||
+      !slot.sequence.compare_exchange_strong(sequence, sequence + 1,
+                                             std::memory_order_relaxed))
+    return;  // being written by another thread
+  std::atomic_thread_fence(std::memory_order_release);
+  uint64_t words[kNumWords] = {0};
+  char* bytes = reinterpret_cast<char*>(words);
+  bytes[0] = static_cast<char>(length);
+  std::memcpy(bytes + 1, str, length);
+  for (size_t i = 0; i < kNumWords; ++i)
+    slot.words[i].store(words[i], std::memory_order_relaxed);
+  slot.string_id.store(string_id, std::memory_order_relaxed);
+  slot.hits.store(0, std::memory_order_relaxed);
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+StringTable::StringTable(const char* ptr, size_t size,
+                         size_t cache_capacity) {
   trie_.map(ptr, size);
+  if (cache_capacity > 0) {
+    cache_.reset(new StringCache(cache_capacity));
+  }
 }
 
 bool StringTable::HasKey(const std::string& key) {
@@ -54,6 +125,10 @@ void StringTable::Predict(const std::string& query,
 }
 
 std::string StringTable::GetString(StringId string_id) {
+  std::string result;
+  if (cache_ && cache_->Get(string_id, &result)) {
+    return result;
+  }
   marisa::Agent agent;
   agent.set_query(string_id);
   try {
@@ -63,6 +138,9 @@ std::string StringTable::GetString(StringId string_id) {
     LOG(ERROR) << "invalid id for string table: " << string_id;
     return std::string();
   }
+  if (cache_) {
+    cache_->Put(string_id, agent.key().ptr(), agent.key().length());
+  }
   return std::string(agent.key().ptr(), agent.key().length());
 }
 
@@ -7,66 +7,105 @@
 #include <cfloat>
 #include <cstring>
 #include <algorithm>
-#include <queue>
 #include <vector>
 #include <utility>
 #include <rime/algo/syllabifier.h>
 #include <rime/dict/table.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RIME_TABLE_SSE2
+#endif
+
 #define RIME_THIS_CALL(f) (this->*(f))
 
 namespace rime {
 
 const char kTableFormat_v1[] = "Rime::Table/1.0";
 const char kTableFormat_v2[] = "Rime::Table/2.0";
+const char kTableFormat_v3[] = "Rime::Table/3.0";
+const char kTableFormat_v4[] = "Rime::Table/4.0";
+const char kTableFormat_v5[] = "Rime::Table/5.0";
 
 const char kTableFormatPrefix[] = "Rime::Table/";
 const size_t kTableFormatPrefixLen = sizeof(kTableFormatPrefix) - 1;
 
-class TableQuery {
- public:
-  TableQuery(table::Index* index) : lv1_index_(index) {
-    Reset();
-  }
-
-  TableAccessor Access(SyllableId syllable_id,
-                       double credibility = 1.0) const;
+Code IndexCode::ToCode() const {
+  Code code;
+  code.assign(begin(), end());
+  return code;
+}
 
-  // down to next level
-  bool Advance(SyllableId syllable_id, double credibility = 1.0);
+namespace table {
 
-  // up one level
-  bool Backdate();
+EntryRun EntryRun::Skip(size_t n) const {
+  if (entries_)
+    return EntryRun(entries_ + n);
+  if (n < hot_size_)
+    return EntryRun(hot_texts_ + n, hot_weights_ + n, hot_size_ - n,
+                    cold_texts_, cold_weights_);
+  n -= hot_size_;
+  return EntryRun(nullptr, nullptr, 0,
+                  cold_texts_ ? cold_texts_ + n : nullptr,
+                  cold_weights_ ? cold_weights_ + n : nullptr);
+}
 
-  // back to root
-  void Reset();
+}  // namespace table
 
-  size_t level() const { return level_; }
+// a block of compact entries holds their texts, then their weights, padded
+// to 4 bytes. a block in the hot region is followed by a link to the block
+// of the rest of the entries in the cold region, if any.
+static inline size_t compact_block_size(size_t count) {
+  size_t size = count * (sizeof(table::StringType) +
+                         sizeof(table::CompactWeight));
+  return (size + 3) & ~size_t(3);
+}
 
- protected:
-  size_t level_ = 0;
-  Code index_code_;
-  std::vector<double> credibility_;
+static inline size_t hot_block_size(size_t count, size_t num_hot_entries) {
+  return count > num_hot_entries ?
+      compact_block_size(num_hot_entries) + sizeof(OffsetPtr<char>) :
+      compact_block_size(count);
+}
 
- private:
-  bool Walk(SyllableId syllable_id);
+static inline size_t cold_block_size(size_t count, size_t num_hot_entries) {
+  return count > num_hot_entries ?
+      compact_block_size(count - num_hot_entries) : 0;
+}
 
-  table::HeadIndex* lv1_index_ = nullptr;
-  table::TrunkIndex* lv2_index_ = nullptr;
-  table::TrunkIndex* lv3_index_ = nullptr;
-  table::TailIndex* lv4_index_ = nullptr;
-};
+static table::EntryRun compact_entry_run(const char* block,
+                                         size_t count,
+                                         size_t num_hot_entries) {
+  if (!block)
+    return table::EntryRun();
+  size_t hot_size = (std::min)(count, num_hot_entries);
+  auto hot_texts = reinterpret_cast<const table::StringType*>(block);
+  auto hot_weights =
+      reinterpret_cast<const table::CompactWeight*>(hot_texts + hot_size);
+  const table::StringType* cold_texts = nullptr;
+  const table::CompactWeight* cold_weights = nullptr;
+  if (count > hot_size) {
+    auto link = reinterpret_cast<const OffsetPtr<char>*>(
+        block + compact_block_size(hot_size));
+    cold_texts = reinterpret_cast<const table::StringType*>(link->get());
+    cold_weights = reinterpret_cast<const table::CompactWeight*>(
+        cold_texts + (count - hot_size));
+  }
+  return table::EntryRun(hot_texts, hot_weights, hot_size,
+                         cold_texts, cold_weights);
+}
 
-TableAccessor::TableAccessor(const Code& index_code,
-                             const List<table::Entry>* list,
+TableAccessor::TableAccessor(const IndexCode& index_code,
+                             const table::EntryRun& entries,
+                             size_t size,
                              double credibility)
     : index_code_(index_code),
-      entries_(list->at.get()),
-      size_(list->size),
+      entries_(entries),
+      size_(size),
       credibility_(credibility) {
 }
 
-TableAccessor::TableAccessor(const Code& index_code,
+TableAccessor::TableAccessor(const IndexCode& index_code,
                              const Array<table::Entry>* array,
                              double credibility)
     : index_code_(index_code),
@@ -75,7 +114,7 @@ TableAccessor::TableAccessor(const Code& index_code,
       credibility_(credibility) {
 }
 
-TableAccessor::TableAccessor(const Code& index_code,
+TableAccessor::TableAccessor(const IndexCode& index_code,
                              const table::TailIndex* code_map,
                              double credibility)
     : index_code_(index_code),
@@ -101,10 +140,33 @@ size_t TableAccessor::remaining() const {
 const table::Entry* TableAccessor::entry() const {
   if (exhausted())
     return NULL;
-  if (entries_)
-    return &entries_[cursor_];
-  else
+  if (long_entries_)
     return &long_entries_[cursor_].entry;
+  if (entries_.entries())
+    return &entries_.entries()[cursor_];
+  return NULL;
+}
+
+const table::StringType* TableAccessor::text() const {
+  if (exhausted())
+    return NULL;
+  if (long_entries_)
+    return &long_entries_[cursor_].entry.text;
+  return &entries_.text(cursor_);
+}
+
+table::Weight TableAccessor::weight() const {
+  if (exhausted())
+    return 0;
+  if (long_entries_)
+    return long_entries_[cursor_].entry.weight;
+  return entries_.weight(cursor_);
+}
+
+table::EntryRun TableAccessor::remaining_entries() const {
+  if (!entries_)
+    return table::EntryRun();
+  return entries_.Skip(cursor_);
 }
 
 const table::Code* TableAccessor::extra_code() const {
@@ -116,9 +178,11 @@ const table::Code* TableAccessor::extra_code() const {
 Code TableAccessor::code() const {
   auto extra = extra_code();
   if (!extra) {
-    return index_code();
+    return index_code_.ToCode();
   }
-  Code code(index_code());
+  Code code;
+  code.reserve(index_code_.size() + extra->size);
+  code.assign(index_code_.begin(), index_code_.end());
   for (auto p = extra->begin(); p != extra->end(); ++p) {
     code.push_back(*p);
   }
@@ -136,9 +200,9 @@ bool TableQuery::Advance(SyllableId syllable_id, double credibility) {
   if (!Walk(syllable_id)) {
     return false;
   }
+  credibility_[level_ + 1] = credibility_[level_] * credibility;
   ++level_;
   index_code_.push_back(syllable_id);
-  credibility_.push_back(credibility_.back() * credibility);
   return true;
 }
 
@@ -148,7 +212,6 @@ bool TableQuery::Backdate() {
   --level_;
   if (index_code_.size() > level_) {
     index_code_.pop_back();
-    credibility_.pop_back();
   }
   return true;
 }
@@ -156,50 +219,127 @@ bool TableQuery::Backdate() {
 void TableQuery::Reset() {
   level_ = 0;
   index_code_.clear();
-  credibility_.clear();
-  credibility_.push_back(1.0);
+  credibility_[0] = 1.0;
 }
 
-inline static bool node_less(const table::TrunkIndexNode& a,
-                             const table::TrunkIndexNode& b) {
+template <class Node>
+inline static bool node_less(const Node& a, const Node& b) {
   return a.key < b.key;
 }
 
-static table::TrunkIndexNode* find_node(table::TrunkIndexNode* first,
-                                        table::TrunkIndexNode* last,
-                                        const SyllableId& key) {
-  table::TrunkIndexNode target;
+template <class Node>
+static const Node* find_node(const Node* first,
+                             const Node* last,
+                             const SyllableId& key) {
+  Node target;
   target.key = key;
-  auto it = std::lower_bound(first, last, target, node_less);
+  auto it = std::lower_bound(first, last, target, node_less<Node>);
   return it == last || key < it->key ? last : it;
 }
 
+// keys left to a linear scan by binary search
+static const size_t kKeyBlockSize = 16;
+
+// finds the key in ascending keys; returns size if not found.
+static size_t find_key(const SyllableId* keys,
+                       size_t size,
+                       SyllableId key) {
+  // branchless binary search, narrowing down to a block of keys
+  const SyllableId* base = keys;
+  size_t n = size;
+  while (n > kKeyBlockSize) {
+    size_t half = n / 2;
+    base = (base[half] < key) ? base + half : base;
+    n -= half;
+  }
+  // counting keys less than the target
+  size_t i = 0;
+#ifdef RIME_TABLE_SSE2
+  const __m128i target = _mm_set1_epi32(key);
+  for (; i + 4 <= n; i += 4) {
+    __m128i block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(base + i));
+    int mask = _mm_movemask_ps(
+        _mm_castsi128_ps(_mm_cmplt_epi32(block, target)));
+    if (mask != 0xf) {
+      // lesser keys come first in a sorted block
+      while (mask & 1) {
+        ++i;
+        mask >>= 1;
+      }
+      n = i;
+      break;
+    }
+  }
+#endif
+  while (i < n && base[i] < key) {
+    ++i;
+  }
+  size_t pos = (base - keys) + i;
+  return pos < size && keys[pos] == key ? pos : size;
+}
+
 bool TableQuery::Walk(SyllableId syllable_id) {
+  if (keyed_)
+    return WalkKeyedIndex(syllable_id);
+  return wide_ ? WalkIndex<int64_t>(syllable_id) :
+      WalkIndex<int32_t>(syllable_id);
+}
+
+bool TableQuery::WalkKeyedIndex(SyllableId syllable_id) {
+  if (level_ != 1 && level_ != 2) {
+    // head and tail indexes are the same as in the v2 format
+    return WalkIndex<int32_t>(syllable_id);
+  }
+  auto index = static_cast<const table::KeyedTrunkIndex*>(
+      (level_ == 1) ? lv2_index_ : lv3_index_);
+  if (!index)
+    return false;
+  size_t pos = find_key(index->keys.get(), index->size, syllable_id);
+  if (pos == index->size)
+    return false;
+  const auto& node(index->nodes[pos]);
+  if (!node.next_level)
+    return false;
+  if (level_ == 1)
+    lv3_index_ = &node.next_level->trunk;
+  else
+    lv4_index_ = &node.next_level->tail;
+  return true;
+}
+
+template <class Offset>
+bool TableQuery::WalkIndex(SyllableId syllable_id) {
+  using HeadIndex = Array<table::BasicHeadIndexNode<Offset>>;
+  using TrunkIndex = Array<table::BasicTrunkIndexNode<Offset>>;
   if (level_ == 0) {
-    if (!lv1_index_ ||
+    auto lv1_index = static_cast<const HeadIndex*>(lv1_index_);
+    if (!lv1_index ||
         syllable_id < 0 ||
-        syllable_id >= static_cast<SyllableId>(lv1_index_->size))
+        syllable_id >= static_cast<SyllableId>(lv1_index->size))
       return false;
-    auto node = &lv1_index_->at[syllable_id];
+    auto node = &lv1_index->at[syllable_id];
     if (!node->next_level)
       return false;
     lv2_index_ = &node->next_level->trunk;
   }
   else if (level_ == 1) {
-    if (!lv2_index_)
+    auto lv2_index = static_cast<const TrunkIndex*>(lv2_index_);
+    if (!lv2_index)
       return false;
-    auto node = find_node(lv2_index_->begin(), lv2_index_->end(), syllable_id);
-    if (node == lv2_index_->end())
+    auto node = find_node(lv2_index->begin(), lv2_index->end(), syllable_id);
+    if (node == lv2_index->end())
       return false;
     if (!node->next_level)
       return false;
     lv3_index_ = &node->next_level->trunk;
   }
   else if (level_ == 2) {
-    if (!lv3_index_)
+    auto lv3_index = static_cast<const TrunkIndex*>(lv3_index_);
+    if (!lv3_index)
       return false;
-    auto node = find_node(lv3_index_->begin(), lv3_index_->end(), syllable_id);
-    if (node == lv3_index_->end())
+    auto node = find_node(lv3_index->begin(), lv3_index->end(), syllable_id);
+    if (node == lv3_index->end())
       return false;
     if (!node->next_level)
       return false;
@@ -211,32 +351,60 @@ bool TableQuery::Walk(SyllableId syllable_id) {
   return true;
 }
 
-inline static Code add_syllable(Code code, SyllableId syllable_id) {
+inline static IndexCode add_syllable(IndexCode code,
+                                     SyllableId syllable_id) {
   code.push_back(syllable_id);
   return code;
 }
 
 TableAccessor TableQuery::Access(SyllableId syllable_id,
                                  double credibility) const {
-  credibility *= credibility_.back();
+  credibility *= credibility_[level_];
+  if (keyed_)
+    return AccessKeyedIndex(syllable_id, credibility);
+  return wide_ ? AccessIndex<int64_t>(syllable_id, credibility) :
+      AccessIndex<int32_t>(syllable_id, credibility);
+}
+
+template <class Offset>
+TableAccessor TableQuery::AccessEntries(
+    SyllableId syllable_id,
+    const List<table::Entry, uint32_t, Offset>* entries,
+    double credibility) const {
+  if (!num_hot_entries_) {
+    return TableAccessor(add_syllable(index_code_, syllable_id),
+                         entries, credibility);
+  }
+  return TableAccessor(add_syllable(index_code_, syllable_id),
+                       compact_entry_run(
+                           reinterpret_cast<const char*>(entries->at.get()),
+                           entries->size, num_hot_entries_),
+                       entries->size, credibility);
+}
+
+template <class Offset>
+TableAccessor TableQuery::AccessIndex(SyllableId syllable_id,
+                                      double credibility) const {
+  using HeadIndex = Array<table::BasicHeadIndexNode<Offset>>;
+  using TrunkIndex = Array<table::BasicTrunkIndexNode<Offset>>;
   if (level_ == 0) {
-    if (!lv1_index_ ||
+    auto lv1_index = static_cast<const HeadIndex*>(lv1_index_);
+    if (!lv1_index ||
         syllable_id < 0 ||
-        syllable_id >= static_cast<SyllableId>(lv1_index_->size))
+        syllable_id >= static_cast<SyllableId>(lv1_index->size))
       return TableAccessor();
-    auto node = &lv1_index_->at[syllable_id];
-    return TableAccessor(add_syllable(index_code_, syllable_id),
-                         &node->entries, credibility);
+    auto node = &lv1_index->at[syllable_id];
+    return AccessEntries(syllable_id, &node->entries, credibility);
   }
   else if (level_ == 1 || level_ == 2) {
-    auto index = (level_ == 1) ? lv2_index_ : lv3_index_;
+    auto index = static_cast<const TrunkIndex*>(
+        (level_ == 1) ? lv2_index_ : lv3_index_);
     if (!index)
       return TableAccessor();
     auto node = find_node(index->begin(), index->end(), syllable_id);
     if (node == index->end())
       return TableAccessor();
-    return TableAccessor(add_syllable(index_code_, syllable_id),
-                         &node->entries, credibility);
+    return AccessEntries(syllable_id, &node->entries, credibility);
   }
   else if (level_ == 3) {
     if (!lv4_index_)
@@ -246,6 +414,46 @@ TableAccessor TableQuery::Access(SyllableId syllable_id,
   return TableAccessor();
 }
 
+TableAccessor TableQuery::AccessKeyedIndex(SyllableId syllable_id,
+                                           double credibility) const {
+  if (level_ != 1 && level_ != 2) {
+    return AccessIndex<int32_t>(syllable_id, credibility);
+  }
+  auto index = static_cast<const table::KeyedTrunkIndex*>(
+      (level_ == 1) ? lv2_index_ : lv3_index_);
+  if (!index)
+    return TableAccessor();
+  size_t pos = find_key(index->keys.get(), index->size, syllable_id);
+  if (pos == index->size)
+    return TableAccessor();
+  return AccessEntries(syllable_id, &index->nodes[pos].entries, credibility);
+}
+
+void TableQueryArena::Clear() {
+  queue_.clear();
+  found_.clear();
+  matches_.clear();
+}
+
+// counting sort by end position, keeping the order of matches found.
+void TableQueryArena::SortMatches() {
+  size_t max_end_pos = 0;
+  for (const auto& match : found_) {
+    max_end_pos = (std::max)(max_end_pos, match.end_pos);
+  }
+  offsets_.assign(max_end_pos + 2, 0);
+  for (const auto& match : found_) {
+    ++offsets_[match.end_pos + 1];
+  }
+  for (size_t i = 1; i < offsets_.size(); ++i) {
+    offsets_[i] += offsets_[i - 1];
+  }
+  matches_.resize(found_.size());
+  for (const auto& match : found_) {
+    matches_[offsets_[match.end_pos]++] = match;
+  }
+}
+
 std::string Table::GetString_v1(const table::StringType& x) {
  return x.str.c_str();
 }
@@ -259,27 +467,46 @@ std::string Table::GetString_v2(const table::StringType& x) {
   return string_table_->GetString(x.str_id);
 }
 
+// strings have been added to the string table in the first pass, in the
+// same order as they are stored.
 bool Table::AddString_v2(const std::string& src, table::StringType* dest,
-                         double weight) {
-  string_table_builder_->Add(src, weight, &dest->str_id);
+                         double /*weight*/) {
+  if (next_string_ >= string_ids_.size()) {
+    LOG(ERROR) << "string not found in string table: " << src;
+    return false;
+  }
+  dest->str_id = string_ids_[next_string_++];
   return true;
 }
 
 bool Table::OnBuildStart_v2() {
   string_table_builder_.reset(new StringTableBuilder);
+  string_ids_.clear();
+  next_string_ = 0;
   return true;
 }
 
-bool Table::OnBuildFinish_v2() {
-  string_table_builder_->Build();
+char* Table::SaveStringTable(size_t* image_size) {
   // saving string table image
-  size_t image_size = string_table_builder_->BinarySize();
-  char* image = Allocate<char>(image_size);
+  *image_size = string_table_builder_->BinarySize();
+  char* image = Allocate<char>(*image_size);
   if (!image) {
     LOG(ERROR) << "Error creating string table image.";
+    return NULL;
+  }
+  string_table_builder_->Dump(image, *image_size);
+  return image;
+}
+
+bool Table::OnBuildFinish_v2() {
+  size_t image_size = 0;
+  char* image = SaveStringTable(&image_size);
+  if (!image)
+    return false;
+  if (image_size > UINT32_MAX) {
+    LOG(ERROR) << "string table too large for format " << kTableFormat_v2;
     return false;
   }
-  string_table_builder_->Dump(image, image_size);
   metadata_->string_table = image;
   metadata_->string_table_size = image_size;
   return true;
@@ -287,12 +514,87 @@ bool Table::OnBuildFinish_v2() {
 
 bool Table::OnLoad_v2() {
   string_table_.reset(new StringTable(metadata_->string_table.get(),
-                                      metadata_->string_table_size));
+                                      metadata_->string_table_size,
+                                      string_cache_capacity_));
+  return true;
+}
+
+bool Table::OnBuildFinish_v3() {
+  size_t image_size = 0;
+  char* image = SaveStringTable(&image_size);
+  if (!image)
+    return false;
+  metadata64_->string_table = image;
+  metadata64_->string_table_size = image_size;
+  return true;
+}
+
+bool Table::OnBuildFinish_v5() {
+  if (!OnBuildFinish_v2())
+    return false;
+  metadata_->num_hot_entries = kNumHotEntries;
+  num_hot_entries_ = kNumHotEntries;
+  return true;
+}
+
+bool Table::OnLoad_v5() {
+  num_hot_entries_ = metadata_->num_hot_entries;
+  if (!num_hot_entries_) {
+    LOG(ERROR) << "invalid number of hot entries.";
+    return false;
+  }
+  return OnLoad_v2();
+}
+
+bool Table::OnLoad_v3() {
+  string_table_.reset(new StringTable(metadata64_->string_table.get(),
+                                      metadata64_->string_table_size,
+                                      string_cache_capacity_));
   return true;
 }
 
+// tells if the format version read from metadata is no less than required.
+// the margin scales with the version, as 3.0 - DBL_EPSILON == 3.0.
+static inline bool version_at_least(double version, double required) {
+  return version > required - required * DBL_EPSILON;
+}
+
+// the v3 format alone is linked by 64-bit offsets
+static inline bool is_wide_format(double version) {
+  return version_at_least(version, 3.0) && !version_at_least(version, 4.0);
+}
+
 void Table::SelectTableFormat(double format_version) {
-  if (format_version > 2.0 - DBL_EPSILON) {
+  format_.keyed_trunk_index = false;
+  format_.compact_entries = false;
+  if (version_at_least(format_version, 5.0)) {
+    format_.format_name = kTableFormat_v5;
+    format_.GetString = &Table::GetString_v2;
+    format_.AddString = &Table::AddString_v2;
+    format_.OnBuildStart = &Table::OnBuildStart_v2;
+    format_.OnBuildFinish = &Table::OnBuildFinish_v5;
+    format_.OnLoad = &Table::OnLoad_v5;
+    format_.keyed_trunk_index = true;
+    format_.compact_entries = true;
+  }
+  else if (version_at_least(format_version, 4.0)) {
+    format_.format_name = kTableFormat_v4;
+    format_.GetString = &Table::GetString_v2;
+    format_.AddString = &Table::AddString_v2;
+    format_.OnBuildStart = &Table::OnBuildStart_v2;
+    format_.OnBuildFinish = &Table::OnBuildFinish_v2;
+    format_.OnLoad = &Table::OnLoad_v2;
+    format_.keyed_trunk_index = true;
+  }
+  else if (version_at_least(format_version, 3.0)) {
+    format_.format_name = kTableFormat_v3;
+    format_.GetString = &Table::GetString_v2;
+    format_.AddString = &Table::AddString_v2;
+    format_.OnBuildStart = &Table::OnBuildStart_v2;
+    format_.OnBuildFinish = &Table::OnBuildFinish_v3;
+    format_.OnLoad = &Table::OnLoad_v3;
+  }
+  else if (version_at_least(format_version, 2.0)) {
     format_.format_name = kTableFormat_v2;
     format_.GetString = &Table::GetString_v2;
     format_.AddString = &Table::AddString_v2;
@@ -328,6 +630,8 @@ bool Table::Load() {
   }
 
   metadata_ = Find<table::Metadata>(0);
+  metadata64_ = nullptr;
+  index64_ = nullptr;
   if (!metadata_) {
     LOG(ERROR) << "metadata not found.";
     Close();
@@ -342,14 +646,24 @@ bool Table::Load() {
   SelectTableFormat(format_version);
   format_.format_name = metadata_->format;
 
-  syllabary_ = metadata_->syllabary.get();
+  if (is_wide_format(format_version)) {
+    // the format and checksum precede the 64-bit offsets in either metadata
+    metadata64_ = Find<table::Metadata64>(0);
+    metadata_ = nullptr;
+    syllabary_ = metadata64_->syllabary.get();
+    index64_ = metadata64_->index.get();
+    index_ = nullptr;
+  }
+  else {
+    syllabary_ = metadata_->syllabary.get();
+    index_ = metadata_->index.get();
+  }
   if (!syllabary_) {
     LOG(ERROR) << "syllabary not found.";
     Close();
     return false;
   }
-  index_ = metadata_->index.get();
-  if (!index_) {
+  if (!index_ && !index64_) {
     LOG(ERROR) << "table index not found.";
     Close();
     return false;
@@ -364,7 +678,7 @@ bool Table::Load() {
 bool Table::Save() {
   LOG(INFO) << "saving table file: " << file_name();
 
-  if (!index_) {
+  if (!index_ && !index64_) {
     LOG(ERROR) << "the table has not been constructed!";
     return false;
   }
@@ -373,38 +687,286 @@ bool Table::Save() {
 }
 
 uint32_t Table::dict_file_checksum() const {
-  return metadata_ ? metadata_->dict_file_checksum : 0;
+  return metadata_ ? metadata_->dict_file_checksum :
+      metadata64_ ? metadata64_->dict_file_checksum : 0;
 }
 
+double Table::format_version() const {
+  const char* format = metadata_ ? metadata_->format :
+      metadata64_ ? metadata64_->format : nullptr;
+  if (!format || strncmp(format, kTableFormatPrefix, kTableFormatPrefixLen))
+    return 0.0;
+  return atof(format + kTableFormatPrefixLen);
+}
+
+namespace {
+
+// pages of a vocabulary in memory
+class VocabularyPages : public VocabularyPageSource {
+ public:
+  explicit VocabularyPages(const Vocabulary& vocabulary)
+      : vocabulary_(vocabulary), it_(vocabulary.begin()) {
+  }
+  virtual bool Rewind() {
+    it_ = vocabulary_.begin();
+    return true;
+  }
+  virtual bool Next(SyllableId* syllable_id, VocabularyPage* page) {
+    if (it_ == vocabulary_.end())
+      return false;
+    *syllable_id = it_->first;
+    *page = it_->second;
+    ++it_;
+    return true;
+  }
+
+ private:
+  const Vocabulary& vocabulary_;
+  Vocabulary::const_iterator it_;
+};
+
+// the first pass of building a table, which measures the file in either
+// format, and adds strings to the string table in the order they are stored.
+class TableSizer {
+ public:
+  TableSizer(StringTableBuilder* builder, std::deque<StringId>* string_ids,
+             bool keyed_trunk_index, bool compact_entries)
+      : builder_(builder),
+        string_ids_(string_ids),
+        keyed_trunk_index_(keyed_trunk_index),
+        compact_entries_(compact_entries) {
+  }
+
+  void AddMetadata() {
+    // with compact entries, the metadata is followed by the entry regions,
+    // which are measured apart
+    if (!compact_entries_)
+      narrow_.Allocate<table::Metadata>();
+    wide_.Allocate<table::Metadata64>();
+  }
+  void AddSyllabary(const Syllabary& syllabary) {
+    narrow_.CreateArray<table::StringType>(syllabary.size());
+    wide_.CreateArray<table::StringType>(syllabary.size());
+    for (const std::string& syllable : syllabary) {
+      AddString(syllable, 0.0);
+    }
+  }
+  void AddHeadIndex(size_t num_syllables) {
+    narrow_.CreateArray<table::HeadIndexNode>(num_syllables);
+    wide_.CreateArray<table::HeadIndexNode64>(num_syllables);
+  }
+  void AddHeadPage(const VocabularyPage& page) {
+    AddEntryList(page.entries);
+    if (page.next_level) {
+      AddTrunkIndex(1, *page.next_level);
+    }
+  }
+  void AddStringTable(size_t image_size) {
+    narrow_.Allocate<char>(image_size);
+    wide_.Allocate<char>(image_size);
+  }
+
+  size_t narrow_size() const {
+    if (!compact_entries_)
+      return narrow_.size();
+    // allocated likewise in Table::CreateEntryRegions()
+    MappedFileSizer head;
+    head.Allocate<table::Metadata>();
+    head.Allocate<StringId>(hot_region_size_ / sizeof(StringId));
+    head.Allocate<StringId>(cold_region_size_ / sizeof(StringId));
+    head.Allocate<uint64_t>(0);
+    return head.size() + narrow_.size();
+  }
+  size_t wide_size() const { return wide_.size(); }
+  size_t hot_region_size() const { return hot_region_size_; }
+  size_t cold_region_size() const { return cold_region_size_; }
+
+ private:
+  void AddString(const std::string& str, double weight) {
+    string_ids_->push_back(kInvalidStringId);
+    builder_->Add(str, weight, &string_ids_->back());
+  }
+  void AddEntryList(const DictEntryList& entries) {
+    if (compact_entries_) {
+      size_t num_hot_entries = Table::kNumHotEntries;
+      hot_region_size_ += hot_block_size(entries.size(), num_hot_entries);
+      cold_region_size_ += cold_block_size(entries.size(), num_hot_entries);
+    }
+    else {
+      narrow_.Allocate<table::Entry>(entries.size());
+    }
+    wide_.Allocate<table::Entry>(entries.size());
+    for (const auto& e : entries) {
+      AddString(e->text, e->weight);
+    }
+  }
+  void AddTrunkIndex(size_t prefix_length, const Vocabulary& vocabulary) {
+    if (keyed_trunk_index_) {
+      narrow_.Allocate<table::KeyedTrunkIndex>();
+      narrow_.Allocate<SyllableId>(vocabulary.size());
+      narrow_.Allocate<table::HeadIndexNode>(vocabulary.size());
+    }
+    else {
+      narrow_.CreateArray<table::TrunkIndexNode>(vocabulary.size());
+    }
+    wide_.CreateArray<table::TrunkIndexNode64>(vocabulary.size());
+    for (const auto& v : vocabulary) {
+      AddEntryList(v.second.entries);
+      if (v.second.next_level) {
+        if (prefix_length + 1 < Code::kIndexCodeMaxLength)
+          AddTrunkIndex(prefix_length + 1, *v.second.next_level);
+        else
+          AddTailIndex(*v.second.next_level);
+      }
+    }
+  }
+  void AddTailIndex(const Vocabulary& vocabulary) {
+    auto it = vocabulary.find(-1);
+    if (it == vocabulary.end())
+      return;
+    const auto& entries(it->second.entries);
+    narrow_.CreateArray<table::LongEntry>(entries.size());
+    wide_.CreateArray<table::LongEntry>(entries.size());
+    for (const auto& e : entries) {
+      size_t extra_code_length = e->code.size() - Code::kIndexCodeMaxLength;
+      narrow_.Allocate<SyllableId>(extra_code_length);
+      wide_.Allocate<SyllableId>(extra_code_length);
+      AddString(e->text, e->weight);
+    }
+  }
+
+  StringTableBuilder* builder_;
+  std::deque<StringId>* string_ids_;
+  // the layout of trunk indexes and entries with 32-bit offsets
+  bool keyed_trunk_index_;
+  bool compact_entries_;
+  size_t hot_region_size_ = 0;
+  size_t cold_region_size_ = 0;
+  MappedFileSizer narrow_;
+  MappedFileSizer wide_;
+};
+
+}  // namespace
+
 bool Table::Build(const Syllabary& syllabary, const Vocabulary& vocabulary,
                   size_t num_entries, uint32_t dict_file_checksum) {
-  SelectTableFormat(2.0);
+  VocabularyPages source(vocabulary);
+  return Build(syllabary, &source, num_entries, dict_file_checksum);
+}
 
-  const size_t kReservedSize = 4096;
+bool Table::Build(const Syllabary& syllabary,
+                  VocabularyPageSource* source,
+                  size_t num_entries, uint32_t dict_file_checksum) {
   size_t num_syllables = syllabary.size();
-  size_t estimated_file_size = kReservedSize + 32 * num_syllables + 64 * num_entries;
   LOG(INFO) << "building table.";
   LOG(INFO) << "num syllables: " << num_syllables;
   LOG(INFO) << "num entries: " << num_entries;
-  LOG(INFO) << "estimated file size: " << estimated_file_size;
-  if (!Create(estimated_file_size)) {
+  if (!version_at_least(format_version_, 2.0)) {
+    LOG(ERROR) << "building tables in format " << format_version_
+               << " is not supported.";
+    return false;
+  }
+  // strings are stored likewise in either format
+  SelectTableFormat(format_version_);
+  if (format_.OnBuildStart && !RIME_THIS_CALL(format_.OnBuildStart)()) {
+    return false;
+  }
+
+  LOG(INFO) << "measuring table.";
+  TableSizer sizer(string_table_builder_.get(), &string_ids_,
+                   format_.keyed_trunk_index, format_.compact_entries);
+  sizer.AddMetadata();
+  sizer.AddSyllabary(syllabary);
+  sizer.AddHeadIndex(num_syllables);
+  if (!source->Rewind()) {
+    return false;
+  }
+  SyllableId syllable_id = 0;
+  VocabularyPage page;
+  while (source->Next(&syllable_id, &page)) {
+    sizer.AddHeadPage(page);
+  }
+  string_table_builder_->Build();
+  sizer.AddStringTable(string_table_builder_->BinarySize());
+
+  // tables out of reach of 32-bit offsets are built in the v3 format
+  bool wide = is_wide_format(format_version_) ||
+      sizer.narrow_size() > large_table_threshold_;
+  if (wide) {
+    SelectTableFormat(3.0);
+  }
+  size_t file_size = wide ? sizer.wide_size() : sizer.narrow_size();
+  LOG(INFO) << "format: " << format_.format_name;
+  LOG(INFO) << "file size: " << file_size;
+  if (!Create(file_size)) {
     LOG(ERROR) << "Error creating table file '" << file_name() << "'.";
     return false;
   }
+  if (!source->Rewind()) {
+    return false;
+  }
 
   LOG(INFO) << "creating metadata.";
-  metadata_ = Allocate<table::Metadata>();
-  if (!metadata_) {
-    LOG(ERROR) << "Error creating metadata in file '" << file_name() << "'.";
+  metadata_ = nullptr;
+  metadata64_ = nullptr;
+  index_ = nullptr;
+  index64_ = nullptr;
+  bool success = false;
+  if (wide) {
+    metadata64_ = Allocate<table::Metadata64>();
+    success = BuildContents(metadata64_, &index64_, syllabary, source,
+                            num_entries, dict_file_checksum);
+  }
+  else {
+    metadata_ = Allocate<table::Metadata>();
+    success = (!format_.compact_entries ||
+               CreateEntryRegions(sizer.hot_region_size(),
+                                  sizer.cold_region_size())) &&
+        BuildContents(metadata_, &index_, syllabary, source,
+                      num_entries, dict_file_checksum);
+  }
+  std::deque<StringId>().swap(string_ids_);
+  hot_region_ = hot_region_end_ = nullptr;
+  cold_region_ = cold_region_end_ = nullptr;
+  return success;
+}
+
+// compact entries are packed in two regions, where the first few entries
+// of each code are kept apart from the rest.
+bool Table::CreateEntryRegions(size_t hot_region_size,
+                               size_t cold_region_size) {
+  LOG(INFO) << "creating entry regions; hot: " << hot_region_size
+            << ", cold: " << cold_region_size;
+  hot_region_ = reinterpret_cast<char*>(
+      Allocate<StringId>(hot_region_size / sizeof(StringId)));
+  cold_region_ = reinterpret_cast<char*>(
+      Allocate<StringId>(cold_region_size / sizeof(StringId)));
+  if (!hot_region_ || !cold_region_) {
+    LOG(ERROR) << "Error creating entry regions.";
     return false;
   }
-  metadata_->dict_file_checksum = dict_file_checksum;
-  metadata_->num_syllables = num_syllables;
-  metadata_->num_entries = num_entries;
+  hot_region_end_ = hot_region_ + hot_region_size;
+  cold_region_end_ = cold_region_ + cold_region_size;
+  // aligns what follows as it has been measured
+  Allocate<uint64_t>(0);
+  return true;
+}
 
-  if (format_.OnBuildStart && !RIME_THIS_CALL(format_.OnBuildStart)()) {
+template <class Metadata, class Offset>
+bool Table::BuildContents(Metadata* metadata,
+                          Array<table::BasicHeadIndexNode<Offset>>** index,
+                          const Syllabary& syllabary,
+                          VocabularyPageSource* source,
+                          size_t num_entries,
+                          uint32_t dict_file_checksum) {
+  if (!metadata) {
+    LOG(ERROR) << "Error creating metadata in file '" << file_name() << "'.";
     return false;
   }
+  size_t num_syllables = syllabary.size();
+  metadata->dict_file_checksum = dict_file_checksum;
+  metadata->num_syllables = num_syllables;
+  metadata->num_entries = num_entries;
 
   LOG(INFO) << "creating syllabary.";
   syllabary_ = CreateArray<table::StringType>(num_syllables);
@@ -418,61 +980,67 @@ bool Table::Build(const Syllabary& syllabary, const Vocabulary& vocabulary,
       RIME_THIS_CALL(format_.AddString)(syllable, &syllabary_->at[i++], 0.0);
     }
   }
-  metadata_->syllabary = syllabary_;
+  metadata->syllabary = syllabary_;
 
   LOG(INFO) << "creating table index.";
-  index_ = BuildIndex(vocabulary, num_syllables);
-  if (!index_) {
+  *index = BuildHeadIndex<Offset>(source, num_syllables);
+  if (!*index) {
     LOG(ERROR) << "Error creating table index.";
     return false;
   }
-  metadata_->index = index_;
+  metadata->index = *index;
 
   if (format_.OnBuildFinish && !RIME_THIS_CALL(format_.OnBuildFinish)()) {
     return false;
   }
 
   // at last, complete the metadata
-  std::strncpy(metadata_->format, format_.format_name,
-               table::Metadata::kFormatMaxLength);
+  std::strncpy(metadata->format, format_.format_name,
+               Metadata::kFormatMaxLength);
   return true;
 }
 
-table::Index* Table::BuildIndex(const Vocabulary& vocabulary,
-                                size_t num_syllables) {
-  return reinterpret_cast<table::Index*>(BuildHeadIndex(vocabulary,
-                                                        num_syllables));
-}
-
-table::HeadIndex* Table::BuildHeadIndex(const Vocabulary& vocabulary,
-                                        size_t num_syllables) {
-  auto index = CreateArray<table::HeadIndexNode>(num_syllables);
+template <class Offset>
+Array<table::BasicHeadIndexNode<Offset>>* Table::BuildHeadIndex(
+    VocabularyPageSource* source, size_t num_syllables) {
+  auto index = CreateArray<table::BasicHeadIndexNode<Offset>>(num_syllables);
   if (!index) {
     return NULL;
   }
-  for (const auto& v : vocabulary) {
-    int syllable_id = v.first;
+  SyllableId syllable_id = 0;
+  VocabularyPage page;
+  while (source->Next(&syllable_id, &page)) {
+    if (syllable_id < 0 || size_t(syllable_id) >= num_syllables) {
+      LOG(ERROR) << "invalid syllable id: " << syllable_id;
+      return NULL;
+    }
     auto& node(index->at[syllable_id]);
-    const auto& entries(v.second.entries);
+    const auto& entries(page.entries);
     if (!BuildEntryList(entries, &node.entries)) {
         return NULL;
     }
-    if (v.second.next_level) {
+    if (page.next_level) {
       Code code;
       code.push_back(syllable_id);
-      auto next_level_index = BuildTrunkIndex(code, *v.second.next_level);
+      void* next_level_index = format_.keyed_trunk_index ?
+          static_cast<void*>(BuildKeyedTrunkIndex(code, *page.next_level)) :
+          static_cast<void*>(BuildTrunkIndex<Offset>(code, *page.next_level));
       if (!next_level_index) {
         return NULL;
       }
-      node.next_level = reinterpret_cast<table::PhraseIndex*>(next_level_index);
+      node.next_level = reinterpret_cast<table::BasicPhraseIndex<Offset>*>(
+          next_level_index);
     }
   }
   return index;
 }
 
-table::TrunkIndex* Table::BuildTrunkIndex(const Code& prefix,
-                                          const Vocabulary& vocabulary) {
-  auto index = CreateArray<table::TrunkIndexNode>(vocabulary.size());
+template <class Offset>
+Array<table::BasicTrunkIndexNode<Offset>>* Table::BuildTrunkIndex(
+    const Code& prefix, const Vocabulary& vocabulary) {
+  using PhraseIndex = table::BasicPhraseIndex<Offset>;
+  auto index = CreateArray<table::BasicTrunkIndexNode<Offset>>(
+      vocabulary.size());
   if (!index) {
     return NULL;
   }
@@ -489,20 +1057,60 @@ table::TrunkIndex* Table::BuildTrunkIndex(const Code& prefix,
       Code code(prefix);
       code.push_back(syllable_id);
       if (code.size() < Code::kIndexCodeMaxLength) {
-        auto next_level_index = BuildTrunkIndex(code, *v.second.next_level);
+        auto next_level_index =
+            BuildTrunkIndex<Offset>(code, *v.second.next_level);
         if (!next_level_index) {
           return NULL;
         }
-        node.next_level =
-            reinterpret_cast<table::PhraseIndex*>(next_level_index);
+        node.next_level = reinterpret_cast<PhraseIndex*>(next_level_index);
       }
       else {
         auto tail_index = BuildTailIndex(code, *v.second.next_level);
         if (!tail_index) {
           return NULL;
         }
-        node.next_level = reinterpret_cast<table::PhraseIndex*>(tail_index);
+        node.next_level = reinterpret_cast<PhraseIndex*>(tail_index);
+      }
+    }
+  }
+  return index;
+}
+
+table::KeyedTrunkIndex* Table::BuildKeyedTrunkIndex(
+    const Code& prefix, const Vocabulary& vocabulary) {
+  auto index = Allocate<table::KeyedTrunkIndex>();
+  if (!index) {
+    return NULL;
+  }
+  size_t size = vocabulary.size();
+  auto keys = Allocate<SyllableId>(size);
+  auto nodes = Allocate<table::HeadIndexNode>(size);
+  if (!keys || !nodes) {
+    return NULL;
+  }
+  index->size = size;
+  index->keys = keys;
+  index->nodes = nodes;
+  size_t count = 0;
+  for (const auto& v : vocabulary) {
+    int syllable_id = v.first;
+    keys[count] = syllable_id;
+    auto& node(nodes[count++]);
+    if (!BuildEntryList(v.second.entries, &node.entries)) {
+      return NULL;
+    }
+    if (v.second.next_level) {
+      Code code(prefix);
+      code.push_back(syllable_id);
+      void* next_level_index = (code.size() < Code::kIndexCodeMaxLength) ?
+          static_cast<void*>(BuildKeyedTrunkIndex(code,
+                                                  *v.second.next_level)) :
+          static_cast<void*>(BuildTailIndex(code, *v.second.next_level));
+      if (!next_level_index) {
+        return NULL;
       }
+      node.next_level = reinterpret_cast<table::PhraseIndex*>(
+          next_level_index);
     }
   }
   return index;
@@ -553,10 +1161,13 @@ Array<table::Entry>* Table::BuildEntryArray(const DictEntryList& entries) {
   return array;
 }
 
+template <class Offset>
 bool Table::BuildEntryList(const DictEntryList& src,
-                           List<table::Entry>* dest) {
+                           List<table::Entry, uint32_t, Offset>* dest) {
   if (!dest)
     return false;
+  if (format_.compact_entries)
+    return BuildCompactEntryList(src, dest);
   dest->size = src.size();
   dest->at = Allocate<table::Entry>(src.size());
   if (!dest->at) {
@@ -571,6 +1182,53 @@ bool Table::BuildEntryList(const DictEntryList& src,
   return true;
 }
 
+template <class Offset>
+bool Table::BuildCompactEntryList(const DictEntryList& src,
+                                  List<table::Entry, uint32_t, Offset>* dest) {
+  size_t size = src.size();
+  dest->size = size;
+  if (size == 0)
+    return true;
+  size_t num_hot_entries = kNumHotEntries;
+  size_t hot_size = (std::min)(size, num_hot_entries);
+  char* hot_block = hot_region_;
+  char* cold_block = cold_region_;
+  hot_region_ += hot_block_size(size, num_hot_entries);
+  cold_region_ += cold_block_size(size, num_hot_entries);
+  if (hot_region_ > hot_region_end_ || cold_region_ > cold_region_end_) {
+    LOG(ERROR) << "Error creating compact entries; out of entry regions.";
+    return false;
+  }
+  if (!BuildCompactEntries(src, 0, hot_size, hot_block))
+    return false;
+  if (size > hot_size) {
+    auto link = reinterpret_cast<OffsetPtr<char>*>(
+        hot_block + compact_block_size(hot_size));
+    *link = cold_block;
+    if (!BuildCompactEntries(src, hot_size, size - hot_size, cold_block))
+      return false;
+  }
+  dest->at = reinterpret_cast<table::Entry*>(hot_block);
+  return true;
+}
+
+bool Table::BuildCompactEntries(const DictEntryList& src,
+                                size_t first, size_t count, char* block) {
+  auto texts = reinterpret_cast<table::StringType*>(block);
+  auto weights = reinterpret_cast<table::CompactWeight*>(texts + count);
+  for (size_t i = 0; i < count; ++i) {
+    const DictEntry& dict_entry(*src[first + i]);
+    if (!RIME_THIS_CALL(format_.AddString)(dict_entry.text, &texts[i],
+                                           dict_entry.weight)) {
+      LOG(ERROR) << "Error creating table entry '" << dict_entry.text
+                 << "'; file size: " << file_size();
+      return false;
+    }
+    weights[i] = table::QuantizeWeight(dict_entry.weight);
+  }
+  return true;
+}
+
 bool Table::BuildEntry(const DictEntry& dict_entry, table::Entry* entry) {
   if (!entry)
     return false;
@@ -601,14 +1259,13 @@ std::string Table::GetSyllableById(SyllableId syllable_id) {
 }
 
 TableAccessor Table::QueryWords(SyllableId syllable_id) {
-  TableQuery query(index_);
-  return query.Access(syllable_id);
+  return NewQuery().Access(syllable_id);
 }
 
 TableAccessor Table::QueryPhrases(const Code& code) {
   if (code.empty())
     return TableAccessor();
-  TableQuery query(index_);
+  TableQuery query(NewQuery());
   for (size_t i = 0; i < Code::kIndexCodeMaxLength; ++i) {
     if (code.size() == i + 1)
       return query.Access(code[i]);
@@ -619,51 +1276,81 @@ TableAccessor Table::QueryPhrases(const Code& code) {
 }
 
 bool Table::Query(const SyllableGraph& syll_graph, size_t start_pos,
-                  TableQueryResult* result) {
-  if (!result ||
-      !index_ ||
+                  TableQueryArena* arena, size_t* horizon) {
+  if (horizon)
+    *horizon = (std::max)(*horizon, start_pos);
+  if (!arena)
+    return false;
+  arena->Clear();
+  if ((!index_ && !index64_) ||
       start_pos >= syll_graph.interpreted_length)
     return false;
-  result->clear();
-  std::queue<std::pair<size_t, TableQuery>> q;
-  TableQuery initial_state(index_);
-  q.push({start_pos, initial_state});
-  while (!q.empty()) {
-    size_t current_pos = q.front().first;
-    TableQuery query(q.front().second);
-    q.pop();
-    auto index = syll_graph.indices.find(current_pos);
-    if (index == syll_graph.indices.end()) {
+  // breadth-first search, with the queue in the arena
+  auto& q(arena->queue_);
+  auto& found(arena->found_);
+  q.emplace_back(start_pos, NewQuery());
+  for (size_t head = 0; head < q.size(); ++head) {
+    size_t current_pos = q[head].first;
+    TableQuery query(q[head].second);
+    SpellingIndex index = syll_graph.spellings(current_pos);
+    if (index.empty()) {
       continue;
     }
     if (query.level() == Code::kIndexCodeMaxLength) {
       TableAccessor accessor(query.Access(-1));
       if (!accessor.exhausted()) {
-        (*result)[current_pos].push_back(accessor);
+        found.push_back({current_pos, accessor});
       }
       continue;
     }
-    for (const auto& spellings : index->second) {
+    for (const auto& spellings : index) {
       SyllableId syll_id = spellings.first;
       TableAccessor accessor(query.Access(syll_id));
-      for (auto props : spellings.second) {
-        size_t end_pos = props->end_pos;
+      for (const auto& props : spellings.second) {
+        size_t end_pos = props.end_pos;
+        if (horizon && end_pos > *horizon)
+          *horizon = end_pos;
         if (!accessor.exhausted()) {
-          (*result)[end_pos].push_back(accessor);
+          found.push_back({end_pos, accessor});
         }
         if (end_pos < syll_graph.interpreted_length &&
-            query.Advance(syll_id, props->credibility)) {
-          q.push({end_pos, query});
+            query.Advance(syll_id, props.credibility)) {
+          q.emplace_back(end_pos, query);
           query.Backdate();
         }
       }
     }
   }
-  return !result->empty();
+  arena->SortMatches();
+  return !arena->matches_.empty();
+}
+
+bool Table::Query(const SyllableGraph& syll_graph, size_t start_pos,
+                  TableQueryResult* result, size_t* horizon) {
+  if (!result)
+    return false;
+  result->clear();
+  TableQueryArena arena;
+  if (!Query(syll_graph, start_pos, &arena, horizon))
+    return false;
+  for (const auto& match : arena.matches()) {
+    (*result)[match.end_pos].push_back(match.accessor);
+  }
+  return true;
+}
+
+TableQuery Table::NewQuery() const {
+  return index64_ ? TableQuery(index64_) :
+      TableQuery(index_, format_.keyed_trunk_index,
+                 format_.compact_entries ? num_hot_entries_ : 0);
 }
 
 std::string Table::GetEntryText(const table::Entry& entry) {
   return RIME_THIS_CALL(format_.GetString)(entry.text);
 }
 
+std::string Table::GetEntryText(const table::StringType& text) {
+  return RIME_THIS_CALL(format_.GetString)(text);
+}
+
 }  // namespace rime
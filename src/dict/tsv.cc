@@ -4,6 +4,7 @@
 //
 // 2013-04-14 GONG Chen <chen.sst@gmail.com>
 //
+#include <cstring>
 #include <fstream>
 #include <boost/algorithm/string.hpp>
 #include <rime/common.h>
@@ -12,48 +13,111 @@
 
 namespace rime {
 
+TsvScanner::TsvScanner(const std::string& path) {
+  std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+  if (!fin || !fin.seekg(0, std::ios::end)) {
+    LOG(ERROR) << "error opening file '" << path << "'.";
+    return;
+  }
+  std::streamoff file_size = fin.tellg();
+  if (file_size > 0) {
+    buffer_.resize(static_cast<size_t>(file_size));
+    fin.seekg(0, std::ios::beg);
+    // the file could have been truncated since measured
+    fin.read(&buffer_[0], file_size);
+    buffer_.resize(static_cast<size_t>(fin.gcount()));
+  }
+  if (fin.bad()) {
+    LOG(ERROR) << "error reading file '" << path << "'.";
+    return;
+  }
+  ok_ = true;
+  pos_ = buffer_.data();
+  end_ = pos_ + buffer_.size();
+}
+
+TsvScanner::~TsvScanner() {
+}
+
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' ||
+      c == '\n' || c == '\v' || c == '\f';
+}
+
+bool TsvScanner::GetLine(TsvField* line) {
+  if (pos_ == end_)
+    return false;
+  // memchr is vectorized in most C libraries
+  auto eol = reinterpret_cast<const char*>(
+      std::memchr(pos_, '\n', end_ - pos_));
+  const char* next = eol ? eol + 1 : end_;
+  if (!eol)
+    eol = end_;
+  const char* begin = pos_;
+  while (eol != begin && is_space(eol[-1]))
+    --eol;
+  *line = TsvField(begin, eol);
+  pos_ = next;
+  ++line_no_;
+  return true;
+}
+
+void TsvScanner::Split(const TsvField& line, std::vector<TsvField>* fields) {
+  fields->clear();
+  const char* start = line.begin();
+  const char* end = line.end();
+  while (auto tab = reinterpret_cast<const char*>(
+             std::memchr(start, '\t', end - start))) {
+    fields->push_back(TsvField(start, tab));
+    start = tab + 1;
+  }
+  fields->push_back(TsvField(start, end));
+}
+
 int TsvReader::operator() (Sink* sink) {
   if (!sink) return 0;
   LOG(INFO) << "reading tsv file: " << path_;
-  std::ifstream fin(path_.c_str());
-  std::string line, key, value;
+  TsvScanner scanner(path_);
+  TsvField line;
+  std::vector<TsvField> fields;
+  std::string key, value;
+  // strings in the row are reused from line to line
   Tsv row;
-  int line_no = 0;
   int num_entries = 0;
   bool enable_comment = true;
-  while (getline(fin, line)) {
-    ++line_no;
-    boost::algorithm::trim_right(line);
+  while (scanner.GetLine(&line)) {
     // skip empty lines and comments
     if (line.empty()) continue;
-    if (enable_comment && line[0] == '#') {
+    if (enable_comment && line.front() == '#') {
       if (boost::starts_with(line, "#@")) {
         // metadata
-        line.erase(0, 2);
-        boost::algorithm::split(row, line,
-                                boost::algorithm::is_any_of("\t"));
-        if (row.size() != 2 ||
-            !sink->MetaPut(row[0], row[1])) {
-          LOG(WARNING) << "invalid metadata at line " << line_no << ".";
+        TsvScanner::Split(TsvField(line.begin() + 2, line.end()), &fields);
+        if (fields.size() != 2 ||
+            !sink->MetaPut(boost::copy_range<std::string>(fields[0]),
+                           boost::copy_range<std::string>(fields[1]))) {
+          LOG(WARNING) << "invalid metadata at line "
+                       << scanner.line_no() << ".";
         }
       }
-      else if (line == "# no comment") {
+      else if (boost::equals(line, "# no comment")) {
         // a "# no comment" line disables further comments
         enable_comment = false;
       }
       continue;
     }
     // read a tsv entry
-    boost::algorithm::split(row, line,
-                            boost::algorithm::is_any_of("\t"));
+    TsvScanner::Split(line, &fields);
+    row.resize(fields.size());
+    for (size_t i = 0; i < fields.size(); ++i) {
+      row[i].assign(fields[i].begin(), fields[i].end());
+    }
     if (!parser_(row, &key, &value) ||
         !sink->Put(key, value)) {
-      LOG(WARNING) << "invalid entry at line " << line_no << ".";
+      LOG(WARNING) << "invalid entry at line " << scanner.line_no() << ".";
       continue;
     }
     ++num_entries;
   }
-  fin.close();
   return num_entries;
 }
 
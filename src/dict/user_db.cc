@@ -5,6 +5,7 @@
 // 2011-11-02 GONG Chen <chen.sst@gmail.com>
 //
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
@@ -21,12 +22,59 @@ UserDbValue::UserDbValue(const std::string& value) {
   Unpack(value);
 }
 
-std::string UserDbValue::Pack() const {
-  return boost::str(boost::format("c=%1% d=%2% t=%3%") %
-                    commits % dee % tick);
+const char UserDbValue::kBinaryVersion;
+const size_t UserDbValue::kBinarySize;
+
+static void put_uint64(uint64_t x, char* p) {
+  for (int i = 0; i < 8; ++i, x >>= 8) {
+    p[i] = static_cast<char>(x & 0xff);
+  }
+}
+
+static uint64_t get_uint64(const char* p) {
+  uint64_t x = 0;
+  for (int i = 7; i >= 0; --i) {
+    x = (x << 8) | static_cast<unsigned char>(p[i]);
+  }
+  return x;
+}
+
+std::string UserDbValue::Pack(bool binary) const {
+  if (!binary) {
+    return boost::str(boost::format("c=%1% d=%2% t=%3%") %
+                      commits % dee % tick);
+  }
+  char buffer[kBinarySize];
+  buffer[0] = kBinaryVersion;
+  uint32_t c = static_cast<uint32_t>(commits);
+  for (int i = 0; i < 4; ++i, c >>= 8) {
+    buffer[1 + i] = static_cast<char>(c & 0xff);
+  }
+  uint64_t d;
+  std::memcpy(&d, &dee, sizeof(d));
+  put_uint64(d, buffer + 5);
+  put_uint64(tick, buffer + 13);
+  return std::string(buffer, kBinarySize);
+}
+
+bool UserDbValue::IsBinary(const std::string& value) {
+  return value.length() == kBinarySize && value[0] == kBinaryVersion;
 }
 
 bool UserDbValue::Unpack(const std::string& value) {
+  if (IsBinary(value)) {
+    const char* p = value.data();
+    uint32_t c = 0;
+    for (int i = 3; i >= 0; --i) {
+      c = (c << 8) | static_cast<unsigned char>(p[1 + i]);
+    }
+    commits = static_cast<int32_t>(c);
+    uint64_t d = get_uint64(p + 5);
+    std::memcpy(&dee, &d, sizeof(dee));
+    dee = (std::min)(10000.0, dee);
+    tick = get_uint64(p + 13);
+    return true;
+  }
   std::vector<std::string> kv;
   boost::split(kv, value, boost::is_any_of(" "));
   for (const std::string& k_eq_v : kv) {
@@ -67,6 +115,16 @@ const std::string UserDb<TreeDb>::extension(".userdb.kct");
 template <>
 const std::string UserDb<TreeDb>::snapshot_extension(".userdb.kcss");
 
+template <>
+const std::string UserDb<TextDb>::value_format("text");
+
+template <>
+const std::string UserDb<TreeDb>::value_format("binary");
+
+bool UsesBinaryValues(Db* db) {
+  return dynamic_cast<UserDb<TreeDb>*>(db) != nullptr;
+}
+
 // key ::= code <space> <Tab> phrase
 
 static bool userdb_entry_parser(const Tsv& row,
@@ -97,7 +155,9 @@ static bool userdb_entry_formatter(const std::string& key,
   if (row.size() != 2 ||
       row[0].empty() || row[1].empty())
     return false;
-  row.push_back(value);
+  // snapshots are always in text
+  row.push_back(UserDbValue::IsBinary(value) ?
+                UserDbValue(value).Pack() : value);
   return true;
 }
 
@@ -121,7 +181,8 @@ template <class BaseDb>
 bool UserDb<BaseDb>::CreateMetadata() {
   Deployer& deployer(Service::instance().deployer());
   return BaseDb::CreateMetadata() &&
-      BaseDb::MetaUpdate("/user_id", deployer.user_id);
+      BaseDb::MetaUpdate("/user_id", deployer.user_id) &&
+      BaseDb::MetaUpdate("/value_format", value_format);
 }
 
 template <>
@@ -219,7 +280,8 @@ static TickCount get_tick_count(Db* db) {
   return 1;
 }
 
-UserDbMerger::UserDbMerger(Db* db) : db_(db) {
+UserDbMerger::UserDbMerger(Db* db)
+    : db_(db), binary_values_(UsesBinaryValues(db)) {
   our_tick_ = get_tick_count(db);
   their_tick_ = 0;
   max_tick_ = our_tick_;
@@ -259,7 +321,7 @@ bool UserDbMerger::Put(const std::string& key, const std::string& value) {
       o.commits = v.commits;
   o.dee = (std::max)(o.dee, v.dee);
   o.tick = max_tick_;
-  return db_->Update(key, o.Pack()) && ++merged_entries_;
+  return db_->Update(key, o.Pack(binary_values_)) && ++merged_entries_;
 }
 
 void UserDbMerger::CloseMerge() {
@@ -280,7 +342,7 @@ void UserDbMerger::CloseMerge() {
 }
 
 UserDbImporter::UserDbImporter(Db* db)
-    : db_(db) {
+    : db_(db), binary_values_(UsesBinaryValues(db)) {
 }
 
 bool UserDbImporter::MetaPut(const std::string& key, const std::string& value) {
@@ -302,7 +364,7 @@ bool UserDbImporter::Put(const std::string& key, const std::string& value) {
   else if (v.commits < 0) {  // mark as deleted
     o.commits = (std::min)(v.commits, -std::abs(o.commits));
   }
-  return db_->Update(key, o.Pack());
+  return db_->Update(key, o.Pack(binary_values_));
 }
 
 }  // namespace rime
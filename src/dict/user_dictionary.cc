@@ -6,6 +6,7 @@
 //
 #include <algorithm>
 #include <map>
+#include <mutex>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/scope_exit.hpp>
@@ -17,12 +18,14 @@
 #include <rime/algo/syllabifier.h>
 #include <rime/dict/db.h>
 #include <rime/dict/table.h>
+#include <rime/dict/tree_db.h>
 #include <rime/dict/user_dictionary.h>
 
 namespace rime {
 
 struct DfsState {
   size_t depth_limit;
+  size_t horizon;
   TickCount present_tick;
   Code code;
   std::vector<double> credibility;
@@ -38,6 +41,7 @@ struct DfsState {
     return boost::starts_with(key, prefix);
   }
   void RecruitEntry(size_t pos);
+  void RecruitRecord(size_t pos, const UserDictIndex::Record& record);
   bool NextEntry() {
     if (!accessor->GetNextRecord(&key, &value)) {
       key.clear();
@@ -62,6 +66,12 @@ struct DfsState {
   }
 };
 
+static shared_ptr<DictEntry> CreateDictEntryFromRecord(
+    const std::string& text,
+    UserDbValue v,
+    TickCount present_tick,
+    double credibility);
+
 void DfsState::RecruitEntry(size_t pos) {
   auto e = UserDictionary::CreateDictEntry(key, value, present_tick,
                                            credibility.back());
@@ -72,6 +82,419 @@ void DfsState::RecruitEntry(size_t pos) {
   }
 }
 
+void DfsState::RecruitRecord(size_t pos, const UserDictIndex::Record& record) {
+  auto e = CreateDictEntryFromRecord(record.text, record.value, present_tick,
+                                     credibility.back());
+  if (e) {
+    e->code = code;
+    DLOG(INFO) << "add entry at pos " << pos;
+    (*collector)[pos].push_back(e);
+  }
+}
+
+// UserDictIndex members
+
+bool UserDictIndex::Accepts(const shared_ptr<Table>& table) {
+  if (!built())
+    return true;
+  auto indexed_table = table_.lock();
+  if (indexed_table == table)
+    return true;
+  if (indexed_table)
+    return false;
+  // the indexed table is gone; rebuild for the current one.
+  Clear();
+  return true;
+}
+
+bool UserDictIndex::Build(DbAccessor* records,
+                          const shared_ptr<Table>& table) {
+  Clear();
+  if (!records || !table)
+    return false;
+  for (SyllableId syllable_id = 0; ; ++syllable_id) {
+    std::string spelling = table->GetSyllableById(syllable_id);
+    if (spelling.empty())
+      break;
+    syllable_ids_[spelling] = syllable_id;
+  }
+  table_ = table;
+  nodes_.resize(1);  // root
+  std::string key;
+  std::string value;
+  while (records->GetNextRecord(&key, &value)) {
+    UserDbValue v;
+    if (v.Unpack(value))
+      Update(key, v);
+  }
+  LOG(INFO) << "indexed " << num_records_ << " user dict entries.";
+  return true;
+}
+
+bool UserDictIndex::Update(const std::string& key, const UserDbValue& value) {
+  if (!built())
+    return false;
+  size_t separator_pos = key.find('\t');
+  if (separator_pos == std::string::npos)
+    return false;
+  Code code;
+  if (!ParseCode(key.substr(0, separator_pos), &code))
+    return false;
+  size_t node_pos = 0;
+  for (SyllableId syllable_id : code) {
+    auto& children(nodes_[node_pos].children);
+    auto it = std::lower_bound(
+        children.begin(), children.end(), syllable_id,
+        [](const std::pair<SyllableId, size_t>& child, SyllableId id) {
+          return child.first < id;
+        });
+    if (it != children.end() && it->first == syllable_id) {
+      node_pos = it->second;
+      continue;
+    }
+    size_t child_pos = nodes_.size();
+    children.insert(it, {syllable_id, child_pos});
+    nodes_.emplace_back();  // invalidates the reference to children
+    node_pos = child_pos;
+  }
+  Record record{key.substr(separator_pos + 1), value};
+  auto& records(nodes_[node_pos].records);
+  auto it = std::lower_bound(
+      records.begin(), records.end(), record,
+      [](const Record& a, const Record& b) { return a.text < b.text; });
+  if (it != records.end() && it->text == record.text) {
+    it->value = value;
+  }
+  else {
+    records.insert(it, record);
+    ++num_records_;
+  }
+  return true;
+}
+
+void UserDictIndex::Clear() {
+  nodes_.clear();
+  num_records_ = 0;
+  syllable_ids_.clear();
+  table_.reset();
+}
+
+const UserDictIndex::Node*
+UserDictIndex::Find(const Node* node, SyllableId syllable_id) const {
+  if (!node)
+    return nullptr;
+  auto it = std::lower_bound(
+      node->children.begin(), node->children.end(), syllable_id,
+      [](const std::pair<SyllableId, size_t>& child, SyllableId id) {
+        return child.first < id;
+      });
+  if (it == node->children.end() || it->first != syllable_id)
+    return nullptr;
+  return &nodes_[it->second];
+}
+
+// accepts codes as written by UserDictionary::TranslateCodeToString(),
+// ie. syllables each followed by a space: 'b e f '
+bool UserDictIndex::ParseCode(const std::string& code_str, Code* code) const {
+  if (code_str.empty() || code_str.back() != ' ')
+    return false;
+  size_t start = 0;
+  while (start < code_str.length()) {
+    size_t end = code_str.find(' ', start);
+    auto it = syllable_ids_.find(code_str.substr(start, end - start));
+    if (it == syllable_ids_.end())
+      return false;
+    code->push_back(it->second);
+    start = end + 1;
+  }
+  return true;
+}
+
+// an accessor to db records merged with pending records.
+// a pending record supersedes the db record of the same key.
+class MergedDbAccessor : public DbAccessor {
+ public:
+  MergedDbAccessor(const shared_ptr<DbAccessor>& accessor,
+                   const shared_ptr<UserDbWriteQueue::Records>& pending,
+                   const std::string& prefix)
+      : DbAccessor(prefix), accessor_(accessor), pending_(pending),
+        next_(pending->lower_bound(prefix)) {
+  }
+
+  virtual bool Reset() {
+    next_ = pending_->lower_bound(prefix_);
+    fetched_ = false;
+    return accessor_->Reset() || HasPendingRecord();
+  }
+  virtual bool Jump(const std::string& key) {
+    next_ = pending_->lower_bound((std::max)(key, prefix_));
+    fetched_ = false;
+    return accessor_->Jump(key) || HasPendingRecord();
+  }
+  virtual bool GetNextRecord(std::string* key, std::string* value) {
+    if (!fetched_) {
+      has_record_ = accessor_->GetNextRecord(&key_, &value_);
+      fetched_ = true;
+    }
+    if (HasPendingRecord() && (!has_record_ || next_->first <= key_)) {
+      if (has_record_ && next_->first == key_)
+        fetched_ = false;  // superseded
+      *key = next_->first;
+      *value = next_->second;
+      ++next_;
+      return true;
+    }
+    if (!has_record_)
+      return false;
+    key->swap(key_);
+    value->swap(value_);
+    fetched_ = false;
+    return true;
+  }
+  virtual bool exhausted() {
+    if (HasPendingRecord())
+      return false;
+    return fetched_ ? !has_record_ : accessor_->exhausted();
+  }
+
+ protected:
+  bool HasPendingRecord() const {
+    return next_ != pending_->end() &&
+        boost::starts_with(next_->first, prefix_);
+  }
+
+  shared_ptr<DbAccessor> accessor_;
+  shared_ptr<UserDbWriteQueue::Records> pending_;
+  UserDbWriteQueue::Records::const_iterator next_;
+  bool fetched_ = false;
+  bool has_record_ = false;
+  std::string key_;
+  std::string value_;
+};
+
+// UserDbWriteQueue members
+
+const size_t UserDbWriteQueue::kMaxPendingRecords;
+const time_t UserDbWriteQueue::kDefaultFlushInterval;
+
+UserDbWriteQueue::UserDbWriteQueue(const shared_ptr<Db>& db,
+                                   time_t flush_interval)
+    : db_(db), flush_interval_(flush_interval), last_flush_time_(time(NULL)) {
+  if (flush_interval_ > 0) {
+    timer_ = std::thread([this] { RunTimer(); });
+  }
+}
+
+UserDbWriteQueue::~UserDbWriteQueue() {
+  if (timer_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(timer_mutex_);
+      stopping_ = true;
+    }
+    timer_stopped_.notify_all();
+    timer_.join();
+  }
+  CommitTransaction();
+  Flush(true);
+}
+
+void UserDbWriteQueue::RunTimer() {
+  std::unique_lock<std::mutex> lock(timer_mutex_);
+  while (!timer_stopped_.wait_for(lock,
+                                  std::chrono::seconds(flush_interval_),
+                                  [this] { return stopping_; })) {
+    lock.unlock();
+    FlushIfDue();
+    lock.lock();
+  }
+}
+
+bool UserDbWriteQueue::Fetch(const std::string& key, std::string* value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(key);
+  if (it == records_.end())
+    return false;
+  *value = it->second.value;
+  return true;
+}
+
+void UserDbWriteQueue::Update(const std::string& key,
+                              const std::string& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(key);
+  if (in_transaction_ && journal_.find(key) == journal_.end()) {
+    journal_[key] = it != records_.end() ?
+        std::make_pair(true, it->second) :
+        std::make_pair(false, Record());
+  }
+  records_[key] = Record{value, ++last_version_};
+  snapshot_.reset();
+}
+
+bool UserDbWriteQueue::FetchTick(TickCount* tick) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!has_tick_)
+    return false;
+  *tick = tick_;
+  return true;
+}
+
+void UserDbWriteQueue::UpdateTick(TickCount tick) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  has_tick_ = true;
+  tick_ = tick;
+}
+
+shared_ptr<DbAccessor>
+UserDbWriteQueue::Merge(const shared_ptr<DbAccessor>& accessor,
+                        const std::string& prefix) {
+  if (!accessor)
+    return accessor;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (records_.empty())
+    return accessor;
+  if (!snapshot_) {
+    snapshot_ = New<Records>();
+    for (const auto& record : records_) {
+      snapshot_->emplace_hint(snapshot_->end(),
+                              record.first, record.second.value);
+    }
+  }
+  return New<MergedDbAccessor>(accessor, snapshot_, prefix);
+}
+
+void UserDbWriteQueue::BeginTransaction() {
+  CommitTransaction();
+  std::lock_guard<std::mutex> lock(mutex_);
+  in_transaction_ = true;
+  had_tick_ = has_tick_;
+  tick_before_ = tick_;
+}
+
+bool UserDbWriteQueue::AbortTransaction() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!in_transaction_)
+    return false;
+  for (const auto& change : journal_) {
+    if (change.second.first)
+      records_[change.first] = change.second.second;
+    else
+      records_.erase(change.first);
+  }
+  journal_.clear();
+  has_tick_ = had_tick_;
+  tick_ = tick_before_;
+  in_transaction_ = false;
+  snapshot_.reset();
+  return true;
+}
+
+void UserDbWriteQueue::CommitTransaction() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  journal_.clear();
+  in_transaction_ = false;
+}
+
+bool UserDbWriteQueue::in_transaction() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_transaction_;
+}
+
+size_t UserDbWriteQueue::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return records_.size();
+}
+
+void UserDbWriteQueue::FlushIfDue() {
+  std::unique_lock<std::mutex> lock(flush_mutex_, std::try_to_lock);
+  if (!lock)
+    return;  // being flushed
+  if (size() >= kMaxPendingRecords ||
+      time(NULL) - last_flush_time_ >= flush_interval_) {
+    StartFlush(false);
+  }
+}
+
+void UserDbWriteQueue::Flush(bool wait) {
+  std::unique_lock<std::mutex> lock(flush_mutex_, std::defer_lock);
+  if (wait)
+    lock.lock();
+  else if (!lock.try_lock())
+    return;  // being flushed
+  StartFlush(wait);
+}
+
+void UserDbWriteQueue::StartFlush(bool wait) {
+  if (work_.valid()) {
+    if (!wait &&
+        work_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return;  // still busy writing the last batch
+    work_.get();
+  }
+  auto batch = New<Batch>();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& record : records_) {
+      if (journal_.find(record.first) == journal_.end())
+        batch->records.push_back(record);
+    }
+    batch->has_tick = in_transaction_ ? had_tick_ : has_tick_;
+    batch->tick = in_transaction_ ? tick_before_ : tick_;
+  }
+  last_flush_time_ = time(NULL);
+  if (batch->records.empty() && !batch->has_tick)
+    return;
+  if (wait) {
+    Write(*batch);
+  }
+  else {
+    work_ = std::async(std::launch::async, [this, batch] { Write(*batch); });
+  }
+}
+
+void UserDbWriteQueue::Write(const Batch& batch) {
+  size_t num_written = 0;
+  std::vector<bool> written(batch.records.size());
+  for (size_t i = 0; i < batch.records.size(); ++i) {
+    const auto& record(batch.records[i]);
+    written[i] = db_->Update(record.first, record.second.value);
+    if (written[i])
+      ++num_written;
+    else
+      LOG(ERROR) << "error writing user db record '" << record.first << "'.";
+  }
+  bool tick_written = false;
+  if (batch.has_tick) {
+    try {
+      tick_written = db_->MetaUpdate(
+          "/tick", boost::lexical_cast<std::string>(batch.tick));
+    }
+    catch (...) {
+    }
+  }
+  DLOG(INFO) << "written " << num_written << " user db records.";
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < batch.records.size(); ++i) {
+    if (!written[i])
+      continue;
+    const auto& record(batch.records[i]);
+    // keep the record if it has changed since
+    auto it = records_.find(record.first);
+    if (it != records_.end() && it->second.version == record.second.version)
+      records_.erase(it);
+  }
+  if (tick_written) {
+    if (in_transaction_) {
+      if (had_tick_ && tick_before_ == batch.tick)
+        had_tick_ = false;
+    }
+    else if (has_tick_ && tick_ == batch.tick) {
+      has_tick_ = false;
+    }
+  }
+  snapshot_.reset();
+}
+
 // UserDictEntryIterator members
 
 void UserDictEntryIterator::Add(const shared_ptr<DictEntry>& entry) {
@@ -117,14 +540,20 @@ bool UserDictEntryIterator::Next() {
 
 // UserDictionary members
 
-UserDictionary::UserDictionary(const shared_ptr<Db>& db)
-    : db_(db) {
+UserDictionary::UserDictionary(const shared_ptr<Db>& db,
+                               const shared_ptr<UserDictIndex>& index,
+                               const shared_ptr<UserDbWriteQueue>& queue)
+    : db_(db), index_(index), queue_(queue),
+      binary_values_(UsesBinaryValues(db.get())) {
 }
 
 UserDictionary::~UserDictionary() {
   if (loaded()) {
     CommitPendingTransaction();
   }
+  if (queue_) {
+    queue_->Flush(true);
+  }
 }
 
 void UserDictionary::Attach(const shared_ptr<Table>& table,
@@ -136,6 +565,9 @@ void UserDictionary::Attach(const shared_ptr<Table>& table,
 bool UserDictionary::Load() {
   if (!db_)
     return false;
+  // user dbs are shared by sessions in different threads; open each once.
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
   if (!db_->loaded() && !db_->Open()) {
     // try to recover managed db in available work thread
     Deployer& deployer(Service::instance().deployer());
@@ -169,8 +601,8 @@ bool UserDictionary::readonly() const {
 // in order to enable forward scaning and to avoid backdating, our strategy is:
 // sort all those syllables from edges that starts at current_pos, so that
 // the syllables are in the same alphabetical order as the user db's.
-// this having been done by transposing the syllable graph into
-// SyllableGraph::index.
+// this having been done by the syllable graph, which lays out spellings
+// from each vertex by syllable id.
 // however, in the case of 'shsh' which could be the abbreviation of either
 // 'sh(a) sh(i)' or 'sh(a) s(hi) h(ou)',
 // we now have to give up the latter path in order to avoid backdating.
@@ -186,13 +618,13 @@ void UserDictionary::DfsLookup(const SyllableGraph& syll_graph,
                                size_t current_pos,
                                const std::string& current_prefix,
                                DfsState* state) {
-  auto index = syll_graph.indices.find(current_pos);
-  if (index == syll_graph.indices.end()) {
+  SpellingIndex index = syll_graph.spellings(current_pos);
+  if (index.empty()) {
     return;
   }
   DLOG(INFO) << "dfs lookup starts from " << current_pos;
   std::string prefix;
-  for (const auto& spelling : index->second) {
+  for (const auto& spelling : index) {
     DLOG(INFO) << "prefix: '" << current_prefix << "'"
                << ", syll_id: " << spelling.first
                << ", num_spellings: " << spelling.second.size();
@@ -204,16 +636,18 @@ void UserDictionary::DfsLookup(const SyllableGraph& syll_graph,
     if (!TranslateCodeToString(state->code, &prefix))
       continue;
     for (size_t i = 0; i < spelling.second.size(); ++i) {
-      auto props = spelling.second[i];
-      if (i > 0 && props->type >= kAbbreviation)
+      const auto& props(spelling.second[i]);
+      if (i > 0 && props.type >= kAbbreviation)
         continue;
       state->credibility.push_back(
-          state->credibility.back() * props->credibility);
+          state->credibility.back() * props.credibility);
       BOOST_SCOPE_EXIT( (&state) ) {
         state->credibility.pop_back();
       }
       BOOST_SCOPE_EXIT_END
-      size_t end_pos = props->end_pos;
+      size_t end_pos = props.end_pos;
+      if (end_pos > state->horizon)
+        state->horizon = end_pos;
       DLOG(INFO) << "edge: [" << current_pos << ", " << end_pos << ")";
       if (prefix != state->key) {  // 'a b c |d ' > 'a b c \tabracadabra'
         DLOG(INFO) << "forward scanning for '" << prefix << "'.";
@@ -238,24 +672,77 @@ void UserDictionary::DfsLookup(const SyllableGraph& syll_graph,
   }
 }
 
+// walks the syllable graph along with the in-memory index, visiting the
+// same paths as DfsLookup() does, in the same order.
+void UserDictionary::IndexLookup(const SyllableGraph& syll_graph,
+                                 size_t current_pos,
+                                 const UserDictIndex::Node* node,
+                                 DfsState* state) {
+  SpellingIndex index = syll_graph.spellings(current_pos);
+  if (index.empty()) {
+    return;
+  }
+  for (const auto& spelling : index) {
+    auto next = index_->Find(node, spelling.first);
+    state->code.push_back(spelling.first);
+    for (size_t i = 0; i < spelling.second.size(); ++i) {
+      const auto& props(spelling.second[i]);
+      if (i > 0 && props.type >= kAbbreviation)
+        continue;
+      size_t end_pos = props.end_pos;
+      if (end_pos > state->horizon)
+        state->horizon = end_pos;
+      if (!next)
+        continue;
+      state->credibility.push_back(
+          state->credibility.back() * props.credibility);
+      for (const auto& record : next->records) {
+        state->RecruitRecord(end_pos, record);
+      }
+      // the caller can limit the number of syllables to look up
+      if ((!state->depth_limit || state->code.size() < state->depth_limit) &&
+          !next->children.empty()) {
+        IndexLookup(syll_graph, end_pos, next, state);
+      }
+      state->credibility.pop_back();
+    }
+    state->code.pop_back();
+  }
+}
+
 shared_ptr<UserDictEntryCollector>
 UserDictionary::Lookup(const SyllableGraph& syll_graph,
                        size_t start_pos,
                        size_t depth_limit,
-                       double initial_credibility) {
+                       double initial_credibility,
+                       size_t* horizon) {
+  if (horizon)
+    *horizon = (std::max)(*horizon, start_pos);
   if (!table_ || !prism_ || !loaded() ||
       start_pos >= syll_graph.interpreted_length)
     return nullptr;
   DfsState state;
   state.depth_limit = depth_limit;
+  state.horizon = start_pos;
   FetchTickCount();
   state.present_tick = tick_ + 1;
   state.credibility.push_back(initial_credibility);
   state.collector = New<UserDictEntryCollector>();
-  state.accessor = db_->Query("");
-  state.accessor->Jump(" ");  // skip metadata
-  std::string prefix;
-  DfsLookup(syll_graph, start_pos, prefix, &state);
+  bool indexed = false;
+  if (index_enabled_ && index_) {
+    std::lock_guard<std::mutex> lock(index_->mutex());
+    indexed = PrepareIndex();
+    if (indexed)
+      IndexLookup(syll_graph, start_pos, index_->root(), &state);
+  }
+  if (!indexed) {
+    state.accessor = Query("");
+    state.accessor->Jump(" ");  // skip metadata
+    std::string prefix;
+    DfsLookup(syll_graph, start_pos, prefix, &state);
+  }
+  if (horizon)
+    *horizon = (std::max)(*horizon, state.horizon);
   if (state.collector->empty())
     return nullptr;
   // sort each group of homophones by weight
@@ -279,7 +766,7 @@ size_t UserDictionary::LookupWords(UserDictEntryIterator* result,
   std::string key;
   std::string value;
   std::string full_code;
-  auto accessor = db_->Query(input);
+  auto accessor = Query(input);
   if (!accessor || accessor->exhausted()) {
     if (resume_key)
       *resume_key = kEnd;
@@ -340,7 +827,7 @@ bool UserDictionary::UpdateEntry(const DictEntry& entry, int commits,
   std::string key(code_str + '\t' + entry.text);
   std::string value;
   UserDbValue v;
-  if (db_->Fetch(key, &value)) {
+  if ((queue_ && queue_->Fetch(key, &value)) || db_->Fetch(key, &value)) {
     v.Unpack(value);
     if (v.tick > tick_) {
       v.tick = tick_;  // fix abnormal timestamp
@@ -365,11 +852,23 @@ bool UserDictionary::UpdateEntry(const DictEntry& entry, int commits,
     v.dee = algo::formula_d(0.0, (double)tick_, v.dee, (double)v.tick);
   }
   v.tick = tick_;
-  return db_->Update(key, v.Pack());
+  if (queue_)
+    queue_->Update(key, v.Pack(binary_values_));
+  else if (!db_->Update(key, v.Pack(binary_values_)))
+    return false;
+  if (index_) {
+    std::lock_guard<std::mutex> lock(index_->mutex());
+    index_->Update(key, v);
+  }
+  return true;
 }
 
 bool UserDictionary::UpdateTickCount(TickCount increment) {
   tick_ += increment;
+  if (queue_) {
+    queue_->UpdateTick(tick_);
+    return true;
+  }
   try {
     return db_->MetaUpdate("/tick", boost::lexical_cast<std::string>(tick_));
   }
@@ -383,6 +882,8 @@ bool UserDictionary::Initialize() {
 }
 
 bool UserDictionary::FetchTickCount() {
+  if (queue_ && queue_->FetchTick(&tick_))
+    return true;
   std::string value;
   try {
     // an earlier version mistakenly wrote tick count into an empty key
@@ -399,6 +900,12 @@ bool UserDictionary::FetchTickCount() {
 }
 
 bool UserDictionary::NewTransaction() {
+  if (queue_) {
+    CommitPendingTransaction();
+    transaction_time_ = time(NULL);
+    queue_->BeginTransaction();
+    return true;
+  }
   auto db = As<Transactional>(db_);
   if (!db)
     return false;
@@ -409,14 +916,28 @@ bool UserDictionary::NewTransaction() {
 
 bool UserDictionary::RevertRecentTransaction() {
   auto db = As<Transactional>(db_);
-  if (!db || !db->in_transaction())
+  bool in_transaction = queue_ ? queue_->in_transaction() :
+      db && db->in_transaction();
+  if (!in_transaction)
     return false;
   if (time(NULL) - transaction_time_ > 3/*seconds*/)
     return false;
-  return db->AbortTransaction();
+  if (!(queue_ ? queue_->AbortTransaction() : db->AbortTransaction()))
+    return false;
+  if (index_) {
+    std::lock_guard<std::mutex> lock(index_->mutex());
+    index_->Clear();  // to be rebuilt from the reverted db
+  }
+  return true;
 }
 
 bool UserDictionary::CommitPendingTransaction() {
+  if (queue_) {
+    bool in_transaction = queue_->in_transaction();
+    queue_->CommitTransaction();
+    queue_->FlushIfDue();
+    return in_transaction;
+  }
   auto db = As<Transactional>(db_);
   if (db && db->in_transaction()) {
     return db->CommitTransaction();
@@ -424,6 +945,25 @@ bool UserDictionary::CommitPendingTransaction() {
   return false;
 }
 
+shared_ptr<DbAccessor> UserDictionary::Query(const std::string& key) {
+  auto accessor = db_->Query(key);
+  return queue_ ? queue_->Merge(accessor, key) : accessor;
+}
+
+shared_ptr<DbAccessor> UserDictionary::QueryAll() {
+  auto accessor = db_->QueryAll();
+  return queue_ ? queue_->Merge(accessor, "") : accessor;
+}
+
+bool UserDictionary::PrepareIndex() {
+  if (!index_->Accepts(table_))
+    return false;
+  if (index_->built())
+    return true;
+  auto records = QueryAll();
+  return records && index_->Build(records.get(), table_);
+}
+
 bool UserDictionary::TranslateCodeToString(const Code& code,
                                            std::string* result) {
   if (!table_ || !result) return false;
@@ -446,29 +986,39 @@ shared_ptr<DictEntry> UserDictionary::CreateDictEntry(const std::string& key,
                                                       TickCount present_tick,
                                                       double credibility,
                                                       std::string* full_code) {
-  shared_ptr<DictEntry> e;
   size_t separator_pos = key.find('\t');
   if (separator_pos == std::string::npos)
-    return e;
+    return nullptr;
   UserDbValue v;
   if (!v.Unpack(value))
-    return e;
+    return nullptr;
+  auto e = CreateDictEntryFromRecord(key.substr(separator_pos + 1), v,
+                                     present_tick, credibility);
+  if (e && full_code) {
+    *full_code = key.substr(0, separator_pos);
+  }
+  return e;
+}
+
+static shared_ptr<DictEntry> CreateDictEntryFromRecord(
+    const std::string& text,
+    UserDbValue v,
+    TickCount present_tick,
+    double credibility) {
+  shared_ptr<DictEntry> e;
   if (v.commits < 0)  // deleted entry
     return e;
   if (v.tick < present_tick)
     v.dee = algo::formula_d(0, (double)present_tick, v.dee, (double)v.tick);
   // create!
   e = New<DictEntry>();
-  e->text = key.substr(separator_pos + 1);
+  e->text = text;
   e->commit_count = v.commits;
   // TODO: argument s not defined...
   e->weight = algo::formula_p(0,
                               (double)v.commits / present_tick,
                               (double)present_tick,
                               v.dee) * credibility;
-  if (full_code) {
-    *full_code = key.substr(0, separator_pos);
-  }
   DLOG(INFO) << "text = '" << e->text
              << "', code_len = " << e->code.size()
              << ", weight = " << e->weight
@@ -510,6 +1060,7 @@ UserDictionary* UserDictionaryComponent::Create(const Ticket& ticket) {
     // user specified db class
   }
   // obtain userdb object
+  std::lock_guard<std::mutex> lock(mutex_);
   auto db = db_pool_[dict_name].lock();
   if (!db) {
     auto component = Db::Require(db_class);
@@ -520,7 +1071,30 @@ UserDictionary* UserDictionaryComponent::Create(const Ticket& ticket) {
     db.reset(component->Create(dict_name));
     db_pool_[dict_name] = db;
   }
-  return new UserDictionary(db);
+  // the index is shared by all dictionaries writing to the db,
+  // even those not looking up in it, so as to keep it in sync.
+  auto index = index_pool_[dict_name].lock();
+  if (!index) {
+    index = New<UserDictIndex>();
+    index_pool_[dict_name] = index;
+  }
+  // learnt records are written behind for dbs allowing concurrent access,
+  // unless turned off in the installation settings.
+  shared_ptr<UserDbWriteQueue> queue;
+  int flush_interval = Service::instance().deployer().user_db_flush_interval;
+  if (flush_interval > 0 && Is<TreeDb>(db)) {
+    queue = queue_pool_[dict_name].lock();
+    if (!queue) {
+      queue = New<UserDbWriteQueue>(db, flush_interval);
+      queue_pool_[dict_name] = queue;
+    }
+  }
+  auto user_dict = new UserDictionary(db, index, queue);
+  bool enable_index = false;
+  config->GetBool(ticket.name_space + "/enable_user_dict_index",
+                  &enable_index);
+  user_dict->EnableIndex(enable_index);
+  return user_dict;
 }
 
 }  // namespace rime
@@ -4,8 +4,10 @@
 //
 // 2011-04-24 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
 #include <cctype>
 #include <functional>
+#include <list>
 #include <string>
 #include <vector>
 #include <rime/common.h>
@@ -25,8 +27,6 @@
 #include <rime/translation.h>
 #include <rime/translator.h>
 
-using namespace std::placeholders;
-
 namespace rime {
 
 class ConcreteEngine : public Engine {
@@ -43,6 +43,11 @@ class ConcreteEngine : public Engine {
   void Compose(Context* ctx);
   void CalculateSegmentation(Composition* comp);
   void TranslateSegments(Composition* comp);
+  void ForgetDisposedSegments(const Composition& comp);
+  bool ReuseTranslatedSegment(const std::string& input, Segment* segment);
+  bool RestoreComposedState(Composition* comp);
+  void SaveComposedState(const Composition& comp);
+  void ForgetComposedStates();
   void FilterCandidates(Segment* segment,
                         CandidateList* recruited,
                         CandidateList* candidates);
@@ -58,6 +63,18 @@ class ConcreteEngine : public Engine {
   std::vector<shared_ptr<Filter>> filters_;
   std::vector<shared_ptr<Formatter>> formatters_;
   std::vector<shared_ptr<Processor>> post_processors_;
+
+  // segments translated for the current composition, kept along with their
+  // input so that a segment recreated over the same text can take its menu.
+  struct TranslatedSegment {
+    std::string input;
+    Segment segment;
+  };
+  std::vector<TranslatedSegment> translated_segments_;
+  // compositions of recently seen inputs, most recently used first, so that
+  // backspacing or moving the caret back to one of them needs no recompose.
+  std::list<Composition> composed_states_;
+  static const size_t kMaxComposedStates = 32;
 };
 
 // implementations
@@ -83,6 +100,9 @@ ConcreteEngine::ConcreteEngine() {
       [this](Context* ctx) { OnSelect(ctx); });
   context_->update_notifier().connect(
       [this](Context* ctx) { OnContextUpdate(ctx); });
+  // connected before the translators that update their dictionaries
+  context_->delete_notifier().connect(
+      [this](Context* ctx) { ForgetComposedStates(); });
   context_->option_update_notifier().connect(
       [this](Context* ctx, const std::string& option) {
         OnOptionUpdate(ctx, option);
@@ -127,6 +147,9 @@ void ConcreteEngine::OnContextUpdate(Context* ctx) {
 void ConcreteEngine::OnOptionUpdate(Context* ctx, const std::string& option) {
   if (!ctx) return;
   LOG(INFO) << "updated option: " << option;
+  // menus created under the previous options are no good
+  translated_segments_.clear();
+  ForgetComposedStates();
   // apply new option to active segment
   if (ctx->IsComposing()) {
     ctx->RefreshNonConfirmedComposition();
@@ -142,9 +165,16 @@ void ConcreteEngine::Compose(Context* ctx) {
   Composition* comp = ctx->composition();
   std::string active_input(ctx->input().substr(0, ctx->caret_pos()));
   DLOG(INFO) << "active input: " << active_input;
+  ForgetDisposedSegments(*comp);
   comp->Reset(active_input);
+  if (RestoreComposedState(comp)) {
+    DLOG(INFO) << "restored composition: " << comp->GetDebugText();
+    ctx->set_composition(comp);
+    return;
+  }
   CalculateSegmentation(comp);
   TranslateSegments(comp);
+  SaveComposedState(*comp);
   DLOG(INFO) << "composition: " << comp->GetDebugText();
   ctx->set_composition(comp);
 }
@@ -182,9 +212,20 @@ void ConcreteEngine::TranslateSegments(Composition* comp) {
     if (len == 0)
       continue;
     std::string input = comp->input().substr(segment.start, len);
+    if (ReuseTranslatedSegment(input, &segment)) {
+      DLOG(INFO) << "reusing segment: " << input;
+      continue;
+    }
     DLOG(INFO) << "translating segment: " << input;
+    // filters see a copy of the segment, which outlives its place in the
+    // composition
+    Segment scope(segment.start, segment.end);
+    scope.tags = segment.tags;
     Menu::CandidateFilter cand_filter(
-        std::bind(&ConcreteEngine::FilterCandidates, this, &segment, _1, _2));
+        [this, scope](CandidateList* recruited,
+                      CandidateList* candidates) mutable {
+          FilterCandidates(&scope, recruited, candidates);
+        });
     auto menu = New<Menu>(cand_filter);
     for (auto& translator : translators_) {
       auto translation = translator->Query(input, segment, &segment.prompt);
@@ -199,7 +240,90 @@ void ConcreteEngine::TranslateSegments(Composition* comp) {
     segment.status = Segment::kGuess;
     segment.menu = menu;
     segment.selected_index = 0;
+    translated_segments_.push_back({input, segment});
+  }
+}
+
+// a menu is reusable as long as the segment it was made for is still part of
+// the composition; segments cleared or disposed since then are forgotten.
+void ConcreteEngine::ForgetDisposedSegments(const Composition& comp) {
+  auto is_disposed = [&comp](const TranslatedSegment& translated) {
+    for (const Segment& segment : comp) {
+      if (segment.menu == translated.segment.menu)
+        return false;
+    }
+    return true;
+  };
+  translated_segments_.erase(std::remove_if(translated_segments_.begin(),
+                                            translated_segments_.end(),
+                                            is_disposed),
+                             translated_segments_.end());
+}
+
+bool ConcreteEngine::ReuseTranslatedSegment(const std::string& input,
+                                            Segment* segment) {
+  for (const TranslatedSegment& translated : translated_segments_) {
+    const Segment& previous(translated.segment);
+    if (previous.start == segment->start &&
+        previous.end == segment->end &&
+        previous.tags == segment->tags &&
+        translated.input == input) {
+      segment->status = Segment::kGuess;
+      segment->menu = previous.menu;
+      segment->selected_index = 0;
+      segment->prompt = previous.prompt;
+      return true;
+    }
+  }
+  return false;
+}
+
+// a composed state applies if it has the same active input and keeps the
+// segments selected by the user, which survive a reset of the composition.
+static bool IsSameSelection(const Composition& comp, const Composition& state) {
+  for (size_t i = 0; i < comp.size() || i < state.size(); ++i) {
+    bool selected_in_comp =
+        i < comp.size() && comp[i].status >= Segment::kSelected;
+    bool selected_in_state =
+        i < state.size() && state[i].status >= Segment::kSelected;
+    if (!selected_in_comp && !selected_in_state)
+      continue;
+    if (!selected_in_comp || !selected_in_state)
+      return false;
+    const Segment& a(comp[i]);
+    const Segment& b(state[i]);
+    if (a.start != b.start || a.end != b.end || a.status != b.status ||
+        a.menu != b.menu || a.selected_index != b.selected_index)
+      return false;
+  }
+  return true;
+}
+
+bool ConcreteEngine::RestoreComposedState(Composition* comp) {
+  for (auto it = composed_states_.begin(); it != composed_states_.end(); ++it) {
+    if (it->input() == comp->input() && IsSameSelection(*comp, *it)) {
+      composed_states_.splice(composed_states_.begin(), composed_states_, it);
+      *comp = composed_states_.front();
+      return true;
+    }
   }
+  return false;
+}
+
+void ConcreteEngine::SaveComposedState(const Composition& comp) {
+  for (auto it = composed_states_.begin(); it != composed_states_.end(); ++it) {
+    if (it->input() == comp.input()) {
+      composed_states_.erase(it);
+      break;
+    }
+  }
+  composed_states_.push_front(comp);
+  if (composed_states_.size() > kMaxComposedStates)
+    composed_states_.pop_back();
+}
+
+void ConcreteEngine::ForgetComposedStates() {
+  composed_states_.clear();
 }
 
 void ConcreteEngine::FilterCandidates(Segment* segment,
@@ -232,6 +356,8 @@ void ConcreteEngine::CommitText(std::string text) {
 }
 
 void ConcreteEngine::OnCommit(Context* ctx) {
+  translated_segments_.clear();
+  ForgetComposedStates();
   context_->commit_history().Push(*ctx->composition(), ctx->input());
   std::string text = ctx->GetCommitText();
   FormatText(&text);
@@ -274,6 +400,8 @@ void ConcreteEngine::ApplySchema(Schema* schema) {
   if (!schema)
     return;
   schema_.reset(schema);
+  translated_segments_.clear();
+  ForgetComposedStates();
   context_->Clear();
   context_->ClearTransientOptions();
   InitializeComponents();
@@ -7,7 +7,6 @@
 #include <algorithm>
 #include <functional>
 #include <map>
-#include <set>
 #include <string>
 #include <vector>
 #include <rime/common.h>
@@ -144,25 +143,31 @@ KeyBinder::KeyBinder(const Ticket& ticket) : Processor(ticket),
   LoadConfig();
 }
 
-class KeyBindingConditions : public std::set<KeyBindingCondition> {
+// conditions are checked as bindings of the key require, for checking
+// the menu brings a composition with pending updates up to date.
+class KeyBindingConditions {
  public:
-  explicit KeyBindingConditions(Context* ctx);
-};
-
-KeyBindingConditions::KeyBindingConditions(Context* ctx) {
-  insert(kAlways);
-
-  if (ctx->IsComposing()) {
-    insert(kWhenComposing);
-  }
+  explicit KeyBindingConditions(Context* ctx) : ctx_(ctx) {}
+  bool Check(KeyBindingCondition condition);
 
-  if (ctx->HasMenu() && !ctx->get_option("ascii_mode")) {
-    insert(kWhenHasMenu);
-  }
+ private:
+  Context* ctx_;
+};
 
-  Composition* comp = ctx->composition();
-  if (!comp->empty() && comp->back().HasTag("paging")) {
-    insert(kWhenPaging);
+bool KeyBindingConditions::Check(KeyBindingCondition condition) {
+  switch (condition) {
+    case kAlways:
+      return true;
+    case kWhenComposing:
+      return ctx_->IsComposing();
+    case kWhenHasMenu:
+      return !ctx_->get_option("ascii_mode") && ctx_->HasMenu();
+    case kWhenPaging: {
+      Composition* comp = ctx_->composition();
+      return !comp->empty() && comp->back().HasTag("paging");
+    }
+    default:
+      return false;
   }
 }
 
@@ -175,7 +180,7 @@ ProcessResult KeyBinder::ProcessKeyEvent(const KeyEvent& key_event) {
     return kNoop;
   KeyBindingConditions conditions(engine_->context());
   for (const KeyBinding& binding : (*key_bindings_)[key_event]) {
-    if (conditions.find(binding.whence) == conditions.end())
+    if (!conditions.Check(binding.whence))
       continue;
     PerformKeyBinding(binding);
     return kAccepted;
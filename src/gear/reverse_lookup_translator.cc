@@ -170,8 +170,8 @@ shared_ptr<Translation> ReverseLookupTranslator::Query(const std::string& input,
   if (start < input.length()) {
     if (options_ && options_->enable_completion()) {
       dict_->LookupWords(&iter, code, true, 100);
-      quality = !iter.exhausted() &&
-                (iter.Peek()->remaining_code_length == 0);
+      auto view = iter.PeekView();
+      quality = view && view.remaining_code_length() == 0;
     }
     else {
       // 2012-04-08 gongchen: fetch multi-syllable words from rev-lookup table
@@ -185,8 +185,7 @@ shared_ptr<Translation> ReverseLookupTranslator::Query(const std::string& input,
         if (collector && !collector->empty() &&
             collector->rbegin()->first == consumed) {
           iter = collector->rbegin()->second;
-          quality = !graph.vertices.empty() &&
-              (graph.vertices.rbegin()->second == kNormalSpelling);
+          quality = graph.last_vertex_type() == kNormalSpelling;
         }
       }
     }
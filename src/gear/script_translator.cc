@@ -7,16 +7,21 @@
 // 2011-07-10 GONG Chen <chen.sst@gmail.com>
 //
 #include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
 #include <boost/algorithm/string/join.hpp>
-#include <boost/range/adaptor/reversed.hpp>
 #include <rime/composition.h>
 #include <rime/candidate.h>
 #include <rime/config.h>
 #include <rime/context.h>
 #include <rime/engine.h>
+#include <rime/key_event.h>
 #include <rime/schema.h>
 #include <rime/translation.h>
 #include <rime/dict/dictionary.h>
+#include <rime/dict/user_dictionary.h>
 #include <rime/algo/syllabifier.h>
 #include <rime/gear/poet.h>
 #include <rime/gear/script_translator.h>
@@ -45,34 +50,142 @@ bool DelimitSyllablesDfs(DelimitSyllableState* state,
     return current_pos == state->end_pos;
   }
   SyllableId syllable_id = state->code->at(depth);
-  auto z = state->graph->edges.find(current_pos);
-  if (z == state->graph->edges.end())
-    return false;
-  // favor longer spellings
-  for (const auto& y : boost::adaptors::reverse(z->second)) {
-    size_t end_vertex_pos = y.first;
+  // favor longer spellings, which come first
+  for (const auto& y : state->graph->spellings(current_pos)[syllable_id]) {
+    size_t end_vertex_pos = y.end_pos;
     if (end_vertex_pos > state->end_pos)
       continue;
-    auto x = y.second.find(syllable_id);
-    if (x != y.second.end()) {
-      size_t len = state->output.length();
-      if (depth > 0 && len > 0 &&
-          state->delimiters->find(
-              state->output[len - 1]) == std::string::npos) {
-        state->output += state->delimiters->at(0);
-      }
-      state->output += state->input->substr(current_pos,
-                                            end_vertex_pos - current_pos);
-      if (DelimitSyllablesDfs(state, end_vertex_pos, depth + 1))
-        return true;
-      state->output.resize(len);
+    size_t len = state->output.length();
+    if (depth > 0 && len > 0 &&
+        state->delimiters->find(
+            state->output[len - 1]) == std::string::npos) {
+      state->output += state->delimiters->at(0);
     }
+    state->output += state->input->substr(current_pos,
+                                          end_vertex_pos - current_pos);
+    if (DelimitSyllablesDfs(state, end_vertex_pos, depth + 1))
+      return true;
+    state->output.resize(len);
   }
   return false;
 }
 
+bool SameSpellings(const SpellingPropertiesList& a,
+                   const SpellingPropertiesList& b) {
+  return a.size() == b.size() &&
+      std::equal(a.begin(), a.end(), b.begin(),
+                 [](const SpellingProperties& x,
+                    const SpellingProperties& y) {
+                   return x.type == y.type &&
+                       x.end_pos == y.end_pos &&
+                       x.credibility == y.credibility &&
+                       x.tips == y.tips;
+                 });
+}
+
+bool SameEdges(const SpellingIndex& a, const SpellingIndex& b) {
+  if (a.size() != b.size())
+    return false;
+  for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+    auto x = *i;
+    auto y = *j;
+    if (x.first != y.first || !SameSpellings(x.second, y.second))
+      return false;
+  }
+  return true;
+}
+
+// collects positions below limit where the two graphs differ.
+void FindDifferences(const SyllableGraph& a, const SyllableGraph& b,
+                     size_t limit, std::set<size_t>* result) {
+  for (size_t pos = 0; pos < limit; ++pos) {
+    if (a.vertex_type(pos) != b.vertex_type(pos) ||
+        !SameEdges(a.spellings(pos), b.spellings(pos)))
+      result->insert(pos);
+  }
+}
+
 }  // anonymous namespace
 
+// results of dictionary lookups made for a previous input.
+// a lookup is reusable with the new input if none of the vertices and edges
+// it has examined in the syllable graph have changed.
+// the collectors are shared with translations rather than copied; they are
+// not modified after the lookup, except that a word graph borrows the user
+// phrases for making a sentence.
+struct ScriptLookupCache {
+  struct VertexLookup {
+    size_t horizon = 0;
+    shared_ptr<const DictEntryCollector> phrase;
+    shared_ptr<UserDictEntryCollector> user_phrase;
+  };
+
+  // typing at the end of input alternates the syllable graph between two
+  // states, with or without abbreviated spellings; keep earlier caches
+  // from both states.
+  static const size_t kMaxGenerations = 2;
+
+  std::string input;
+  UserDictionary* user_dict = nullptr;
+  // a copy of the syllable graph the lookups were made in
+  SyllableGraph graph;
+  // phrases that start at the beginning of input
+  unique_ptr<VertexLookup> phrase;
+  // merged lookup results at each vertex for making sentences
+  std::map<size_t, VertexLookup> sentence;
+  // cache of an earlier generation
+  shared_ptr<ScriptLookupCache> earlier;
+
+  ScriptLookupCache(const std::string& _input,
+                    UserDictionary* _user_dict,
+                    const SyllableGraph& _graph)
+      : input(_input), user_dict(_user_dict), graph(_graph) {
+  }
+};
+
+// a cache compared with the syllable graph of the new input
+struct ScriptLookupCacheDiff {
+  shared_ptr<ScriptLookupCache> cache;
+  // the length of input the comparison covers
+  size_t length = 0;
+  // positions where the syllable graph has changed
+  std::set<size_t> changes;
+
+  ScriptLookupCacheDiff(const shared_ptr<ScriptLookupCache>& _cache,
+                        const std::string& new_input,
+                        UserDictionary* new_user_dict,
+                        const SyllableGraph& graph);
+
+  bool IsReusable(size_t start_pos,
+                  const ScriptLookupCache::VertexLookup& lookup) const {
+    if (lookup.horizon >= length)
+      return false;
+    auto change = changes.lower_bound(start_pos);
+    return change == changes.end() || *change > lookup.horizon;
+  }
+};
+
+ScriptLookupCacheDiff::ScriptLookupCacheDiff(
+    const shared_ptr<ScriptLookupCache>& _cache,
+    const std::string& new_input,
+    UserDictionary* new_user_dict,
+    const SyllableGraph& graph)
+    : cache(_cache) {
+  if (new_user_dict != cache->user_dict)
+    return;
+  const std::string& input(cache->input);
+  auto mismatch = std::mismatch(input.begin(),
+                                input.begin() + (std::min)(input.length(),
+                                                           new_input.length()),
+                                new_input.begin());
+  length = mismatch.first - input.begin();
+  length = (std::min)(length, cache->graph.interpreted_length);
+  length = (std::min)(length, graph.interpreted_length);
+  FindDifferences(cache->graph, graph, length, &changes);
+  DLOG(INFO) << "syllable graph changed at " << changes.size()
+             << " positions within length " << length;
+}
+
 class ScriptTranslation
     : public Translation,
       public Syllabification,
@@ -85,7 +198,8 @@ class ScriptTranslation
         input_(input), start_(start) {
     set_exhausted(true);
   }
-  bool Evaluate(Dictionary* dict, UserDictionary* user_dict);
+  bool Evaluate(Dictionary* dict, UserDictionary* user_dict,
+                shared_ptr<ScriptLookupCache>* lookup_cache = NULL);
   virtual bool Next();
   virtual shared_ptr<Candidate> Peek();
   virtual size_t PreviousStop(size_t caret_pos) const;
@@ -100,19 +214,27 @@ class ScriptTranslation
   std::string GetOriginalSpelling(const CandidateT& cand) const;
   shared_ptr<Sentence> MakeSentence(Dictionary* dict,
                                     UserDictionary* user_dict);
+  const ScriptLookupCache::VertexLookup* FindReusablePhrase() const;
+  void LoadPhraseEntries();
 
   ScriptTranslator* translator_;
   std::string input_;
   size_t start_;
 
   SyllableGraph syllable_graph_;
-  shared_ptr<DictEntryCollector> phrase_;
-  shared_ptr<UserDictEntryCollector> user_phrase_;
+  shared_ptr<const DictEntryCollector> phrase_;
+  shared_ptr<const UserDictEntryCollector> user_phrase_;
   shared_ptr<Sentence> sentence_;
 
-  DictEntryCollector::reverse_iterator phrase_iter_;
-  UserDictEntryCollector::reverse_iterator user_phrase_iter_;
+  DictEntryCollector::const_reverse_iterator phrase_iter_;
+  // a copy of the entries at phrase_iter_, being consumed
+  DictEntryIterator phrase_entries_;
+  UserDictEntryCollector::const_reverse_iterator user_phrase_iter_;
   size_t user_phrase_index_ = 0;
+
+  // incremental lookup
+  shared_ptr<ScriptLookupCache> lookup_cache_;
+  std::vector<ScriptLookupCacheDiff> earlier_lookups_;
 };
 
 // ScriptTranslator implementation
@@ -125,9 +247,41 @@ ScriptTranslator::ScriptTranslator(const Ticket& ticket)
     return;
   if (Config* config = engine_->schema()->config()) {
     config->GetInt(name_space_ + "/spelling_hints", &spelling_hints_);
+    config->GetBool(name_space_ + "/enable_incremental_lookup",
+                    &enable_incremental_lookup_);
+  }
+  if (enable_incremental_lookup_) {
+    // user dictionary may change in these events; the handlers should run
+    // before Memory's, which could trigger a new query right away.
+    Context* ctx = engine_->context();
+    commit_connection_ = ctx->commit_notifier().connect(
+        [this](Context*) { ClearLookupCache(); },
+        boost::signals2::at_front);
+    delete_connection_ = ctx->delete_notifier().connect(
+        [this](Context*) { ClearLookupCache(); },
+        boost::signals2::at_front);
+    unhandled_key_connection_ = ctx->unhandled_key_notifier().connect(
+        [this](Context*, const KeyEvent&) { ClearLookupCache(); },
+        boost::signals2::at_front);
   }
 }
 
+ScriptTranslator::~ScriptTranslator() {
+  commit_connection_.disconnect();
+  delete_connection_.disconnect();
+  unhandled_key_connection_.disconnect();
+}
+
+void ScriptTranslator::ClearLookupCache() {
+  lookup_cache_.reset();
+}
+
+void ScriptTranslator::OnLookup(bool reused) {
+  ++lookup_stats_.lookups;
+  if (reused)
+    ++lookup_stats_.reused;
+}
+
 shared_ptr<Translation> ScriptTranslator::Query(const std::string& input,
                                                 const Segment& segment,
                                                 std::string* prompt) {
@@ -145,7 +299,8 @@ shared_ptr<Translation> ScriptTranslator::Query(const std::string& input,
   auto result = New<ScriptTranslation>(this, input, segment.start);
   if (!result ||
       !result->Evaluate(dict_.get(),
-                        enable_user_dict ? user_dict_.get() : NULL)) {
+                        enable_user_dict ? user_dict_.get() : NULL,
+                        enable_incremental_lookup_ ? &lookup_cache_ : NULL)) {
     return nullptr;
   }
   return New<UniqueFilter>(result);
@@ -191,7 +346,8 @@ bool ScriptTranslator::Memorize(const CommitEntry& commit_entry) {
 
 // ScriptTranslation implementation
 
-bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict) {
+bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict,
+                                 shared_ptr<ScriptLookupCache>* lookup_cache) {
   Syllabifier syllabifier(translator_->delimiters(),
                           translator_->enable_completion(),
                           translator_->strict_spelling());
@@ -199,9 +355,48 @@ bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict) {
                                                    *dict->prism(),
                                                    &syllable_graph_);
 
-  phrase_ = dict->Lookup(syllable_graph_, 0);
-  if (user_dict) {
-    user_phrase_ = user_dict->Lookup(syllable_graph_, 0);
+  if (lookup_cache) {
+    size_t generations = 0;
+    for (auto c = *lookup_cache; c; c = c->earlier) {
+      earlier_lookups_.emplace_back(c, input_, user_dict, syllable_graph_);
+      if (++generations == ScriptLookupCache::kMaxGenerations)
+        c->earlier.reset();
+    }
+    lookup_cache_ = New<ScriptLookupCache>(input_, user_dict,
+                                           syllable_graph_);
+    lookup_cache_->earlier = *lookup_cache;
+    *lookup_cache = lookup_cache_;
+  }
+
+  if (auto cached = FindReusablePhrase()) {
+    phrase_ = cached->phrase;
+    user_phrase_ = cached->user_phrase;
+    lookup_cache_->phrase.reset(new ScriptLookupCache::VertexLookup(*cached));
+    translator_->OnLookup(true);
+  }
+  else {
+    size_t horizon = 0;
+    phrase_ = dict->Lookup(syllable_graph_, 0, 1.0, &horizon);
+    shared_ptr<UserDictEntryCollector> user_phrase;
+    if (user_dict) {
+      user_phrase = user_dict->Lookup(syllable_graph_, 0, 0, 1.0, &horizon);
+      user_phrase_ = user_phrase;
+    }
+    if (lookup_cache_) {
+      auto lookup = new ScriptLookupCache::VertexLookup;
+      lookup->horizon = horizon;
+      lookup->phrase = phrase_;
+      lookup->user_phrase = user_phrase;
+      lookup_cache_->phrase.reset(lookup);
+    }
+    translator_->OnLookup(false);
+  }
+  // collect reusable lookups for making sentences
+  for (const auto& diff : earlier_lookups_) {
+    for (const auto& x : diff.cache->sentence) {
+      if (diff.IsReusable(x.first, x.second))
+        lookup_cache_->sentence.insert(x);
+    }
   }
   if (!phrase_ && !user_phrase_)
     return false;
@@ -212,17 +407,38 @@ bool ScriptTranslation::Evaluate(Dictionary* dict, UserDictionary* user_dict) {
   if (user_phrase_ && !user_phrase_->empty())
     translated_len = (std::max)(translated_len, user_phrase_->rbegin()->first);
   if (translated_len < consumed &&
-      syllable_graph_.edges.size() > 1) {  // at least 2 syllables required
+      syllable_graph_.num_spelt_vertices() > 1) {  // at least 2 syllables
     sentence_ = MakeSentence(dict, user_dict);
   }
 
-  if (phrase_)
+  if (phrase_) {
     phrase_iter_ = phrase_->rbegin();
+    LoadPhraseEntries();
+  }
   if (user_phrase_)
     user_phrase_iter_ = user_phrase_->rbegin();
   return !CheckEmpty();
 }
 
+void ScriptTranslation::LoadPhraseEntries() {
+  // the collector may be shared with the lookup cache; consume a copy of
+  // the entries at one code length at a time.
+  if (phrase_iter_ != phrase_->rend()) {
+    DictEntryIterator entries(phrase_iter_->second);
+    phrase_entries_ = entries;
+  }
+}
+
+const ScriptLookupCache::VertexLookup*
+ScriptTranslation::FindReusablePhrase() const {
+  for (const auto& diff : earlier_lookups_) {
+    const auto& lookup(diff.cache->phrase);
+    if (lookup && diff.IsReusable(0, *lookup))
+      return lookup.get();
+  }
+  return nullptr;
+}
+
 template <class CandidateT>
 std::string
 ScriptTranslation::GetPreeditString(const CandidateT& cand) const {
@@ -267,24 +483,23 @@ bool ScriptTranslation::Next() {
   }
   if (user_phrase_code_length > 0 &&
       user_phrase_code_length >= phrase_code_length) {
-    DictEntryList& entries(user_phrase_iter_->second);
+    const DictEntryList& entries(user_phrase_iter_->second);
     if (++user_phrase_index_ >= entries.size()) {
       ++user_phrase_iter_;
       user_phrase_index_ = 0;
     }
   }
   else if (phrase_code_length > 0) {
-    DictEntryIterator& iter(phrase_iter_->second);
-    if (!iter.Next()) {
+    if (!phrase_entries_.Next()) {
       ++phrase_iter_;
+      LoadPhraseEntries();
     }
   }
   return !CheckEmpty();
 }
 
 bool ScriptTranslation::IsNormalSpelling() const {
-  return !syllable_graph_.vertices.empty() &&
-      (syllable_graph_.vertices.rbegin()->second == kNormalSpelling);
+  return syllable_graph_.last_vertex_type() == kNormalSpelling;
 }
 
 shared_ptr<Candidate> ScriptTranslation::Peek() {
@@ -314,7 +529,7 @@ shared_ptr<Candidate> ScriptTranslation::Peek() {
   shared_ptr<Phrase> cand;
   if (user_phrase_code_length > 0 &&
       user_phrase_code_length >= phrase_code_length) {
-    DictEntryList& entries(user_phrase_iter_->second);
+    const DictEntryList& entries(user_phrase_iter_->second);
     const auto& entry(entries[user_phrase_index_]);
     DLOG(INFO) << "user phrase '" << entry->text
                << "', code length: " << user_phrase_code_length;
@@ -328,8 +543,7 @@ shared_ptr<Candidate> ScriptTranslation::Peek() {
                       (IsNormalSpelling() ? 0.5 : -0.5));
   }
   else if (phrase_code_length > 0) {
-    DictEntryIterator& iter(phrase_iter_->second);
-    const auto& entry(iter.Peek());
+    const auto& entry(phrase_entries_.Peek());
     DLOG(INFO) << "phrase '" << entry->text
                << "', code length: " << user_phrase_code_length;
     cand = New<Phrase>(translator_->language(),
@@ -365,21 +579,35 @@ ScriptTranslation::MakeSentence(Dictionary* dict, UserDictionary* user_dict) {
   const int kMaxSyllablesForUserPhraseQuery = 5;
   const double kPenaltyForAmbiguousSyllable = 1e-10;
   WordGraph graph;
-  for (const auto& x : syllable_graph_.edges) {
+  for (size_t start_pos = 0;
+       start_pos < syllable_graph_.vertices().size(); ++start_pos) {
+    if (syllable_graph_.spellings(start_pos).empty())
+      continue;
+    UserDictEntryCollector& dest(graph[start_pos]);
+    if (lookup_cache_) {
+      auto cached = lookup_cache_->sentence.find(start_pos);
+      if (cached != lookup_cache_->sentence.end()) {
+        // borrowed for making the sentence; returned below
+        dest.swap(*cached->second.user_phrase);
+        translator_->OnLookup(true);
+        continue;
+      }
+    }
     // discourage starting a word from an ambiguous joint
     // bad cases include pinyin syllabification "niju'ede"
     double credibility = 1.0;
-    if (syllable_graph_.vertices[x.first] >= kAmbiguousSpelling)
+    if (syllable_graph_.vertex_type(start_pos) >= kAmbiguousSpelling)
       credibility = kPenaltyForAmbiguousSyllable;
-    UserDictEntryCollector& dest(graph[x.first]);
+    size_t horizon = 0;
     if (user_dict) {
-      auto user_phrase = user_dict->Lookup(syllable_graph_, x.first,
+      auto user_phrase = user_dict->Lookup(syllable_graph_, start_pos,
                                            kMaxSyllablesForUserPhraseQuery,
-                                           credibility);
+                                           credibility, &horizon);
       if (user_phrase)
         dest.swap(*user_phrase);
     }
-    if (auto phrase = dict->Lookup(syllable_graph_, x.first, credibility)) {
+    if (auto phrase = dict->Lookup(syllable_graph_, start_pos, credibility,
+                                   &horizon)) {
       // merge lookup results
       for (auto& y : *phrase) {
         DictEntryList& entries(dest[y.first]);
@@ -388,10 +616,24 @@ ScriptTranslation::MakeSentence(Dictionary* dict, UserDictionary* user_dict) {
         }
       }
     }
+    if (lookup_cache_) {
+      auto& lookup(lookup_cache_->sentence[start_pos]);
+      lookup.horizon = horizon;
+      lookup.user_phrase = New<UserDictEntryCollector>();
+    }
+    translator_->OnLookup(false);
   }
   Poet poet(translator_->language());
   auto sentence = poet.MakeSentence(graph,
                                     syllable_graph_.interpreted_length);
+  if (lookup_cache_) {
+    // move the word graph into the cache
+    for (auto& x : lookup_cache_->sentence) {
+      auto w = graph.find(x.first);
+      if (w != graph.end())
+        x.second.user_phrase->swap(w->second);
+    }
+  }
   if (sentence) {
     sentence->Offset(start_);
     sentence->set_syllabification(shared_from_this());
@@ -401,18 +643,20 @@ ScriptTranslation::MakeSentence(Dictionary* dict, UserDictionary* user_dict) {
 
 size_t ScriptTranslation::PreviousStop(size_t caret_pos) const {
   size_t offset = caret_pos - start_;
-  for (const auto& x : boost::adaptors::reverse(syllable_graph_.vertices)) {
-    if (x.first < offset)
-      return x.first + start_;
+  const auto& vertices(syllable_graph_.vertices());
+  for (size_t pos = (std::min)(offset, vertices.size()); pos-- > 0; ) {
+    if (vertices[pos] != kInvalidSpelling)
+      return pos + start_;
   }
   return caret_pos;
 }
 
 size_t ScriptTranslation::NextStop(size_t caret_pos) const {
   size_t offset = caret_pos - start_;
-  for (const auto& x : syllable_graph_.vertices) {
-    if (x.first > offset)
-      return x.first + start_;
+  const auto& vertices(syllable_graph_.vertices());
+  for (size_t pos = offset + 1; pos < vertices.size(); ++pos) {
+    if (vertices[pos] != kInvalidSpelling)
+      return pos + start_;
   }
   return caret_pos;
 }
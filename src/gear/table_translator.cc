@@ -109,7 +109,8 @@ bool TableTranslation::PreferUserPhrase() {
     return false;
   if (iter_.exhausted())
     return true;
-  if (iter_.Peek()->remaining_code_length == 0 &&
+  auto view = iter_.PeekView();
+  if (view && view.remaining_code_length() == 0 &&
       (uter_.Peek()->remaining_code_length != 0 ||
        is_constructed(uter_.Peek().get())))
     return false;
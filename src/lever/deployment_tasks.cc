@@ -4,6 +4,11 @@
 //
 // 2011-12-10 GONG Chen <chen.sst@gmail.com>
 //
+#include <atomic>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/uuid/random_generator.hpp>
@@ -13,9 +18,11 @@
 #include <rime/common.h>
 #include <rime/schema.h>
 #include <rime/ticket.h>
+#include <rime/algo/manifest.h>
 #include <rime/algo/utilities.h>
 #include <rime/dict/dictionary.h>
 #include <rime/dict/dict_compiler.h>
+#include <rime/dict/reverse_lookup_dictionary.h>
 #include <rime/lever/customizer.h>
 #include <rime/lever/deployment_tasks.h>
 #include <rime/lever/user_dict_manager.h>
@@ -57,6 +64,16 @@ bool InstallationUpdate::Run(Deployer* deployer) {
       deployer->sync_dir = (user_data_path / "sync").string();
     }
     LOG(INFO) << "sync dir: " << deployer->sync_dir;
+    config.GetInt("user_db_flush_interval",
+                  &deployer->user_db_flush_interval);
+    config.GetInt("max_parallel_jobs", &deployer->max_parallel_jobs);
+    int max_table_build_memory = 0;
+    if (config.GetInt("max_table_build_memory", &max_table_build_memory) &&
+        max_table_build_memory > 0) {
+      deployer->max_table_build_memory = max_table_build_memory;
+    }
+    config.GetBool("compact_tables", &deployer->compact_tables);
+    config.GetBool("keyed_table_index", &deployer->keyed_table_index);
     if (config.GetString("distribution_code_name", &last_distro_code_name)) {
       LOG(INFO) << "previous distribution: " << last_distro_code_name;
     }
@@ -140,6 +157,7 @@ bool WorkspaceUpdate::Run(Deployer* deployer) {
   int success = 0;
   int failure = 0;
   std::map<std::string, std::string> schemas;
+  std::vector<std::string> schema_files;
   for (auto it = schema_list->begin(); it != schema_list->end(); ++it) {
     auto item = As<ConfigMap>(*it);
     if (!item)
@@ -161,14 +179,12 @@ bool WorkspaceUpdate::Run(Deployer* deployer) {
       LOG(WARNING) << "missing schema file for '" << schema_id << "'.";
       continue;
     }
-    // build schema
-    unique_ptr<DeploymentTask> t(new SchemaUpdate(schema_path));
-    if (t->Run(deployer))
-      ++success;
-    else
-      ++failure;
+    schema_files.push_back(schema_path);
   }
+  // build schemas
+  RunSchemaUpdates(deployer, schema_files, &success, &failure);
   // find dependencies
+  schema_files.clear();
   for (auto s = schemas.cbegin(); s != schemas.cend(); ++s) {
     Config schema_config;
     // user could have customized dependencies in the resulting schema
@@ -192,14 +208,11 @@ bool WorkspaceUpdate::Run(Deployer* deployer) {
         LOG(WARNING) << "missing schema file for dependency '" << dependency_id << "'.";
         continue;
       }
-      // build dependency
-      unique_ptr<DeploymentTask> t(new SchemaUpdate(dependency_path));
-      if (t->Run(deployer))
-        ++success;
-      else
-        ++failure;
+      schema_files.push_back(dependency_path);
     }
   }
+  // build dependencies
+  RunSchemaUpdates(deployer, schema_files, &success, &failure);
   LOG(INFO) << "finished updating schemas: "
             << success << " success, " << failure << " failure.";
   return failure == 0;
@@ -224,6 +237,138 @@ std::string WorkspaceUpdate::GetSchemaPath(Deployer* deployer,
   return schema_path.string();
 }
 
+// the key tells the format tables are built in as well, so that an update
+// is not found up to date after the format option changes.
+static std::string schema_update_key(Deployer* deployer,
+                                     const std::string& schema_file) {
+  std::string key("schema_update:" + schema_file);
+  if (deployer->compact_tables)
+    key += "|compact_tables";
+  else if (deployer->keyed_table_index)
+    key += "|keyed_table_index";
+  return key;
+}
+
+// lists files a schema update may write to: the customized schema, and the
+// dictionary and prism it compiles. outputs are listed even for an update
+// found up to date, which could turn stale as another update rewrites the
+// files they share.
+static std::vector<std::string> schema_update_outputs(
+    Deployer* deployer, const std::string& schema_file) {
+  std::vector<std::string> outputs;
+  std::string schema_id;
+  {
+    Config source;
+    if (!source.LoadFromFile(schema_file) ||
+        !source.GetString("schema/schema_id", &schema_id) ||
+        schema_id.empty())
+      return outputs;
+  }
+  outputs.push_back(schema_id + ".schema.yaml");
+  // find the customized dictionary without writing the customized schema,
+  // which is left to SchemaUpdate::Run().
+  Config config;
+  std::string dict_name;
+  if (!config.LoadFromFile(schema_file))
+    return outputs;
+  fs::path custom_path(fs::path(deployer->user_data_dir) /
+                       (schema_id + ".custom.yaml"));
+  Config custom_config;
+  if (fs::exists(custom_path) &&
+      custom_config.LoadFromFile(custom_path.string())) {
+    if (auto patch = custom_config.GetMap("patch")) {
+      for (auto it = patch->begin(); it != patch->end(); ++it) {
+        config.SetItem(it->first, it->second);
+      }
+    }
+  }
+  if (!config.GetString("translator/dictionary", &dict_name))
+    return outputs;
+  std::string prism_name(dict_name);
+  config.GetString("translator/prism", &prism_name);
+  outputs.push_back(dict_name + ".table.bin");
+  outputs.push_back(dict_name + ".reverse.bin");
+  outputs.push_back(prism_name + ".prism.bin");
+  return outputs;
+}
+
+void WorkspaceUpdate::RunSchemaUpdates(
+    Deployer* deployer,
+    const std::vector<std::string>& schema_files,
+    int* success,
+    int* failure) {
+  size_t num_jobs = deployer->max_parallel_jobs > 0 ?
+      deployer->max_parallel_jobs : std::thread::hardware_concurrency();
+  if (num_jobs <= 1 || schema_files.size() <= 1) {
+    for (const auto& schema_file : schema_files) {
+      unique_ptr<DeploymentTask> t(new SchemaUpdate(schema_file));
+      if (t->Run(deployer))
+        ++*success;
+      else
+        ++*failure;
+    }
+    return;
+  }
+  // updates writing to the same file are chained, to run one after another
+  // in the given order. thus a dictionary shared by several schemas is
+  // compiled by the first update and found up to date by the rest.
+  std::vector<size_t> chain_head(schema_files.size());
+  std::function<size_t (size_t)> find_head = [&](size_t i) {
+    return chain_head[i] == i ? i : chain_head[i] = find_head(chain_head[i]);
+  };
+  std::map<std::string, size_t> writer;
+  for (size_t i = 0; i < schema_files.size(); ++i) {
+    chain_head[i] = i;
+    for (const auto& output : schema_update_outputs(deployer,
+                                                    schema_files[i])) {
+      auto found = writer.find(output);
+      if (found == writer.end()) {
+        writer[output] = i;
+        continue;
+      }
+      size_t a = find_head(found->second);
+      size_t b = find_head(i);
+      chain_head[(std::max)(a, b)] = (std::min)(a, b);
+    }
+  }
+  std::vector<std::vector<size_t>> chains;
+  std::map<size_t, size_t> chain_index;
+  for (size_t i = 0; i < schema_files.size(); ++i) {
+    size_t head = find_head(i);
+    if (chain_index.find(head) == chain_index.end()) {
+      chain_index[head] = chains.size();
+      chains.emplace_back();
+    }
+    chains[chain_index[head]].push_back(i);
+  }
+  num_jobs = (std::min)(num_jobs, chains.size());
+  LOG(INFO) << "updating " << schema_files.size() << " schemas in "
+            << chains.size() << " chains, with " << num_jobs << " threads.";
+  std::atomic<size_t> next_chain(0);
+  std::atomic<int> num_success(0);
+  std::atomic<int> num_failure(0);
+  auto work = [&] {
+    for (size_t k; (k = next_chain++) < chains.size(); ) {
+      for (size_t i : chains[k]) {
+        unique_ptr<DeploymentTask> t(new SchemaUpdate(schema_files[i]));
+        if (t->Run(deployer))
+          ++num_success;
+        else
+          ++num_failure;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t j = 0; j < num_jobs; ++j) {
+    workers.emplace_back(work);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  *success += num_success;
+  *failure += num_failure;
+}
+
 SchemaUpdate::SchemaUpdate(TaskInitializer arg) : verbose_(false) {
   try {
     schema_file_ = boost::any_cast<std::string>(arg);
@@ -254,6 +399,12 @@ bool SchemaUpdate::Run(Deployer* deployer) {
                << schema_file_ << "'.";
     return false;
   }
+  Manifest* manifest = deployer->manifest();
+  std::string update_key(schema_update_key(deployer, schema_file_));
+  if (!verbose_ && manifest->IsUpToDate(update_key)) {
+    LOG(INFO) << "schema '" << schema_file_ << "' is up-to-date.";
+    return true;
+  }
   std::string schema_id;
   {
     Config source;
@@ -279,9 +430,16 @@ bool SchemaUpdate::Run(Deployer* deployer) {
                << destination_path.string() << "'.";
     return false;
   }
+  // files to check for changes next time
+  std::vector<std::string> files = {
+    schema_file_,
+    (user_data_path / (schema_id + ".custom.yaml")).string(),
+    destination_path.string(),
+  };
   std::string dict_name;
   if (!config->GetString("translator/dictionary", &dict_name)) {
     // not requiring a dictionary
+    manifest->Record(update_key, files);
     return true;
   }
   DictionaryComponent component;
@@ -294,6 +452,11 @@ bool SchemaUpdate::Run(Deployer* deployer) {
   DictFileFinder finder = std::bind(&find_dict_file,
                                     _1, shared_data_path, user_data_path);
   DictCompiler dict_compiler(dict.get(), finder);
+  if (deployer->max_table_build_memory) {
+    dict_compiler.set_memory_budget(deployer->max_table_build_memory);
+  }
+  dict_compiler.set_compact_table(deployer->compact_tables);
+  dict_compiler.set_keyed_trunk_index(deployer->keyed_table_index);
   if (verbose_) {
     dict_compiler.set_options(DictCompiler::kRebuild | DictCompiler::kDump);
   }
@@ -302,6 +465,21 @@ bool SchemaUpdate::Run(Deployer* deployer) {
     return false;
   }
   LOG(INFO) << "dictionary '" << dict_name << "' is ready.";
+  // dict sources in the user data dir would take the place of shared ones
+  std::string dict_file_name(dict_name + ".dict.yaml");
+  files.push_back((shared_data_path / dict_file_name).string());
+  files.push_back((user_data_path / dict_file_name).string());
+  for (const auto& source_file : dict_compiler.source_files()) {
+    files.push_back(source_file);
+    if (boost::ends_with(source_file, ".dict.yaml")) {
+      files.push_back(
+          (user_data_path / fs::path(source_file).filename()).string());
+    }
+  }
+  files.push_back(dict->table()->file_name());
+  files.push_back(dict->prism()->file_name());
+  files.push_back(ReverseDb(dict_name).file_name());
+  manifest->Record(update_key, files);
   return true;
 }
 
@@ -335,17 +513,19 @@ bool PrebuildAllSchemas::Run(Deployer* deployer) {
   fs::path user_data_path(deployer->user_data_dir);
   if (!fs::exists(shared_data_path) || !fs::is_directory(shared_data_path))
     return false;
-  bool success = true;
+  std::vector<std::string> schema_files;
   for (fs::directory_iterator iter(shared_data_path), end;
        iter != end; ++iter) {
     fs::path entry(iter->path());
     if (boost::ends_with(entry.string(), ".schema.yaml")) {
-      unique_ptr<DeploymentTask> t(new SchemaUpdate(entry.string()));
-      if (!t->Run(deployer))
-        success = false;
+      schema_files.push_back(entry.string());
     }
   }
-  return success;
+  int success = 0;
+  int failure = 0;
+  WorkspaceUpdate::RunSchemaUpdates(deployer, schema_files,
+                                    &success, &failure);
+  return failure == 0;
 }
 
 bool SymlinkingPrebuiltDictionaries::Run(Deployer* deployer) {
@@ -5,6 +5,8 @@
 // 2012-03-23 GONG Chen <chen.sst@gmail.com>
 //
 #include <fstream>
+#include <utility>
+#include <vector>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/scope_exit.hpp>
@@ -181,9 +183,37 @@ bool UserDictManager::UpgradeUserDict(const std::string& dict_name) {
            db.Remove() &&
            Restore(snapshot_path.string());
   }
+  std::string value_format;
+  if (!db.MetaFetch("/value_format", &value_format) ||
+      value_format != UserDb<TreeDb>::value_format) {
+    LOG(INFO) << "converting user dict '" << dict_name
+              << "' to binary values.";
+    return db.Close() &&
+           db.Open() &&
+           ConvertToBinaryValues(&db);
+  }
   return true;
 }
 
+// packs values written by older versions in the binary layout
+bool UserDictManager::ConvertToBinaryValues(Db* db) {
+  std::vector<std::pair<std::string, std::string>> records;
+  if (auto accessor = db->QueryAll()) {
+    std::string key, value;
+    while (accessor->GetNextRecord(&key, &value)) {
+      UserDbValue v;
+      if (!UserDbValue::IsBinary(value) && v.Unpack(value))
+        records.push_back({key, v.Pack(true)});
+    }
+  }
+  for (const auto& record : records) {
+    if (!db->Update(record.first, record.second))
+      return false;
+  }
+  LOG(INFO) << records.size() << " values converted.";
+  return db->MetaUpdate("/value_format", UserDb<TreeDb>::value_format);
+}
+
 bool UserDictManager::Synchronize(const std::string& dict_name) {
   LOG(INFO) << "synchronize user dict '" << dict_name << "'.";
   bool success = true;
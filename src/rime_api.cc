@@ -4,6 +4,7 @@
 //
 // 2011-08-09 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
 #include <cstring>
 #include <functional>
 #include <sstream>
@@ -198,38 +199,54 @@ RIME_API void RimeCleanupAllSessions() {
   rime::Service::instance().CleanupAllSessions();
 }
 
-// input
+// allocates the output of RimeGetContext(), to be freed by RimeFreeContext()
+struct CopiedOutput {
+  char* CopyString(const std::string& str) {
+    char* copy = new char[str.length() + 1];
+    std::strcpy(copy, str.c_str());
+    return copy;
+  }
+  char* LendString(const std::string& str) {
+    return CopyString(str);
+  }
+  RimeCandidate* AllocateCandidates(size_t count) {
+    return new RimeCandidate[count];
+  }
+};
 
-RIME_API Bool RimeProcessKey(RimeSessionId session_id, int keycode, int mask) {
-  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
-  if (!session)
-    return False;
-  return Bool(session->ProcessKey(rime::KeyEvent(keycode, mask)));
-}
+// lends the output of the peek functions from the session
+struct LentOutput {
+  rime::OutputArena* arena;
 
-RIME_API Bool RimeCommitComposition(RimeSessionId session_id) {
-  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
-  if (!session)
-    return False;
-  return Bool(session->CommitComposition());
-}
+  char* CopyString(const std::string& str) {
+    return arena->CopyString(str);
+  }
+  // for strings kept by the session until it is modified
+  char* LendString(const std::string& str) {
+    return const_cast<char*>(str.c_str());
+  }
+  RimeCandidate* AllocateCandidates(size_t count) {
+    return arena->Allocate<RimeCandidate>(count);
+  }
+};
 
-RIME_API void RimeClearComposition(RimeSessionId session_id) {
-  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
-  if (!session)
-    return;
-  session->ClearComposition();
+// fills in the candidates in [start, end) of the menu, which are prepared
+template <class Output>
+static void GetCandidates(rime::Menu* menu, size_t start, size_t end,
+                          RimeCandidate* candidates, Output* output) {
+  for (size_t i = start; i < end; ++i) {
+    auto cand = menu->GetCandidateAt(i);
+    RimeCandidate* dest = &candidates[i - start];
+    dest->text = output->LendString(cand->text());
+    std::string comment(cand->comment());
+    dest->comment = comment.empty() ? NULL : output->CopyString(comment);
+  }
 }
 
-// output
-
-RIME_API Bool RimeGetContext(RimeSessionId session_id, RimeContext* context) {
-  if (!context || context->data_size <= 0)
-    return False;
-  RIME_STRUCT_CLEAR(*context);
-  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
-  if (!session)
-    return False;
+// fills in the context of a locked session
+template <class Output>
+static Bool GetContext(rime::Session* session, RimeContext* context,
+                       Output* output) {
   rime::Context *ctx = session->context();
   if (!ctx)
     return False;
@@ -237,16 +254,14 @@ RIME_API Bool RimeGetContext(RimeSessionId session_id, RimeContext* context) {
     rime::Preedit preedit;
     ctx->GetPreedit(&preedit, ctx->get_option("soft_cursor"));
     context->composition.length = preedit.text.length();
-    context->composition.preedit = new char[preedit.text.length() + 1];
-    std::strcpy(context->composition.preedit, preedit.text.c_str());
+    context->composition.preedit = output->CopyString(preedit.text);
     context->composition.cursor_pos = preedit.caret_pos;
     context->composition.sel_start = preedit.sel_start;
     context->composition.sel_end = preedit.sel_end;
     if (RIME_STRUCT_HAS_MEMBER(*context, context->commit_text_preview)) {
       std::string commit_text(ctx->GetCommitText());
       if (!commit_text.empty()) {
-        context->commit_text_preview = new char[commit_text.length() + 1];
-        std::strcpy(context->commit_text_preview, commit_text.c_str());
+        context->commit_text_preview = output->CopyString(commit_text);
       }
     }
   }
@@ -258,33 +273,24 @@ RIME_API Bool RimeGetContext(RimeSessionId session_id, RimeContext* context) {
       page_size = schema->page_size();
     int selected_index = seg.selected_index;
     int page_no = selected_index / page_size;
-    rime::unique_ptr<rime::Page> page(seg.menu->CreatePage(page_size, page_no));
-    if (page) {
+    // candidates are taken from the menu, without creating a page
+    size_t start = page_no * page_size;
+    size_t end = (std::min)(seg.menu->Prepare(start + page_size),
+                            start + page_size);
+    if (start < end) {
       context->menu.page_size = page_size;
       context->menu.page_no = page_no;
-      context->menu.is_last_page = Bool(page->is_last_page);
+      context->menu.is_last_page =
+          Bool(seg.menu->exhausted() && end == seg.menu->candidate_count());
       context->menu.highlighted_candidate_index = selected_index % page_size;
-      int i = 0;
-      context->menu.num_candidates = page->candidates.size();
-      context->menu.candidates = new RimeCandidate[page->candidates.size()];
-      for (const rime::shared_ptr<rime::Candidate> &cand : page->candidates) {
-        RimeCandidate* dest = &context->menu.candidates[i++];
-        dest->text = new char[cand->text().length() + 1];
-        std::strcpy(dest->text, cand->text().c_str());
-        std::string comment(cand->comment());
-        if (!comment.empty()) {
-          dest->comment = new char[comment.length() + 1];
-          std::strcpy(dest->comment, comment.c_str());
-        }
-        else {
-          dest->comment = NULL;
-        }
-      }
+      context->menu.num_candidates = end - start;
+      context->menu.candidates = output->AllocateCandidates(end - start);
+      GetCandidates(seg.menu.get(), start, end, context->menu.candidates,
+                    output);
       if (schema) {
         const std::string& select_keys(schema->select_keys());
         if (!select_keys.empty()) {
-          context->menu.select_keys = new char[select_keys.length() + 1];
-          std::strcpy(context->menu.select_keys, select_keys.c_str());
+          context->menu.select_keys = output->LendString(select_keys);
         }
       }
     }
@@ -292,6 +298,67 @@ RIME_API Bool RimeGetContext(RimeSessionId session_id, RimeContext* context) {
   return True;
 }
 
+// input
+
+RIME_API Bool RimeProcessKey(RimeSessionId session_id, int keycode, int mask) {
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  return Bool(session->ProcessKey(rime::KeyEvent(keycode, mask)));
+}
+
+RIME_API size_t RimeProcessKeys(RimeSessionId session_id,
+                                const RimeKeyEvent* keys,
+                                size_t num_keys,
+                                RimeContext* context) {
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return 0;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  rime::KeySequence key_sequence;
+  for (size_t i = 0; i < num_keys; ++i) {
+    key_sequence.push_back(rime::KeyEvent(keys[i].keycode, keys[i].mask));
+  }
+  size_t handled = session->ProcessKeys(key_sequence, true);
+  if (context && context->data_size > 0) {
+    RIME_STRUCT_CLEAR(*context);
+    CopiedOutput output;
+    GetContext(session.get(), context, &output);
+  }
+  return handled;
+}
+
+RIME_API Bool RimeCommitComposition(RimeSessionId session_id) {
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  return Bool(session->CommitComposition());
+}
+
+RIME_API void RimeClearComposition(RimeSessionId session_id) {
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  session->ClearComposition();
+}
+
+// output
+
+RIME_API Bool RimeGetContext(RimeSessionId session_id, RimeContext* context) {
+  if (!context || context->data_size <= 0)
+    return False;
+  RIME_STRUCT_CLEAR(*context);
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  CopiedOutput output;
+  return GetContext(session.get(), context, &output);
+}
+
 RIME_API Bool RimeFreeContext(RimeContext* context) {
   if (!context || context->data_size <= 0)
     return False;
@@ -316,6 +383,7 @@ RIME_API Bool RimeGetCommit(RimeSessionId session_id, RimeCommit* commit) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   const std::string& commit_text(session->commit_text());
   if (!commit_text.empty()) {
     commit->text = new char[commit_text.length() + 1];
@@ -334,21 +402,16 @@ RIME_API Bool RimeFreeCommit(RimeCommit* commit) {
   return True;
 }
 
-RIME_API Bool RimeGetStatus(RimeSessionId session_id, RimeStatus* status) {
-  if (!status || status->data_size <= 0)
-    return False;
-  RIME_STRUCT_CLEAR(*status);
-  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
-  if (!session)
-    return False;
+// fills in the status of a locked session
+template <class Output>
+static Bool GetStatus(rime::Session* session, RimeStatus* status,
+                      Output* output) {
   rime::Schema *schema = session->schema();
   rime::Context *ctx = session->context();
   if (!schema || !ctx)
     return False;
-  status->schema_id = new char[schema->schema_id().length() + 1];
-  std::strcpy(status->schema_id, schema->schema_id().c_str());
-  status->schema_name = new char[schema->schema_name().length() + 1];
-  std::strcpy(status->schema_name, schema->schema_name().c_str());
+  status->schema_id = output->LendString(schema->schema_id());
+  status->schema_name = output->LendString(schema->schema_name());
   status->is_disabled = rime::Service::instance().disabled();
   status->is_composing = Bool(ctx->IsComposing());
   status->is_ascii_mode = Bool(ctx->get_option("ascii_mode"));
@@ -359,6 +422,18 @@ RIME_API Bool RimeGetStatus(RimeSessionId session_id, RimeStatus* status) {
   return True;
 }
 
+RIME_API Bool RimeGetStatus(RimeSessionId session_id, RimeStatus* status) {
+  if (!status || status->data_size <= 0)
+    return False;
+  RIME_STRUCT_CLEAR(*status);
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  CopiedOutput output;
+  return GetStatus(session.get(), status, &output);
+}
+
 RIME_API Bool RimeFreeStatus(RimeStatus* status) {
   if (!status || status->data_size <= 0)
     return False;
@@ -368,12 +443,77 @@ RIME_API Bool RimeFreeStatus(RimeStatus* status) {
   return True;
 }
 
+RIME_API Bool RimePeekContext(RimeSessionId session_id, RimeContext* context) {
+  if (!context || context->data_size <= 0)
+    return False;
+  RIME_STRUCT_CLEAR(*context);
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  session->context_arena().Reset();
+  LentOutput output{&session->context_arena()};
+  return GetContext(session.get(), context, &output);
+}
+
+RIME_API Bool RimePeekCommit(RimeSessionId session_id, RimeCommit* commit) {
+  if (!commit)
+    return False;
+  RIME_STRUCT_CLEAR(*commit);
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  if (session->commit_text().empty())
+    return False;
+  const std::string& commit_text(session->TakeCommitText());
+  commit->text = const_cast<char*>(commit_text.c_str());
+  return True;
+}
+
+RIME_API Bool RimePeekStatus(RimeSessionId session_id, RimeStatus* status) {
+  if (!status || status->data_size <= 0)
+    return False;
+  RIME_STRUCT_CLEAR(*status);
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  LentOutput output{nullptr};  // nothing to copy
+  return GetStatus(session.get(), status, &output);
+}
+
+RIME_API size_t RimePeekCandidates(RimeSessionId session_id,
+                                   size_t start_index,
+                                   size_t max_count,
+                                   RimeCandidate* candidates) {
+  if (!candidates || max_count == 0)
+    return 0;
+  rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
+  if (!session)
+    return 0;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
+  rime::Context *ctx = session->context();
+  if (!ctx || !ctx->HasMenu())
+    return 0;
+  rime::Menu* menu = ctx->composition()->back().menu.get();
+  size_t end = (std::min)(menu->Prepare(start_index + max_count),
+                          start_index + max_count);
+  if (start_index >= end)
+    return 0;
+  session->candidate_arena().Reset();
+  LentOutput output{&session->candidate_arena()};
+  GetCandidates(menu, start_index, end, candidates, &output);
+  return end - start_index;
+}
+
 // runtime options
 
 RIME_API void RimeSetOption(RimeSessionId session_id, const char* option, Bool value) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return;
@@ -384,6 +524,7 @@ RIME_API Bool RimeGetOption(RimeSessionId session_id, const char* option) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return False;
@@ -394,6 +535,7 @@ RIME_API void RimeSetProperty(RimeSessionId session_id, const char* prop, const
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return;
@@ -405,6 +547,7 @@ RIME_API Bool RimeGetProperty(RimeSessionId session_id, const char* prop,
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return False;
@@ -465,6 +608,7 @@ RIME_API void RimeFreeSchemaList(RimeSchemaList* schema_list) {
 RIME_API Bool RimeGetCurrentSchema(RimeSessionId session_id, char* schema_id, size_t buffer_size) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session) return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Schema* schema = session->schema();
   if (!schema) return False;
   strncpy(schema_id, schema->schema_id().c_str(), buffer_size);
@@ -475,6 +619,7 @@ RIME_API Bool RimeSelectSchema(RimeSessionId session_id, const char* schema_id)
   if (!schema_id) return False;
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session) return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   session->ApplySchema(new rime::Schema(schema_id));
   return True;
 }
@@ -667,14 +812,13 @@ RIME_API Bool RimeSimulateKeySequence(RimeSessionId session_id, const char *key_
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::KeySequence keys;
   if (!keys.Parse(key_sequence)) {
     LOG(ERROR) << "error parsing input: '" << key_sequence << "'";
     return False;
   }
-  for (const rime::KeyEvent& key : keys) {
-    session->ProcessKey(key);
-  }
+  session->ProcessKeys(keys, false);
   return True;
 }
 
@@ -848,6 +992,7 @@ const char* RimeGetInput(RimeSessionId session_id) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return NULL;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return NULL;
@@ -858,6 +1003,7 @@ size_t RimeGetCaretPos(RimeSessionId session_id) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return 0;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return 0;
@@ -868,6 +1014,7 @@ Bool RimeSelectCandidate(RimeSessionId session_id, size_t index) {
   rime::shared_ptr<rime::Session> session(rime::Service::instance().GetSession(session_id));
   if (!session)
     return False;
+  std::lock_guard<std::recursive_mutex> lock(session->mutex());
   rime::Context *ctx = session->context();
   if (!ctx)
     return False;
@@ -950,6 +1097,11 @@ RIME_API RimeApi* rime_get_api() {
     s_api.get_input = &RimeGetInput;
     s_api.get_caret_pos = &RimeGetCaretPos;
     s_api.select_candidate = &RimeSelectCandidate;
+    s_api.process_keys = &RimeProcessKeys;
+    s_api.peek_context = &RimePeekContext;
+    s_api.peek_commit = &RimePeekCommit;
+    s_api.peek_status = &RimePeekStatus;
+    s_api.peek_candidates = &RimePeekCandidates;
   }
   return &s_api;
 }
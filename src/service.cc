@@ -4,8 +4,11 @@
 //
 // 2011-08-08 GONG Chen <chen.sst@gmail.com>
 //
+#include <algorithm>
+#include <vector>
 #include <rime/context.h>
 #include <rime/engine.h>
+#include <rime/key_event.h>
 #include <rime/schema.h>
 #include <rime/service.h>
 
@@ -13,6 +16,44 @@ using namespace std::placeholders;
 
 namespace rime {
 
+void OutputArena::Reset() {
+  used_ = 0;
+  if (blocks_.size() <= 1)
+    return;
+  size_t merged_capacity = capacity();
+  blocks_.clear();
+  blocks_.emplace_back(unique_ptr<char[]>(new char[merged_capacity]),
+                       merged_capacity);
+}
+
+char* OutputArena::AllocateBytes(size_t size, size_t alignment) {
+  size_t offset = (used_ + alignment - 1) / alignment * alignment;
+  if (blocks_.empty() || offset + size > blocks_.back().second) {
+    const size_t kMinBlockSize = 1024;
+    size_t capacity = (std::max)(size, (std::max)(
+        kMinBlockSize, blocks_.empty() ? 0 : blocks_.back().second * 2));
+    blocks_.emplace_back(unique_ptr<char[]>(new char[capacity]), capacity);
+    // operator new[] returns memory aligned for any fundamental type
+    offset = 0;
+  }
+  used_ = offset + size;
+  return blocks_.back().first.get() + offset;
+}
+
+size_t OutputArena::capacity() const {
+  size_t capacity = 0;
+  for (const auto& block : blocks_) {
+    capacity += block.second;
+  }
+  return capacity;
+}
+
+char* OutputArena::CopyString(const std::string& str) {
+  char* ptr = AllocateBytes(str.length() + 1, 1);
+  std::copy(str.c_str(), str.c_str() + str.length() + 1, ptr);
+  return ptr;
+}
+
 Session::Session() {
   engine_.reset(Engine::Create());
   engine_->sink().connect(std::bind(&Session::OnCommit, this, _1));
@@ -25,6 +66,21 @@ bool Session::ProcessKey(const KeyEvent& key_event) {
   return engine_->ProcessKey(key_event);
 }
 
+size_t Session::ProcessKeys(const KeySequence& keys,
+                            bool stop_at_unhandled_key) {
+  Context* ctx = engine_->context();
+  ctx->DeferUpdates();
+  size_t handled = 0;
+  for (const KeyEvent& key_event : keys) {
+    if (engine_->ProcessKey(key_event))
+      ++handled;
+    else if (stop_at_unhandled_key)
+      break;
+  }
+  ctx->ResumeUpdates();
+  return handled;
+}
+
 void Session::Activate() {
   last_active_time_ = time(NULL);
 }
@@ -33,6 +89,12 @@ void Session::ResetCommitText() {
   commit_text_.clear();
 }
 
+const std::string& Session::TakeCommitText() {
+  taken_commit_text_.swap(commit_text_);
+  commit_text_.clear();
+  return taken_commit_text_;
+}
+
 bool Session::CommitComposition() {
   if (!engine_)
     return false;
@@ -78,6 +140,8 @@ void Service::StartService() {
 void Service::StopService() {
   started_ = false;
   CleanupAllSessions();
+  // wait for a running handler; later session notifications are dropped
+  std::lock_guard<std::recursive_mutex> lock(notification_mutex_);
 }
 
 SessionId Service::CreateSession() {
@@ -87,7 +151,9 @@ SessionId Service::CreateSession() {
     auto session = New<Session>();
     session->Activate();
     id = reinterpret_cast<uintptr_t>(session.get());
-    sessions_[id] = session;
+    SessionShard& sessions(shard(id));
+    std::lock_guard<std::mutex> lock(sessions.mutex);
+    sessions.sessions[id] = session;
   }
   catch (const std::exception& ex) {
     LOG(ERROR) << "Error creating session: " << ex.what();
@@ -107,11 +173,18 @@ SessionId Service::CreateSession() {
   return id;
 }
 
+Service::SessionShard& Service::shard(SessionId session_id) {
+  // session ids are addresses of sessions; drop the bits always zero
+  return session_shards_[(session_id >> 4) % kNumSessionShards];
+}
+
 shared_ptr<Session> Service::GetSession(SessionId session_id) {
   if (disabled())
     return nullptr;
-  SessionMap::iterator it = sessions_.find(session_id);
-  if (it != sessions_.end()) {
+  SessionShard& sessions(shard(session_id));
+  std::lock_guard<std::mutex> lock(sessions.mutex);
+  SessionMap::iterator it = sessions.sessions.find(session_id);
+  if (it != sessions.sessions.end()) {
     auto& session = it->second;
     session->Activate();
     return session;
@@ -120,59 +193,82 @@ shared_ptr<Session> Service::GetSession(SessionId session_id) {
 }
 
 bool Service::DestroySession(SessionId session_id) {
-  auto it = sessions_.find(session_id);
-  if (it == sessions_.end())
-    return false;
-  sessions_.erase(it);
+  // the session is disposed of out of the lock, or when the last thread
+  // using it releases it
+  shared_ptr<Session> session;
+  {
+    SessionShard& sessions(shard(session_id));
+    std::lock_guard<std::mutex> lock(sessions.mutex);
+    auto it = sessions.sessions.find(session_id);
+    if (it == sessions.sessions.end())
+      return false;
+    session.swap(it->second);
+    sessions.sessions.erase(it);
+  }
   return true;
 }
 
 void Service::CleanupStaleSessions() {
   time_t now = time(NULL);
-  int count = 0;
-  for (auto it = sessions_.begin(); it != sessions_.end(); ) {
-    if (it->second &&
-        it->second->last_active_time() < now - Session::kLifeSpan) {
-      sessions_.erase(it++);
-      ++count;
-    }
-    else {
-      ++it;
+  std::vector<shared_ptr<Session>> stale_sessions;
+  for (SessionShard& sessions : session_shards_) {
+    std::lock_guard<std::mutex> lock(sessions.mutex);
+    for (auto it = sessions.sessions.begin();
+         it != sessions.sessions.end(); ) {
+      if (it->second &&
+          it->second->last_active_time() < now - Session::kLifeSpan) {
+        stale_sessions.push_back(it->second);
+        sessions.sessions.erase(it++);
+      }
+      else {
+        ++it;
+      }
     }
   }
-  if (count > 0) {
-    LOG(INFO) << "Recycled " << count << " stale sessions.";
+  if (!stale_sessions.empty()) {
+    LOG(INFO) << "Recycled " << stale_sessions.size() << " stale sessions.";
   }
 }
 
 void Service::CleanupAllSessions() {
-  sessions_.clear();
+  for (SessionShard& sessions : session_shards_) {
+    SessionMap disposed;
+    {
+      std::lock_guard<std::mutex> lock(sessions.mutex);
+      disposed.swap(sessions.sessions);
+    }
+  }
 }
 
 void Service::SetNotificationHandler(const NotificationHandler& handler) {
+  std::lock_guard<std::recursive_mutex> lock(notification_mutex_);
   notification_handler_ = handler;
 }
 
 void Service::ClearNotificationHandler() {
+  // waits for a running handler, so none runs after this returns
+  std::lock_guard<std::recursive_mutex> lock(notification_mutex_);
   notification_handler_ = nullptr;
 }
 
 void Service::Notify(SessionId session_id,
                      const std::string& message_type,
                      const std::string& message_value) {
-  if (notification_handler_) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    notification_handler_(session_id,
-                          message_type.c_str(),
-                          message_value.c_str());
+  // handlers are called one at a time; the lock is recursive so that
+  // a handler may call back into the service on the same thread.
+  std::lock_guard<std::recursive_mutex> lock(notification_mutex_);
+  if (session_id != 0 && !started_)
+    return;
+  // a copy, in case the handler replaces itself
+  NotificationHandler handler = notification_handler_;
+  if (handler) {
+    handler(session_id, message_type.c_str(), message_value.c_str());
   }
 }
 
 Service& Service::instance() {
-  static unique_ptr<Service> s_instance;
-  if (!s_instance) {
-    s_instance.reset(new Service);
-  }
+  // initialized once, even if first called from several threads
+  static unique_ptr<Service> s_instance(new Service);
   return *s_instance;
 }
 
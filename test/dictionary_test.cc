@@ -60,11 +60,12 @@ TEST_F(RimeDictionaryTest, PredictiveLookup) {
   rime::DictEntryIterator it;
   dict_->LookupWords(&it, "z", true);
   ASSERT_FALSE(it.exhausted());
-  EXPECT_EQ("\xe5\x92\x8b", it.Peek()->text);  // 咋
+  // the heaviest of the shortest completions comes first
+  EXPECT_EQ("\xe5\x88\x99", it.Peek()->text);  // 则
   ASSERT_EQ(1, it.Peek()->code.size());
   rime::RawCode raw_code;
   ASSERT_TRUE(dict_->Decode(it.Peek()->code, &raw_code));
-  EXPECT_EQ("za", raw_code.ToString());
+  EXPECT_EQ("ze", raw_code.ToString());
 }
 
 TEST_F(RimeDictionaryTest, ScriptLookup) {
@@ -102,3 +103,109 @@ TEST_F(RimeDictionaryTest, ScriptLookup) {
   EXPECT_EQ(9, e3->text.length());
   EXPECT_FALSE(d7.Next());
 }
+
+TEST_F(RimeDictionaryTest, LookupHorizon) {
+  ASSERT_TRUE(dict_->loaded());
+  rime::SyllableGraph g;
+  rime::Syllabifier s;
+  std::string input("shurufa");
+  ASSERT_TRUE(s.BuildSyllableGraph(input, *dict_->prism(), &g) > 0);
+  size_t horizon = 0;
+  auto c = dict_->Lookup(g, 0, 1.0, &horizon);
+  ASSERT_TRUE(bool(c));
+  EXPECT_EQ(7, horizon);
+  horizon = 0;
+  dict_->Lookup(g, 5, 1.0, &horizon);
+  EXPECT_EQ(7, horizon);
+}
+
+TEST_F(RimeDictionaryTest, MergeSortedChunks) {
+  ASSERT_TRUE(dict_->loaded());
+  rime::DictEntryIterator it;
+  dict_->LookupWords(&it, "s", true);
+  it.Sort();
+  size_t count = 0;
+  int last_remaining_code_length = 0;
+  double last_weight = 0.0;
+  while (!it.exhausted()) {
+    auto e = it.Peek();
+    ASSERT_TRUE(bool(e));
+    ASSERT_GE(e->remaining_code_length, last_remaining_code_length);
+    if (count > 0 && e->remaining_code_length == last_remaining_code_length) {
+      EXPECT_LE(e->weight, last_weight);
+    }
+    last_remaining_code_length = e->remaining_code_length;
+    last_weight = e->weight;
+    ++count;
+    it.Next();
+  }
+  EXPECT_LT(1, count);
+  EXPECT_EQ(it.entry_count(), count);
+}
+
+TEST_F(RimeDictionaryTest, PeekEntryView) {
+  ASSERT_TRUE(dict_->loaded());
+  rime::DictEntryIterator it;
+  dict_->LookupWords(&it, "s", true);
+  it.Sort();
+  auto view = it.PeekView();
+  ASSERT_TRUE(bool(view));
+  auto e1 = it.Peek();
+  ASSERT_TRUE(bool(e1));
+  EXPECT_EQ(e1->text, view.text());
+  EXPECT_EQ(e1->weight, view.weight());
+  EXPECT_EQ(e1->remaining_code_length, view.remaining_code_length());
+  std::string text = e1->text;
+  // a kept entry is left intact
+  it.Next();
+  auto e2 = it.Peek();
+  EXPECT_NE(e1, e2);
+  EXPECT_EQ(text, e1->text);
+  // an entry no longer referenced is recycled for the next one
+  rime::DictEntry* recycled = e2.get();
+  e2.reset();
+  it.Next();
+  EXPECT_EQ(recycled, it.Peek().get());
+}
+
+TEST_F(RimeDictionaryTest, FilterEntryView) {
+  ASSERT_TRUE(dict_->loaded());
+  rime::DictEntryIterator it;
+  dict_->LookupWords(&it, "s", true);
+  it.Sort();
+  size_t count = it.entry_count();
+  size_t examined = 0;
+  it.AddFilter([&examined](rime::shared_ptr<rime::DictEntry> e) {
+      ++examined;
+      return e->remaining_code_length <= 1;
+    });
+  size_t accepted = 0;
+  for (auto view = it.PeekView(); view; view = it.PeekView()) {
+    EXPECT_GE(1, view.remaining_code_length());
+    ++accepted;
+    it.Next();
+  }
+  EXPECT_LT(0, accepted);
+  EXPECT_LT(accepted, count);
+  EXPECT_EQ(count, examined);
+}
+
+TEST(RimeDictCompilerTest, RebuildInRequestedFormat) {
+  rime::Dictionary dict(
+      "dictionary_test",
+      rime::New<rime::Table>("dictionary_test_format.table.bin"),
+      rime::New<rime::Prism>("dictionary_test_format.prism.bin"));
+  dict.Remove();
+  const bool compact_options[] = {false, true, true, false};
+  for (bool compact : compact_options) {
+    rime::DictCompiler dict_compiler(&dict);
+    dict_compiler.set_compact_table(compact);
+    ASSERT_TRUE(dict_compiler.Compile(""));
+    ASSERT_TRUE(dict.table()->Load());
+    EXPECT_DOUBLE_EQ(compact ? rime::Table::kCompactFormatVersion :
+                     rime::Table::kDefaultFormatVersion,
+                     dict.table()->format_version());
+    dict.table()->Close();
+  }
+  dict.Remove();
+}
@@ -0,0 +1,238 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <map>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/composition.h>
+#include <rime/config.h>
+#include <rime/context.h>
+#include <rime/engine.h>
+#include <rime/key_event.h>
+#include <rime/menu.h>
+#include <rime/schema.h>
+#include <rime/segmentation.h>
+#include <rime/segmentor.h>
+#include <rime/ticket.h>
+#include <rime/translation.h>
+#include <rime/translator.h>
+
+using namespace rime;
+
+// splits input into words and commas
+class CommaSegmentor : public Segmentor {
+ public:
+  explicit CommaSegmentor(const Ticket& ticket) : Segmentor(ticket) {}
+
+  bool Proceed(Segmentation* segmentation) {
+    const std::string& input(segmentation->input());
+    size_t start = segmentation->GetCurrentStartPosition();
+    size_t end = start;
+    if (input[start] == ',') {
+      ++end;
+    }
+    else {
+      while (end < input.length() && input[end] != ',')
+        ++end;
+    }
+    Segment segment(start, end);
+    segment.tags.insert(input[start] == ',' ? "comma" : "word");
+    segmentation->AddSegment(segment);
+    return false;
+  }
+};
+
+// counts the queries for each input
+class CountingTranslator : public Translator {
+ public:
+  explicit CountingTranslator(const Ticket& ticket) : Translator(ticket) {}
+
+  shared_ptr<Translation> Query(const std::string& input,
+                                const Segment& segment,
+                                std::string* prompt) {
+    ++queries[input];
+    return New<UniqueTranslation>(
+        New<SimpleCandidate>("test", segment.start, segment.end, input));
+  }
+
+  static std::map<std::string, int> queries;
+};
+
+std::map<std::string, int> CountingTranslator::queries;
+
+class RimeEngineTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Registry& r = Registry::instance();
+    r.Register("test_comma_segmentor",
+               new Component<CommaSegmentor>);
+    r.Register("test_counting_translator",
+               new Component<CountingTranslator>);
+    std::istringstream yaml(
+        "engine:\n"
+        "  segmentors: [test_comma_segmentor]\n"
+        "  translators: [test_counting_translator]\n");
+    Config* config = new Config;
+    ASSERT_TRUE(config->LoadFromStream(yaml));
+    engine_.reset(Engine::Create());
+    engine_->ApplySchema(new Schema("engine_test", config));
+    CountingTranslator::queries.clear();
+  }
+  virtual void TearDown() {
+    engine_.reset();
+    Registry& r = Registry::instance();
+    r.Unregister("test_comma_segmentor");
+    r.Unregister("test_counting_translator");
+  }
+
+  unique_ptr<Engine> engine_;
+};
+
+TEST_F(RimeEngineTest, KeepUnchangedSegments) {
+  Context* ctx = engine_->context();
+  ctx->set_input("ab,cd");
+  ASSERT_EQ(3, ctx->composition()->size());
+  EXPECT_EQ(1, CountingTranslator::queries["ab"]);
+  EXPECT_EQ(1, CountingTranslator::queries[","]);
+  EXPECT_EQ(1, CountingTranslator::queries["cd"]);
+  auto menu = ctx->composition()->at(0).menu;
+  ctx->PushInput('e');
+  ASSERT_EQ(3, ctx->composition()->size());
+  EXPECT_EQ(menu, ctx->composition()->at(0).menu);
+  EXPECT_EQ(1, CountingTranslator::queries["ab"]);
+  EXPECT_EQ(1, CountingTranslator::queries[","]);
+  EXPECT_EQ(1, CountingTranslator::queries["cde"]);
+}
+
+TEST_F(RimeEngineTest, ReuseMenuOfReopenedSegment) {
+  Context* ctx = engine_->context();
+  ctx->set_input("ab");
+  ASSERT_TRUE(ctx->ConfirmCurrentSelection());
+  EXPECT_EQ(Segment::kConfirmed, ctx->composition()->front().status);
+  auto menu = ctx->composition()->front().menu;
+  ASSERT_TRUE(ctx->ReopenPreviousSegment());
+  EXPECT_EQ(Segment::kGuess, ctx->composition()->back().status);
+  EXPECT_EQ(menu, ctx->composition()->back().menu);
+  EXPECT_EQ(1, CountingTranslator::queries["ab"]);
+}
+
+TEST_F(RimeEngineTest, RetranslateRefreshedSegments) {
+  Context* ctx = engine_->context();
+  ctx->set_input("ab");
+  ASSERT_EQ(1, CountingTranslator::queries["ab"]);
+  ctx->set_option("test_option", true);
+  EXPECT_EQ(2, CountingTranslator::queries["ab"]);
+  ctx->set_option("test_option", false);
+  EXPECT_EQ(3, CountingTranslator::queries["ab"]);
+}
+
+TEST_F(RimeEngineTest, RestoreComposedStates) {
+  Context* ctx = engine_->context();
+  ctx->PushInput('a');
+  auto menu = ctx->composition()->back().menu;
+  ctx->PushInput('b');
+  ctx->PushInput('c');
+  EXPECT_EQ(1, CountingTranslator::queries["abc"]);
+  // backspace
+  ctx->PopInput(1);
+  EXPECT_EQ(1, CountingTranslator::queries["ab"]);
+  // caret movement
+  ctx->set_caret_pos(1);
+  EXPECT_EQ(1, CountingTranslator::queries["a"]);
+  EXPECT_EQ(menu, ctx->composition()->back().menu);
+  ctx->set_caret_pos(2);
+  EXPECT_EQ(1, CountingTranslator::queries["ab"]);
+  EXPECT_EQ("ab", ctx->composition()->input());
+}
+
+TEST_F(RimeEngineTest, KeepSelectionWhenRestoringComposedState) {
+  Context* ctx = engine_->context();
+  ctx->set_input("ab,");
+  ctx->set_input("ab,c");
+  ASSERT_EQ(3, ctx->composition()->size());
+  ctx->composition()->front().status = Segment::kSelected;
+  ctx->PopInput(1);
+  // the composition of "ab," did not have "ab" selected
+  EXPECT_EQ(Segment::kSelected, ctx->composition()->front().status);
+}
+
+TEST_F(RimeEngineTest, ForgetComposedStatesOnDelete) {
+  Context* ctx = engine_->context();
+  ctx->set_input("a");
+  ctx->set_input("ab");
+  ASSERT_TRUE(ctx->DeleteCurrentSelection());
+  ctx->PopInput(1);
+  EXPECT_EQ(2, CountingTranslator::queries["a"]);
+}
+
+TEST_F(RimeEngineTest, DeferUpdates) {
+  Context* ctx = engine_->context();
+  ctx->DeferUpdates();
+  ctx->PushInput('a');
+  ctx->PushInput('b');
+  ctx->PushInput('c');
+  EXPECT_TRUE(CountingTranslator::queries.empty());
+  // looking into the composition brings it up to date
+  EXPECT_TRUE(ctx->HasMenu());
+  EXPECT_EQ(1, CountingTranslator::queries["abc"]);
+  ctx->PushInput('d');
+  ctx->PushInput('e');
+  ctx->ResumeUpdates();
+  EXPECT_EQ(1, CountingTranslator::queries["abcde"]);
+  EXPECT_EQ(0, CountingTranslator::queries.count("abcd"));
+  EXPECT_EQ("abcde", ctx->composition()->input());
+}
+
+TEST_F(RimeEngineTest, ConfirmPreviousSelectionWithUpdatesDeferred) {
+  Context* ctx = engine_->context();
+  ctx->set_input("ab,c");
+  ctx->composition()->front().status = Segment::kSelected;
+  ctx->DeferUpdates();
+  ctx->PushInput('d');
+  EXPECT_TRUE(ctx->ConfirmPreviousSelection());
+  EXPECT_EQ(0, CountingTranslator::queries.count("cd"));
+  ctx->ResumeUpdates();
+  EXPECT_EQ(Segment::kConfirmed, ctx->composition()->front().status);
+  EXPECT_EQ(1, CountingTranslator::queries["cd"]);
+  // the selected segment is to be disposed of, as its input is changed
+  ctx->composition()->front().status = Segment::kSelected;
+  ctx->DeferUpdates();
+  ctx->set_input("a");
+  EXPECT_FALSE(ctx->ConfirmPreviousSelection());
+  ctx->ResumeUpdates();
+  EXPECT_EQ(Segment::kGuess, ctx->composition()->front().status);
+}
+
+TEST_F(RimeEngineTest, DeferUpdatesThroughProcessors) {
+  std::istringstream yaml(
+      "engine:\n"
+      "  processors: [key_binder, speller]\n"
+      "  segmentors: [test_comma_segmentor]\n"
+      "  translators: [test_counting_translator]\n"
+      "key_binder:\n"
+      "  bindings:\n"
+      "    - {when: has_menu, accept: minus, send: Page_Up}\n"
+      "    - {when: composing, accept: Control+b, send: b}\n");
+  Config* config = new Config;
+  ASSERT_TRUE(config->LoadFromStream(yaml));
+  engine_->ApplySchema(new Schema("engine_test", config));
+  Context* ctx = engine_->context();
+  KeySequence keys;
+  ASSERT_TRUE(keys.Parse("ab{Control+b}a"));
+  // as Session::ProcessKeys() does
+  ctx->DeferUpdates();
+  for (const KeyEvent& key_event : keys) {
+    EXPECT_TRUE(engine_->ProcessKey(key_event));
+  }
+  EXPECT_TRUE(CountingTranslator::queries.empty());
+  ctx->ResumeUpdates();
+  EXPECT_EQ("abba", ctx->input());
+  EXPECT_EQ(1, CountingTranslator::queries.size());
+  EXPECT_EQ(1, CountingTranslator::queries["abba"]);
+}
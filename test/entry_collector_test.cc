@@ -0,0 +1,103 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <algorithm>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <rime/dict/dict_settings.h>
+#include <rime/dict/entry_collector.h>
+
+using namespace rime;
+
+static const char* kDictFile = "entry_collector_test.dict.yaml";
+
+class RimeEntryCollectorTest : public ::testing::Test {
+ public:
+  virtual void SetUp() {
+    std::ofstream out(kDictFile);
+    out << "---\n"
+        << "name: entry_collector_test\n"
+        << "version: \"1.0\"\n"
+        << "...\n";
+    for (char x = 'a'; x <= 'z'; ++x) {
+      out << x << "\tk" << x << "\t" << int(x) << "\n";
+    }
+    out << "ab\tkab\t%50\n";
+    // plenty of phrases for worker threads to encode
+    for (char x = 'a'; x <= 'z'; ++x) {
+      for (char y = 'a'; y <= 'z'; ++y) {
+        out << x << y << x << "\n"
+            << y << x << "\t\t" << int(y) << "\n";
+      }
+    }
+  }
+
+ protected:
+  std::vector<std::string> Collect(int num_threads) {
+    std::ifstream fin(kDictFile);
+    DictSettings settings;
+    EXPECT_TRUE(settings.LoadDictHeader(fin));
+    EntryCollector collector;
+    collector.num_threads = num_threads;
+    collector.Configure(&settings);
+    collector.Collect(std::vector<std::string>{kDictFile});
+    std::vector<std::string> result;
+    for (const auto& e : collector.entries) {
+      result.push_back(e.text + "\t" + e.raw_code.ToString() + "\t" +
+                       std::to_string(e.weight));
+    }
+    return result;
+  }
+};
+
+TEST_F(RimeEntryCollectorTest, CollectInParallel) {
+  auto serial = Collect(1);
+  // 27 coded entries, 1352 phrases to encode, two of which ('aba', 'bab')
+  // can also be encoded with the word 'ab'
+  EXPECT_EQ(27 + 1352 + 2, serial.size());
+  // phrases are encoded in the order of the dict file, then each with
+  // the longest words first
+  auto aba = std::find(serial.begin(), serial.end(), "aba\tkab ka\t0.000000");
+  ASSERT_TRUE(aba != serial.end());
+  EXPECT_EQ("aba\tka kb ka\t0.000000", *++aba);
+  EXPECT_EQ("ba\tkb ka\t98.000000", *++aba);
+  EXPECT_EQ(serial, Collect(4));
+}
+
+TEST_F(RimeEntryCollectorTest, PresetVocabulary) {
+  {
+    std::ofstream out("essay.txt");
+    out << "ab\t10\n"
+        << "ba\t20\n"
+        << "zz\t30\n";
+  }
+  {
+    std::ofstream out(kDictFile);
+    out << "---\n"
+        << "name: entry_collector_test\n"
+        << "version: \"1.0\"\n"
+        << "use_preset_vocabulary: true\n"
+        << "...\n"
+        << "a\tka\n"
+        << "b\tkb\n"
+        << "z\tkz\n"
+        << "ab\tkab\n"
+        << "ba\n";
+  }
+  auto result = Collect(1);
+  // phrases of the preset vocabulary are added unless defined in the dict
+  EXPECT_EQ((std::vector<std::string>{
+        "a\tka\t0.000000",
+        "b\tkb\t0.000000",
+        "z\tkz\t0.000000",
+        "ab\tkab\t10.000000",
+        "ba\tkb ka\t20.000000",
+        "zz\tkz kz\t30.000000",
+      }), result);
+  boost::filesystem::remove("essay.txt");
+  boost::filesystem::remove("essay.bin");
+}
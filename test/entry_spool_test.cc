@@ -0,0 +1,61 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <gtest/gtest.h>
+#include <rime/dict/entry_collector.h>
+#include <rime/dict/entry_spool.h>
+
+using namespace rime;
+
+static std::vector<std::string> PutAndGet(size_t memory_budget,
+                                          size_t* num_runs) {
+  const char* codes[] = { "b a", "a", "c", "a b", "b", "a", "a c d e" };
+  EntrySpool spool("entry_spool_test", memory_budget);
+  for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++i) {
+    RawDictEntry e;
+    e.raw_code.FromString(codes[i]);
+    e.text = std::to_string(i);
+    e.weight = double(i);
+    EXPECT_TRUE(spool.Put(e));
+  }
+  EXPECT_TRUE(spool.Rewind());
+  *num_runs = spool.num_runs();
+  std::vector<std::string> result;
+  RawDictEntry e;
+  while (spool.Get(&e)) {
+    result.push_back(e.raw_code.ToString() + ":" + e.text);
+  }
+  return result;
+}
+
+TEST(RimeEntrySpoolTest, SpillAndMerge) {
+  size_t num_runs = 0;
+  auto in_memory = PutAndGet(EntrySpool::kDefaultMemoryBudget, &num_runs);
+  EXPECT_EQ(0, num_runs);
+  // ordered by first syllable, then in the order put
+  std::vector<std::string> expected = {
+    "a:1", "a b:3", "a:5", "a c d e:6", "b a:0", "b:4", "c:2"
+  };
+  EXPECT_EQ(expected, in_memory);
+  // every entry exceeds the budget, making a run of its own
+  auto spilled = PutAndGet(1, &num_runs);
+  EXPECT_EQ(7, num_runs);
+  EXPECT_EQ(expected, spilled);
+}
+
+TEST(RimeEntrySpoolTest, FailToSpill) {
+  // temporary files cannot be created in a missing directory
+  EntrySpool spool("no_such_dir/entry_spool_test", 1);
+  RawDictEntry e;
+  e.raw_code.FromString("a");
+  e.text = "a";
+  e.weight = 1.0;
+  EXPECT_FALSE(spool.Put(e));
+  // takes no more entries
+  EXPECT_FALSE(spool.Put(e));
+  EXPECT_EQ(0, spool.num_runs());
+  EXPECT_FALSE(spool.Rewind());
+}
@@ -0,0 +1,62 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <rime/algo/manifest.h>
+#include <rime/algo/utilities.h>
+
+using namespace rime;
+
+static const char* kManifestFile = "manifest_test.manifest";
+static const char* kInputFile = "manifest_test.txt";
+
+// writes a file as if it had been modified a while ago
+static void WriteFile(const std::string& file_name,
+                      const std::string& content) {
+  {
+    std::ofstream out(file_name.c_str());
+    out << content;
+  }
+  boost::filesystem::last_write_time(file_name, std::time(NULL) - 100);
+}
+
+TEST(RimeManifestTest, Checksum) {
+  boost::filesystem::remove(kManifestFile);
+  WriteFile(kInputFile, "abc");
+  Manifest manifest(kManifestFile);
+  uint32_t checksum = manifest.Checksum({kInputFile});
+  EXPECT_EQ(Checksum(kInputFile), checksum);
+  ASSERT_TRUE(manifest.Save());
+  // recorded checksum is reused
+  Manifest reloaded(kManifestFile);
+  EXPECT_EQ(checksum, reloaded.Checksum({kInputFile}));
+  WriteFile(kInputFile, "abcd");
+  EXPECT_EQ(Checksum(kInputFile), reloaded.Checksum({kInputFile}));
+  EXPECT_NE(checksum, reloaded.Checksum({kInputFile}));
+}
+
+TEST(RimeManifestTest, UpToDate) {
+  boost::filesystem::remove(kManifestFile);
+  WriteFile(kInputFile, "abc");
+  Manifest manifest(kManifestFile);
+  EXPECT_FALSE(manifest.IsUpToDate("task"));
+  manifest.Record("task", {kInputFile, "nonexistent_file"});
+  EXPECT_TRUE(manifest.IsUpToDate("task"));
+  ASSERT_TRUE(manifest.Save());
+  Manifest reloaded(kManifestFile);
+  EXPECT_TRUE(reloaded.IsUpToDate("task"));
+  WriteFile(kInputFile, "abcd");
+  EXPECT_FALSE(reloaded.IsUpToDate("task"));
+  // a file just modified is not trusted to stay the same
+  {
+    std::ofstream out(kInputFile);
+    out << "abc";
+  }
+  reloaded.Record("task", {kInputFile});
+  EXPECT_FALSE(reloaded.IsUpToDate("task"));
+}
@@ -0,0 +1,46 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <gtest/gtest.h>
+#include <rime/dict/preset_vocabulary.h>
+
+using namespace rime;
+
+TEST(RimeVocabularyBinTest, BuildAndLoad) {
+  const uint32_t kChecksum = 0xbeef;
+  {
+    VocabularyBin bin("vocabulary_bin_test.bin");
+    bin.Remove();
+    std::vector<std::pair<std::string, double>> phrases = {
+      {"a", 10.0},
+      {"ab", 2.5},
+      {"b", 0.0},
+    };
+    ASSERT_TRUE(bin.Build(phrases, kChecksum));
+    ASSERT_TRUE(bin.Save());
+  }
+  VocabularyBin bin("vocabulary_bin_test.bin");
+  ASSERT_TRUE(bin.Load());
+  EXPECT_EQ(kChecksum, bin.source_file_checksum());
+  ASSERT_EQ(3, bin.size());
+  double weight = -1.0;
+  EXPECT_TRUE(bin.GetWeight("ab", &weight));
+  EXPECT_EQ(2.5, weight);
+  EXPECT_FALSE(bin.GetWeight("c", &weight));
+  StringId id = kInvalidStringId;
+  EXPECT_TRUE(bin.GetPhraseId("ab", &id));
+  EXPECT_GT(3, id);
+  EXPECT_FALSE(bin.GetPhraseId("c", &id));
+  // phrases are kept in order of text
+  std::string phrase;
+  EXPECT_TRUE(bin.GetPhrase(0, &phrase, &weight));
+  EXPECT_EQ("a", phrase);
+  EXPECT_EQ(10.0, weight);
+  EXPECT_TRUE(bin.GetPhrase(2, &phrase, &weight));
+  EXPECT_EQ("b", phrase);
+  EXPECT_EQ(0.0, weight);
+  EXPECT_FALSE(bin.GetPhrase(3, &phrase, &weight));
+}
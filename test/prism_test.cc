@@ -92,3 +92,42 @@ TEST_F(RimePrismTest, ExpandSearch) {
   EXPECT_EQ(result[2].value, 3);  // goodbye
   EXPECT_EQ(result[2].length, 7);  // goodbye
 }
+
+TEST_F(RimePrismTest, ExpandSearchWithCompletionIndex) {
+  std::set<std::string> keyset;
+  keyset.insert("good");       // 0
+  keyset.insert("goodbye");    // 1
+  keyset.insert("google");     // 2
+  keyset.insert("macrosoft");  // 3
+  keyset.insert("microsoft");  // 4
+  std::vector<double> weights{1.0, 1.0, 1.0, 0.5, 2.0};
+  Prism prism("prism_test.bin");
+  prism.Remove();
+  ASSERT_TRUE(prism.Build(keyset, NULL, 0, 0, &weights));
+  ASSERT_TRUE(prism.Save());
+  ASSERT_TRUE(prism.Load());
+
+  std::vector<Prism::Match> result;
+  prism.ExpandSearch("goo", &result, 10);
+  // still ordered by length asc.
+  ASSERT_EQ(result.size(), 3);
+  EXPECT_EQ(result[0].value, 0);  // good
+  EXPECT_EQ(result[0].length, 4);
+  EXPECT_EQ(result[1].value, 2);  // google
+  EXPECT_EQ(result[1].length, 6);
+  EXPECT_EQ(result[2].value, 1);  // goodbye
+  EXPECT_EQ(result[2].length, 7);
+
+  // keys of equal length are ordered by weight desc.
+  prism.ExpandSearch("m", &result, 10);
+  ASSERT_EQ(result.size(), 2);
+  EXPECT_EQ(result[0].value, 4);  // microsoft
+  EXPECT_EQ(result[1].value, 3);  // macrosoft
+
+  prism.ExpandSearch("m", &result, 1);
+  ASSERT_EQ(result.size(), 1);
+  EXPECT_EQ(result[0].value, 4);  // microsoft
+
+  prism.ExpandSearch("x", &result, 10);
+  EXPECT_TRUE(result.empty());
+}
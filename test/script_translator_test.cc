@@ -0,0 +1,114 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/config.h>
+#include <rime/engine.h>
+#include <rime/schema.h>
+#include <rime/segmentation.h>
+#include <rime/ticket.h>
+#include <rime/translation.h>
+#include <rime/dict/dictionary.h>
+#include <rime/dict/dict_compiler.h>
+#include <rime/gear/script_translator.h>
+
+using namespace rime;
+
+class RimeScriptTranslatorTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    if (!compiled_) {
+      Dictionary dict("dictionary_test",
+                      New<Table>("dictionary_test.table.bin"),
+                      New<Prism>("dictionary_test.prism.bin"));
+      DictCompiler dict_compiler(&dict);
+      ASSERT_TRUE(dict_compiler.Compile(""));
+      compiled_ = true;
+    }
+    engine_.reset(Engine::Create());
+    engine_->ApplySchema(NewSchema(true));
+    incremental_.reset(new ScriptTranslator(Ticket(engine_.get(),
+                                                   "translator")));
+    ASSERT_TRUE(incremental_->enable_incremental_lookup());
+    fresh_engine_.reset(Engine::Create());
+    fresh_engine_->ApplySchema(NewSchema(false));
+    fresh_.reset(new ScriptTranslator(Ticket(fresh_engine_.get(),
+                                             "translator")));
+  }
+  virtual void TearDown() {
+    incremental_.reset();
+    fresh_.reset();
+    engine_.reset();
+    fresh_engine_.reset();
+  }
+
+  Schema* NewSchema(bool enable_incremental_lookup) {
+    std::istringstream yaml(
+        std::string("translator:\n"
+                    "  dictionary: dictionary_test\n"
+                    "  enable_user_dict: false\n"
+                    "  enable_incremental_lookup: ") +
+        (enable_incremental_lookup ? "true" : "false") + "\n");
+    Config* config = new Config;
+    config->LoadFromStream(yaml);
+    return new Schema("script_translator_test", config);
+  }
+
+  static std::vector<std::string> Translate(ScriptTranslator* translator,
+                                            const std::string& input) {
+    const size_t kMaxCandidates = 50;
+    std::vector<std::string> result;
+    Segment segment(0, input.length());
+    segment.tags.insert("abc");
+    std::string prompt;
+    auto translation = translator->Query(input, segment, &prompt);
+    while (translation && !translation->exhausted() &&
+           result.size() < kMaxCandidates) {
+      auto cand = translation->Peek();
+      std::ostringstream line;
+      line << cand->text() << " [" << cand->start() << ", " << cand->end()
+           << ") " << cand->quality() << " " << cand->preedit();
+      result.push_back(line.str());
+      translation->Next();
+    }
+    return result;
+  }
+
+  static bool compiled_;
+  unique_ptr<Engine> engine_;
+  unique_ptr<Engine> fresh_engine_;
+  unique_ptr<ScriptTranslator> incremental_;
+  unique_ptr<ScriptTranslator> fresh_;
+};
+
+bool RimeScriptTranslatorTest::compiled_ = false;
+
+TEST_F(RimeScriptTranslatorTest, IncrementalLookup) {
+  const std::string text("babaibabanbei");
+  std::vector<std::string> inputs;
+  // type the text, then backspace
+  for (size_t i = 1; i <= text.length(); ++i) {
+    inputs.push_back(text.substr(0, i));
+  }
+  for (size_t i = text.length() - 1; i > 0; --i) {
+    inputs.push_back(text.substr(0, i));
+  }
+  for (const auto& input : inputs) {
+    auto expected = Translate(fresh_.get(), input);
+    ASSERT_FALSE(expected.empty()) << input;
+    EXPECT_EQ(expected, Translate(incremental_.get(), input)) << input;
+  }
+  const auto& stats(incremental_->lookup_stats());
+  EXPECT_EQ(0, fresh_->lookup_stats().reused);
+  EXPECT_EQ(fresh_->lookup_stats().lookups, stats.lookups);
+  // a good part of the lookups are reused as the input is edited
+  EXPECT_LT(stats.lookups / 4, stats.reused);
+}
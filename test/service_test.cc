@@ -0,0 +1,269 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <rime/config.h>
+#include <rime/context.h>
+#include <rime/schema.h>
+#include <rime/service.h>
+#include <rime/dict/dict_compiler.h>
+#include <rime/dict/dictionary.h>
+#include <rime/dict/tree_db.h>
+#include <rime/dict/user_db.h>
+#include <rime_api.h>
+
+using namespace rime;
+
+static Schema* NewDictionarySchema(const std::string& translator) {
+  std::istringstream yaml(
+      "engine:\n"
+      "  segmentors: [abc_segmentor, fallback_segmentor]\n"
+      "  translators: [" + translator + "]\n"
+      "  filters: [reverse_lookup_filter]\n"
+      "translator:\n"
+      "  dictionary: dictionary_test\n"
+      "  user_dict: service_test\n"
+      "  enable_user_dict_index: true\n"
+      "reverse_lookup:\n"
+      "  dictionary: dictionary_test\n");
+  Config* config = new Config;
+  config->LoadFromStream(yaml);
+  return new Schema("service_test", config);
+}
+
+TEST(RimeServiceTest, ConcurrentSessions) {
+  const int kNumThreads = 8;
+  const int kNumCommits = 50;
+  const std::vector<std::string> kSyllables{
+    "ba", "bai", "ban", "bang", "bao", "ben", "bei", "bi",
+  };
+  Dictionary dict("dictionary_test",
+                  New<Table>("dictionary_test.table.bin"),
+                  New<Prism>("dictionary_test.prism.bin"));
+  DictCompiler dict_compiler(&dict);
+  ASSERT_TRUE(dict_compiler.Compile(""));
+  {
+    auto db = New<UserDb<TreeDb>>("service_test");
+    if (db->Exists())
+      db->Remove();
+  }
+  Service& service(Service::instance());
+  service.StartService();
+  std::atomic<int> failures{0};
+  std::atomic<bool> done{false};
+  std::mutex committed_mutex;
+  std::set<std::string> committed;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      SessionId id = service.CreateSession();
+      auto session = service.GetSession(id);
+      if (!session) {
+        ++failures;
+        return;
+      }
+      // sessions share the dictionary, the user dict and its write queue
+      session->ApplySchema(NewDictionarySchema(
+          t % 2 == 0 ? "script_translator" : "table_translator"));
+      for (int i = 0; i < kNumCommits; ++i) {
+        auto session = service.GetSession(id);
+        if (!session) {
+          ++failures;
+          return;
+        }
+        std::lock_guard<std::recursive_mutex> lock(session->mutex());
+        Context* ctx = session->context();
+        ctx->set_option("test_option", i % 2 == 0);
+        const std::string& input(kSyllables[(t + i) % kSyllables.size()]);
+        ctx->PushInput(input);
+        std::string text = ctx->GetCommitText();
+        if (text.empty() || text == input) {
+          ++failures;
+          continue;
+        }
+        // confirmed, so that the commit is learnt
+        if (!ctx->Select(0) || !ctx->Commit())
+          ++failures;
+        std::lock_guard<std::mutex> committed_lock(committed_mutex);
+        committed.insert(text);
+      }
+      if (!service.DestroySession(id))
+        ++failures;
+    }));
+  }
+  // sessions created and destroyed meanwhile
+  std::thread churn([&]() {
+    while (!done) {
+      SessionId id = service.CreateSession();
+      service.GetSession(id + 1);
+      service.CleanupStaleSessions();
+      service.DestroySession(id);
+    }
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  done = true;
+  churn.join();
+  EXPECT_EQ(0, failures);
+  service.StopService();
+  // every committed word has been learnt, once the write queue is flushed
+  auto db = New<UserDb<TreeDb>>("service_test");
+  ASSERT_TRUE(db->OpenReadOnly());
+  std::set<std::string> learnt;
+  auto accessor = db->QueryAll();
+  std::string key, value;
+  while (accessor->GetNextRecord(&key, &value)) {
+    size_t tab = key.find('\t');
+    if (tab != std::string::npos)
+      learnt.insert(key.substr(tab + 1));
+  }
+  db->Close();
+  EXPECT_FALSE(committed.empty());
+  for (const auto& text : committed) {
+    EXPECT_EQ(1, learnt.count(text)) << text;
+  }
+}
+
+TEST(RimeServiceTest, NotificationHandlerCallingBack) {
+  Service& service(Service::instance());
+  int count = 0;
+  service.SetNotificationHandler(
+      [&service, &count](SessionId session_id,
+                         const char* message_type,
+                         const char* message_value) {
+        if (++count == 1)
+          service.Notify(session_id, message_type, "again");
+        else
+          service.ClearNotificationHandler();
+      });
+  service.Notify(0, "test", "once");
+  EXPECT_EQ(2, count);
+  service.Notify(0, "test", "cleared");
+  EXPECT_EQ(2, count);
+}
+
+TEST(RimeServiceTest, NotificationHandlerSerialized) {
+  const int kNumThreads = 4;
+  Service& service(Service::instance());
+  std::atomic<int> running{0};
+  std::atomic<int> overlaps{0};
+  std::atomic<int> count{0};
+  service.SetNotificationHandler(
+      [&](SessionId, const char*, const char*) {
+        if (++running > 1)
+          ++overlaps;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ++count;
+        --running;
+      });
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&service]() {
+      for (int i = 0; i < 20; ++i)
+        service.Notify(0, "test", "concurrent");
+    }));
+  }
+  while (count == 0) {
+    std::this_thread::yield();
+  }
+  // returns only after the running handler has finished
+  service.ClearNotificationHandler();
+  EXPECT_EQ(0, running);
+  int seen = count;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(seen, count);
+  EXPECT_EQ(0, overlaps);
+}
+
+TEST(RimeServiceTest, OutputArena) {
+  OutputArena arena;
+  std::vector<char*> strings;
+  // enough to take several blocks
+  for (int i = 0; i < 1000; ++i) {
+    strings.push_back(arena.CopyString(std::to_string(i)));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(std::to_string(i), strings[i]);
+  }
+  int* numbers = arena.Allocate<int>(3);
+  EXPECT_EQ(0, numbers[0]);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(numbers) % alignof(int));
+  size_t capacity = arena.capacity();
+  arena.Reset();
+  EXPECT_EQ(capacity, arena.capacity());
+  // reuses the merged block, allocating strings one after another
+  char* first = arena.CopyString("0");
+  strings[0] = first;
+  for (int i = 1; i < 1000; ++i) {
+    strings[i] = arena.CopyString(std::to_string(i));
+    EXPECT_EQ(strings[i - 1] + std::to_string(i - 1).length() + 1,
+              strings[i]);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_LE(first, strings[i]);
+    EXPECT_GE(first + capacity,
+              strings[i] + std::to_string(i).length() + 1);
+  }
+  EXPECT_EQ(capacity, arena.capacity());
+}
+
+TEST(RimeServiceTest, PeekOutput) {
+  Service& service(Service::instance());
+  service.StartService();
+  SessionId id = service.CreateSession();
+  ASSERT_NE(kInvalidSessionId, id);
+  auto session = service.GetSession(id);
+  std::istringstream yaml(
+      "engine:\n"
+      "  segmentors: [fallback_segmentor]\n"
+      "  translators: [echo_translator]\n");
+  Config* config = new Config;
+  ASSERT_TRUE(config->LoadFromStream(yaml));
+  session->ApplySchema(new Schema("service_test", config));
+  session->context()->PushInput("ab");
+
+  RIME_STRUCT(RimeContext, context);
+  ASSERT_TRUE(RimePeekContext(id, &context));
+  EXPECT_STREQ("ab", context.composition.preedit);
+  EXPECT_EQ(2, context.composition.length);
+  const char* preedit = context.composition.preedit;
+  session->context()->PushInput("c");
+  ASSERT_TRUE(RimePeekContext(id, &context));
+  EXPECT_STREQ("abc", context.composition.preedit);
+  // in the same place, without allocating memory
+  EXPECT_EQ(preedit, context.composition.preedit);
+
+  RIME_STRUCT(RimeStatus, status);
+  ASSERT_TRUE(RimePeekStatus(id, &status));
+  EXPECT_EQ(session->schema()->schema_id().c_str(), status.schema_id);
+  EXPECT_TRUE(status.is_composing);
+
+  RimeCommit commit = {0};
+  session->ResetCommitText();
+  EXPECT_FALSE(RimePeekCommit(id, &commit));
+  session->CommitComposition();
+  ASSERT_TRUE(RimePeekCommit(id, &commit));
+  EXPECT_STREQ("abc", commit.text);
+  EXPECT_FALSE(RimePeekCommit(id, &commit));
+
+  session->context()->PushInput("de");
+  RimeCandidate candidates[5];
+  ASSERT_EQ(1, RimePeekCandidates(id, 0, 5, candidates));
+  EXPECT_STREQ("de", candidates[0].text);
+  EXPECT_EQ(0, RimePeekCandidates(id, 1, 5, candidates));
+  service.StopService();
+}
@@ -0,0 +1,95 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <rime/dict/string_table.h>
+
+TEST(RimeStringCacheTest, GetAndPut) {
+  rime::StringCache cache(100);
+  EXPECT_EQ(128, cache.capacity());
+  std::string value;
+  EXPECT_FALSE(cache.Get(1, &value));
+  cache.Put(1, "yi", 2);
+  ASSERT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("yi", value);
+  // a string that has been hit survives a collision
+  cache.Put(1 + 128, "er", 2);
+  EXPECT_FALSE(cache.Get(1 + 128, &value));
+  ASSERT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("yi", value);
+  // and is replaced at the next but one
+  cache.Put(1 + 128, "er", 2);
+  cache.Put(1 + 128, "er", 2);
+  EXPECT_FALSE(cache.Get(1, &value));
+  ASSERT_TRUE(cache.Get(1 + 128, &value));
+  EXPECT_EQ("er", value);
+  // a string never hit is replaced right away
+  cache.Put(2, "san", 3);
+  cache.Put(2 + 128, "si", 2);
+  EXPECT_FALSE(cache.Get(2, &value));
+  ASSERT_TRUE(cache.Get(2 + 128, &value));
+  EXPECT_EQ("si", value);
+  // long strings are not cached
+  std::string long_string(rime::StringCache::kMaxLength + 1, 'x');
+  cache.Put(3, long_string.c_str(), long_string.length());
+  EXPECT_FALSE(cache.Get(3, &value));
+  std::string max_string(rime::StringCache::kMaxLength, 'x');
+  cache.Put(4, max_string.c_str(), max_string.length());
+  ASSERT_TRUE(cache.Get(4, &value));
+  EXPECT_EQ(max_string, value);
+}
+
+TEST(RimeStringCacheTest, ConcurrentReplacement) {
+  const int kNumThreads = 4;
+  const rime::StringId kNumIds = 256;
+  rime::StringCache cache(16);
+  std::atomic<int> errors{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&cache, &errors, t]() {
+      std::string value;
+      for (int round = 0; round < 200; ++round) {
+        for (rime::StringId id = t; id < kNumIds; ++id) {
+          std::string expected(std::to_string(id) +
+                               std::string(id % 20, '-'));
+          if (cache.Get(id, &value)) {
+            if (value != expected)
+              ++errors;
+          }
+          else {
+            cache.Put(id, expected.c_str(), expected.length());
+          }
+        }
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, errors);
+}
+
+TEST(RimeStringTableTest, CachedGetString) {
+  rime::StringTableBuilder builder;
+  std::vector<rime::StringId> ids(3);
+  builder.Add("yi", 1.0, &ids[0]);
+  builder.Add("er", 1.0, &ids[1]);
+  builder.Add("yi-er-san-si-wu-liu-qi-ba-jiu-shi", 1.0, &ids[2]);
+  builder.Build();
+  std::vector<char> image(builder.BinarySize());
+  builder.Dump(image.data(), image.size());
+
+  rime::StringTable table(image.data(), image.size(), 16);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ("yi", table.GetString(ids[0]));
+    EXPECT_EQ("er", table.GetString(ids[1]));
+    EXPECT_EQ("yi-er-san-si-wu-liu-qi-ba-jiu-shi", table.GetString(ids[2]));
+  }
+}
@@ -55,12 +55,14 @@ TEST_F(RimeSyllabifierTest, CaseAlpha) {
   s.BuildSyllableGraph(input, *prism_, &g);
   EXPECT_EQ(input.length(), g.input_length);
   EXPECT_EQ(input.length(), g.interpreted_length);
-  EXPECT_EQ(2, g.vertices.size());
-  ASSERT_FALSE(g.vertices.end() == g.vertices.find(1));
-  EXPECT_EQ(rime::kNormalSpelling, g.vertices[1]);
-  rime::SpellingMap& sp(g.edges[0][1]);
-  EXPECT_EQ(1, sp.size());
-  ASSERT_FALSE(sp.end() == sp.find(syllable_id_["a"]));
+  EXPECT_EQ(2, g.num_vertices());
+  ASSERT_NE(rime::kInvalidSpelling, g.vertex_type(1));
+  EXPECT_EQ(rime::kNormalSpelling, g.vertex_type(1));
+  rime::SpellingIndex e0(g.spellings(0));
+  EXPECT_EQ(1, e0.size());
+  rime::SpellingPropertiesList sp(e0[syllable_id_["a"]]);
+  ASSERT_EQ(1, sp.size());
+  EXPECT_EQ(1, sp[0].end_pos);
   EXPECT_EQ(rime::kNormalSpelling, sp[0].type);
   EXPECT_EQ(1.0, sp[0].credibility);
 }
@@ -72,13 +74,15 @@ TEST_F(RimeSyllabifierTest, CaseFailure) {
   s.BuildSyllableGraph(input, *prism_, &g);
   EXPECT_EQ(input.length(), g.input_length);
   EXPECT_EQ(input.length() - 1, g.interpreted_length);
-  EXPECT_EQ(2, g.vertices.size());
-  ASSERT_TRUE(g.vertices.end() == g.vertices.find(1));
-  ASSERT_FALSE(g.vertices.end() == g.vertices.find(2));
-  EXPECT_EQ(rime::kNormalSpelling, g.vertices[2]);
-  rime::SpellingMap& sp(g.edges[0][2]);
-  EXPECT_EQ(1, sp.size());
-  ASSERT_FALSE(sp.end() == sp.find(syllable_id_["an"]));
+  EXPECT_EQ(2, g.num_vertices());
+  ASSERT_EQ(rime::kInvalidSpelling, g.vertex_type(1));
+  ASSERT_NE(rime::kInvalidSpelling, g.vertex_type(2));
+  EXPECT_EQ(rime::kNormalSpelling, g.vertex_type(2));
+  rime::SpellingIndex e0(g.spellings(0));
+  EXPECT_EQ(1, e0.size());
+  rime::SpellingPropertiesList sp(e0[syllable_id_["an"]]);
+  ASSERT_EQ(1, sp.size());
+  EXPECT_EQ(2, sp[0].end_pos);
 }
 
 TEST_F(RimeSyllabifierTest, CaseChangan) {
@@ -88,30 +92,30 @@ TEST_F(RimeSyllabifierTest, CaseChangan) {
   s.BuildSyllableGraph(input, *prism_, &g);
   EXPECT_EQ(input.length(), g.input_length);
   EXPECT_EQ(input.length(), g.interpreted_length);
-  EXPECT_EQ(4, g.vertices.size());
+  EXPECT_EQ(4, g.num_vertices());
   // not c'han'gan or c'hang'an
-  EXPECT_TRUE(g.vertices.end() == g.vertices.find(1));
-  ASSERT_FALSE(g.vertices.end() == g.vertices.find(4));
-  ASSERT_FALSE(g.vertices.end() == g.vertices.find(5));
-  EXPECT_EQ(rime::kNormalSpelling, g.vertices[4]);
-  EXPECT_EQ(rime::kNormalSpelling, g.vertices[5]);
+  EXPECT_EQ(rime::kInvalidSpelling, g.vertex_type(1));
+  ASSERT_NE(rime::kInvalidSpelling, g.vertex_type(4));
+  ASSERT_NE(rime::kInvalidSpelling, g.vertex_type(5));
+  EXPECT_EQ(rime::kNormalSpelling, g.vertex_type(4));
+  EXPECT_EQ(rime::kNormalSpelling, g.vertex_type(5));
   // chan, chang but not cha
-  rime::EndVertexMap& e0(g.edges[0]);
+  rime::SpellingIndex e0(g.spellings(0));
   EXPECT_EQ(2, e0.size());
-  ASSERT_FALSE(e0.end() == e0.find(4));
-  ASSERT_FALSE(e0.end() == e0.find(5));
-  EXPECT_FALSE(e0[4].end() == e0[4].find(syllable_id_["chan"]));
-  EXPECT_FALSE(e0[5].end() == e0[5].find(syllable_id_["chang"]));
+  ASSERT_EQ(1, e0[syllable_id_["chan"]].size());
+  ASSERT_EQ(1, e0[syllable_id_["chang"]].size());
+  EXPECT_EQ(4, e0[syllable_id_["chan"]][0].end_pos);
+  EXPECT_EQ(5, e0[syllable_id_["chang"]][0].end_pos);
   // gan$
-  rime::EndVertexMap& e4(g.edges[4]);
+  rime::SpellingIndex e4(g.spellings(4));
   EXPECT_EQ(1, e4.size());
-  ASSERT_FALSE(e4.end() == e4.find(7));
-  EXPECT_FALSE(e4[7].end() == e4[7].find(syllable_id_["gan"]));
+  ASSERT_EQ(1, e4[syllable_id_["gan"]].size());
+  EXPECT_EQ(7, e4[syllable_id_["gan"]][0].end_pos);
   // an$
-  rime::EndVertexMap& e5(g.edges[5]);
+  rime::SpellingIndex e5(g.spellings(5));
   EXPECT_EQ(1, e5.size());
-  ASSERT_FALSE(e5.end() == e5.find(7));
-  EXPECT_FALSE(e5[7].end() == e5[7].find(syllable_id_["an"]));
+  ASSERT_EQ(1, e5[syllable_id_["an"]].size());
+  EXPECT_EQ(7, e5[syllable_id_["an"]][0].end_pos);
 }
 
 TEST_F(RimeSyllabifierTest, CaseTuan) {
@@ -121,23 +125,23 @@ TEST_F(RimeSyllabifierTest, CaseTuan) {
   s.BuildSyllableGraph(input, *prism_, &g);
   EXPECT_EQ(input.length(), g.input_length);
   EXPECT_EQ(input.length(), g.interpreted_length);
-  EXPECT_EQ(3, g.vertices.size());
+  EXPECT_EQ(3, g.num_vertices());
   // both tu'an and tuan
-  ASSERT_FALSE(g.vertices.end() == g.vertices.find(2));
-  ASSERT_FALSE(g.vertices.end() == g.vertices.find(4));
-  EXPECT_EQ(rime::kAmbiguousSpelling, g.vertices[2]);
-  EXPECT_EQ(rime::kNormalSpelling, g.vertices[4]);
-  rime::EndVertexMap& e0(g.edges[0]);
+  ASSERT_NE(rime::kInvalidSpelling, g.vertex_type(2));
+  ASSERT_NE(rime::kInvalidSpelling, g.vertex_type(4));
+  EXPECT_EQ(rime::kAmbiguousSpelling, g.vertex_type(2));
+  EXPECT_EQ(rime::kNormalSpelling, g.vertex_type(4));
+  rime::SpellingIndex e0(g.spellings(0));
   EXPECT_EQ(2, e0.size());
-  ASSERT_FALSE(e0.end() == e0.find(2));
-  ASSERT_FALSE(e0.end() == e0.find(4));
-  EXPECT_FALSE(e0[2].end() == e0[2].find(syllable_id_["tu"]));
-  EXPECT_FALSE(e0[4].end() == e0[4].find(syllable_id_["tuan"]));
+  ASSERT_EQ(1, e0[syllable_id_["tu"]].size());
+  ASSERT_EQ(1, e0[syllable_id_["tuan"]].size());
+  EXPECT_EQ(2, e0[syllable_id_["tu"]][0].end_pos);
+  EXPECT_EQ(4, e0[syllable_id_["tuan"]][0].end_pos);
   // an$
-  rime::EndVertexMap& e2(g.edges[2]);
+  rime::SpellingIndex e2(g.spellings(2));
   EXPECT_EQ(1, e2.size());
-  ASSERT_FALSE(e2.end() == e2.find(4));
-  EXPECT_FALSE(e2[4].end() == e2[4].find(syllable_id_["an"]));
+  ASSERT_EQ(1, e2[syllable_id_["an"]].size());
+  EXPECT_EQ(4, e2[syllable_id_["an"]][0].end_pos);
 }
 
 TEST_F(RimeSyllabifierTest, CaseChainingAmbiguity) {
@@ -147,7 +151,7 @@ TEST_F(RimeSyllabifierTest, CaseChainingAmbiguity) {
   s.BuildSyllableGraph(input, *prism_, &g);
   EXPECT_EQ(input.length(), g.input_length);
   EXPECT_EQ(input.length(), g.interpreted_length);
-  EXPECT_EQ(input.length() + 1, g.vertices.size());
+  EXPECT_EQ(input.length() + 1, g.num_vertices());
 }
 
 TEST_F(RimeSyllabifierTest, TransposedSyllableGraph) {
@@ -155,11 +159,44 @@ TEST_F(RimeSyllabifierTest, TransposedSyllableGraph) {
   rime::SyllableGraph g;
   const std::string input("changan");
   s.BuildSyllableGraph(input, *prism_, &g);
-  ASSERT_FALSE(g.indices.end() == g.indices.find(0));
-  EXPECT_EQ(2, g.indices[0].size());
-  EXPECT_FALSE(g.indices[0].end() == g.indices[0].find(syllable_id_["chan"]));
-  EXPECT_FALSE(g.indices[0].end() == g.indices[0].find(syllable_id_["chang"]));
-  ASSERT_EQ(1, g.indices[0][syllable_id_["chan"]].size());
-  ASSERT_FALSE(NULL == g.indices[0][syllable_id_["chan"]][0]);
-  EXPECT_EQ(4, g.indices[0][syllable_id_["chan"]][0]->end_pos);
+  ASSERT_FALSE(g.spellings(0).empty());
+  EXPECT_EQ(2, g.spellings(0).size());
+  EXPECT_FALSE(g.spellings(0).end() ==
+               g.spellings(0).find(syllable_id_["chan"]));
+  EXPECT_FALSE(g.spellings(0).end() ==
+               g.spellings(0).find(syllable_id_["chang"]));
+  ASSERT_EQ(1, g.spellings(0)[syllable_id_["chan"]].size());
+  EXPECT_EQ(4, g.spellings(0)[syllable_id_["chan"]][0].end_pos);
+}
+
+TEST_F(RimeSyllabifierTest, BuiltFromUnorderedSpellings) {
+  rime::SyllableGraphBuilder builder;
+  rime::SpellingProperties props;
+  builder.AddVertex(0, rime::kNormalSpelling);
+  builder.AddVertex(4, rime::kNormalSpelling);
+  builder.AddVertex(2, rime::kAmbiguousSpelling);
+  props.end_pos = 4;
+  builder.AddSpelling(2, 1, props);
+  builder.AddSpelling(0, 10, props);
+  props.end_pos = 2;
+  builder.AddSpelling(0, 9, props);
+  // a duplicate spelling is dropped, the first one kept
+  props.end_pos = 4;
+  props.credibility = 0.5;
+  builder.AddSpelling(0, 10, props);
+  rime::SyllableGraph g;
+  builder.Build(&g);
+  EXPECT_EQ(3, g.num_vertices());
+  EXPECT_EQ(5, g.vertices().size());
+  EXPECT_EQ(rime::kNormalSpelling, g.last_vertex_type());
+  EXPECT_EQ(2, g.num_spelt_vertices());
+  rime::SpellingIndex e0(g.spellings(0));
+  ASSERT_EQ(2, e0.size());
+  auto first = *e0.begin();
+  EXPECT_EQ(9, first.first);
+  ASSERT_EQ(1, e0[10].size());
+  EXPECT_EQ(1.0, e0[10][0].credibility);
+  EXPECT_TRUE(g.spellings(1).empty());
+  EXPECT_TRUE(g.spellings(5).empty());
+  EXPECT_TRUE(e0[1].empty());
 }
@@ -4,6 +4,9 @@
 //
 // 2011-07-03 GONG Chen <chen.sst@gmail.com>
 //
+#include <cmath>
+#include <string>
+#include <boost/filesystem.hpp>
 #include <gtest/gtest.h>
 #include <rime/algo/syllabifier.h>
 #include <rime/dict/table.h>
@@ -32,6 +35,8 @@ class RimeTableTest : public ::testing::Test {
 
   static void PrepareSampleVocabulary(rime::Syllabary& syll,
                                       rime::Vocabulary& voc);
+  // spellings of syllables 1, 2, 3, 4 over [0, 2), [2, 4), [4, 7), [7, 9)
+  static void AddSpellings(rime::SyllableGraphBuilder* builder);
   static std::string Text(const rime::TableAccessor& a) {
     return table_->GetEntryText(*a.entry());
   }
@@ -40,6 +45,16 @@ class RimeTableTest : public ::testing::Test {
 
 const char RimeTableTest::file_name[] = "table_test.bin";
 
+void RimeTableTest::AddSpellings(rime::SyllableGraphBuilder* builder) {
+  const size_t vertices[] = {0, 2, 4, 7, 9};
+  for (rime::SyllableId id = 1; id <= 4; ++id) {
+    rime::SpellingProperties props;
+    props.type = rime::kNormalSpelling;
+    props.end_pos = vertices[id];
+    builder->AddSpelling(vertices[id - 1], id, props);
+  }
+}
+
 rime::unique_ptr<rime::Table> RimeTableTest::table_;
 
 void RimeTableTest::PrepareSampleVocabulary(rime::Syllabary& syll,
@@ -164,23 +179,14 @@ TEST_F(RimeTableTest, QueryWithSyllableGraph) {
   rime::SyllableGraph g;
   g.input_length = input.length();
   g.interpreted_length = g.input_length;
-  g.vertices[0] = rime::kNormalSpelling;
-  g.vertices[2] = rime::kNormalSpelling;
-  g.vertices[4] = rime::kNormalSpelling;
-  g.vertices[7] = rime::kNormalSpelling;
-  g.vertices[9] = rime::kNormalSpelling;
-  g.edges[0][2][1].type = rime::kNormalSpelling;
-  g.edges[0][2][1].end_pos = 2;
-  g.edges[2][4][2].type = rime::kNormalSpelling;
-  g.edges[2][4][2].end_pos = 4;
-  g.edges[4][7][3].type = rime::kNormalSpelling;
-  g.edges[4][7][3].end_pos = 7;
-  g.edges[7][9][4].type = rime::kNormalSpelling;
-  g.edges[7][9][4].end_pos = 9;
-  g.indices[0][1].push_back(&g.edges[0][2][1]);
-  g.indices[2][2].push_back(&g.edges[2][4][2]);
-  g.indices[4][3].push_back(&g.edges[4][7][3]);
-  g.indices[7][4].push_back(&g.edges[7][9][4]);
+  rime::SyllableGraphBuilder builder;
+  builder.AddVertex(0, rime::kNormalSpelling);
+  builder.AddVertex(2, rime::kNormalSpelling);
+  builder.AddVertex(4, rime::kNormalSpelling);
+  builder.AddVertex(7, rime::kNormalSpelling);
+  builder.AddVertex(9, rime::kNormalSpelling);
+  AddSpellings(&builder);
+  builder.Build(&g);
 
   rime::TableQueryResult result;
   ASSERT_TRUE(table_->Query(g, 0, &result));
@@ -208,3 +214,225 @@ TEST_F(RimeTableTest, QueryWithSyllableGraph) {
   EXPECT_STREQ("lia", Text(result[4].front()).c_str());
   EXPECT_FALSE(result[4].front().Next());
 }
+
+TEST_F(RimeTableTest, QueryWithArena) {
+  rime::SyllableGraph g;
+  g.input_length = 9;
+  g.interpreted_length = 9;
+  rime::SyllableGraphBuilder builder;
+  builder.AddVertex(0, rime::kNormalSpelling);
+  builder.AddVertex(2, rime::kNormalSpelling);
+  builder.AddVertex(4, rime::kNormalSpelling);
+  builder.AddVertex(7, rime::kNormalSpelling);
+  builder.AddVertex(9, rime::kNormalSpelling);
+  AddSpellings(&builder);
+  builder.Build(&g);
+
+  rime::TableQueryArena arena;
+  ASSERT_TRUE(table_->Query(g, 0, &arena));
+  const auto& matches(arena.matches());
+  ASSERT_EQ(3, matches.size());
+  EXPECT_EQ(2, matches[0].end_pos);
+  EXPECT_STREQ("yi", Text(matches[0].accessor).c_str());
+  EXPECT_EQ(7, matches[1].end_pos);
+  EXPECT_STREQ("yi-er-san", Text(matches[1].accessor).c_str());
+  EXPECT_EQ(7, matches[2].end_pos);
+  EXPECT_STREQ("yi-er-san-si", Text(matches[2].accessor).c_str());
+  ASSERT_EQ(3, matches[2].accessor.index_code().size());
+
+  // the arena is reused by the next query
+  ASSERT_TRUE(table_->Query(g, 2, &arena));
+  ASSERT_EQ(1, arena.matches().size());
+  EXPECT_EQ(4, arena.matches()[0].end_pos);
+  EXPECT_STREQ("er", Text(arena.matches()[0].accessor).c_str());
+
+  EXPECT_FALSE(table_->Query(g, 9, &arena));
+  EXPECT_TRUE(arena.matches().empty());
+}
+
+TEST_F(RimeTableTest, LargeTableFormat) {
+  rime::Table wide_table("table_test_wide.bin");
+  wide_table.Remove();
+  rime::Syllabary syll;
+  rime::Vocabulary voc;
+  PrepareSampleVocabulary(syll, voc);
+  // as if the table were too large for 32-bit offsets
+  wide_table.set_large_table_threshold(0);
+  ASSERT_TRUE(wide_table.Build(syll, voc, total_num_entries, 0xbeef));
+  ASSERT_TRUE(wide_table.Save());
+  ASSERT_TRUE(wide_table.Load());
+  EXPECT_EQ(0xbeef, wide_table.dict_file_checksum());
+  EXPECT_STREQ("3", wide_table.GetSyllableById(3).c_str());
+
+  rime::TableAccessor v = wide_table.QueryWords(2);
+  ASSERT_EQ(3, v.remaining());
+  EXPECT_STREQ("er", wide_table.GetEntryText(*v.entry()).c_str());
+
+  rime::Code code;
+  code.push_back(1);
+  code.push_back(2);
+  code.push_back(3);
+  v = wide_table.QueryPhrases(code);
+  ASSERT_EQ(1, v.remaining());
+  EXPECT_STREQ("yi-er-san", wide_table.GetEntryText(*v.entry()).c_str());
+  code.push_back(4);
+  v = wide_table.QueryPhrases(code);
+  ASSERT_EQ(2, v.remaining());
+  EXPECT_STREQ("yi-er-san-si", wide_table.GetEntryText(*v.entry()).c_str());
+  ASSERT_TRUE(v.extra_code() != NULL);
+  EXPECT_EQ(4, *v.extra_code()->at);
+
+  // queries walking down the index are the same as in the v2 format
+  rime::SyllableGraph g;
+  g.input_length = 9;
+  g.interpreted_length = 9;
+  rime::SyllableGraphBuilder builder;
+  AddSpellings(&builder);
+  builder.Build(&g);
+  rime::TableQueryResult result;
+  ASSERT_TRUE(wide_table.Query(g, 0, &result));
+  rime::TableQueryResult expected;
+  ASSERT_TRUE(table_->Query(g, 0, &expected));
+  ASSERT_EQ(expected.size(), result.size());
+  for (const auto& x : expected) {
+    ASSERT_EQ(x.second.size(), result[x.first].size());
+    for (size_t i = 0; i < x.second.size(); ++i) {
+      EXPECT_EQ(Text(x.second[i]),
+                wide_table.GetEntryText(*result[x.first][i].entry()));
+    }
+  }
+  wide_table.Close();
+}
+
+TEST_F(RimeTableTest, ExactFileSize) {
+  for (size_t threshold : {rime::Table::kDefaultLargeTableThreshold,
+                           size_t(0)}) {
+    rime::Table sized_table("table_test_sized.bin");
+    sized_table.Remove();
+    rime::Syllabary syll;
+    rime::Vocabulary voc;
+    PrepareSampleVocabulary(syll, voc);
+    sized_table.set_large_table_threshold(threshold);
+    ASSERT_TRUE(sized_table.Build(syll, voc, total_num_entries));
+    // the file is created at its exact size, leaving nothing to shrink
+    EXPECT_EQ(boost::filesystem::file_size("table_test_sized.bin"),
+              sized_table.file_size());
+    ASSERT_TRUE(sized_table.Save());
+    ASSERT_TRUE(sized_table.Load());
+    rime::TableAccessor v = sized_table.QueryWords(2);
+    ASSERT_EQ(3, v.remaining());
+    EXPECT_STREQ("er", sized_table.GetEntryText(*v.entry()).c_str());
+    sized_table.Close();
+  }
+}
+
+TEST_F(RimeTableTest, KeyedTrunkIndex) {
+  // a second level of more keys than are scanned at a time
+  const int kNumSyllables = 200;
+  rime::Syllabary syll;
+  rime::Vocabulary voc;
+  for (int i = 0; i < kNumSyllables; ++i) {
+    syll.insert(std::to_string(1000 + i));
+  }
+  auto lv2 = rime::New<rime::Vocabulary>();
+  voc[0].next_level = lv2;
+  for (int i = 0; i < kNumSyllables; i += 2) {
+    auto d = rime::New<rime::DictEntry>();
+    d->code.push_back(0);
+    d->code.push_back(i);
+    d->text = std::to_string(i);
+    d->weight = 1.0;
+    (*lv2)[i].entries.push_back(d);
+  }
+  for (double version : {rime::Table::kKeyedTrunkFormatVersion, 2.0}) {
+    rime::Table keyed_table("table_test_keyed.bin");
+    keyed_table.Remove();
+    keyed_table.set_format_version(version);
+    ASSERT_TRUE(keyed_table.Build(syll, voc, kNumSyllables / 2));
+    ASSERT_TRUE(keyed_table.Save());
+    ASSERT_TRUE(keyed_table.Load());
+    for (int i = -1; i <= kNumSyllables; ++i) {
+      rime::Code code;
+      code.push_back(0);
+      code.push_back(i);
+      rime::TableAccessor v = keyed_table.QueryPhrases(code);
+      if (i >= 0 && i < kNumSyllables && i % 2 == 0) {
+        ASSERT_FALSE(v.exhausted()) << "version " << version << ", key " << i;
+        EXPECT_EQ(std::to_string(i), keyed_table.GetEntryText(*v.entry()));
+      }
+      else {
+        EXPECT_TRUE(v.exhausted()) << "version " << version << ", key " << i;
+      }
+    }
+    keyed_table.Close();
+  }
+}
+
+TEST(RimeTableWeightTest, QuantizeWeight) {
+  const double weights[] = {-1000.0, -1.0, 0.0, 0.5, 1.0, 1.01, 3.0,
+                            1000.0, 123456.0, 1e8};
+  rime::table::Weight last = -1e9;
+  for (double weight : weights) {
+    rime::table::Weight w =
+        rime::table::DequantizeWeight(rime::table::QuantizeWeight(weight));
+    // within the precision of 8 significant bits
+    EXPECT_NEAR(weight, w, std::abs(weight) / 256);
+    EXPECT_LE(last, w);
+    last = w;
+  }
+}
+
+TEST_F(RimeTableTest, CompactEntries) {
+  // a code of more homophones than are kept in the hot region
+  const size_t kNumHomophones = rime::Table::kNumHotEntries * 2 + 3;
+  rime::Syllabary syll;
+  rime::Vocabulary voc;
+  PrepareSampleVocabulary(syll, voc);
+  syll.insert("5");
+  for (size_t i = 0; i < kNumHomophones; ++i) {
+    auto d = rime::New<rime::DictEntry>();
+    d->code.push_back(5);
+    d->text = "wu" + std::to_string(i);
+    d->weight = 1000.0 - i;
+    voc[5].entries.push_back(d);
+  }
+  size_t num_entries = total_num_entries + kNumHomophones;
+  rime::Table compact_table("table_test_compact.bin");
+  compact_table.Remove();
+  compact_table.set_format_version(rime::Table::kCompactFormatVersion);
+  ASSERT_TRUE(compact_table.Build(syll, voc, num_entries));
+  ASSERT_TRUE(compact_table.Save());
+  ASSERT_TRUE(compact_table.Load());
+
+  rime::TableAccessor v = compact_table.QueryWords(5);
+  ASSERT_EQ(kNumHomophones, v.remaining());
+  EXPECT_TRUE(v.entry() == NULL);
+  for (size_t i = 0; i < kNumHomophones; ++i, v.Next()) {
+    ASSERT_TRUE(v.text() != NULL);
+    EXPECT_EQ("wu" + std::to_string(i), compact_table.GetEntryText(*v.text()));
+    EXPECT_NEAR(1000.0 - i, v.weight(), 4.0);
+  }
+  EXPECT_TRUE(v.exhausted());
+
+  v = compact_table.QueryWords(2);
+  ASSERT_EQ(3, v.remaining());
+  EXPECT_STREQ("er", compact_table.GetEntryText(*v.text()).c_str());
+  EXPECT_EQ(1.0, v.weight());
+  EXPECT_TRUE(compact_table.QueryWords(0).exhausted());
+
+  rime::Code code;
+  code.push_back(1);
+  code.push_back(2);
+  code.push_back(3);
+  v = compact_table.QueryPhrases(code);
+  ASSERT_EQ(1, v.remaining());
+  EXPECT_STREQ("yi-er-san", compact_table.GetEntryText(*v.text()).c_str());
+  // long entries are stored as they are
+  code.push_back(4);
+  v = compact_table.QueryPhrases(code);
+  ASSERT_EQ(2, v.remaining());
+  ASSERT_TRUE(v.entry() != NULL);
+  EXPECT_STREQ("yi-er-san-si",
+               compact_table.GetEntryText(*v.entry()).c_str());
+  compact_table.Close();
+}
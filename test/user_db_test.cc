@@ -85,3 +85,24 @@ TEST(RimeUserDbTest, Query) {
   }
   db.Close();
 }
+
+TEST(RimeUserDbTest, PackValues) {
+  rime::UserDbValue v;
+  v.commits = -3;
+  v.dee = 2.5;
+  v.tick = 12345678901ULL;
+  std::string text = v.Pack();
+  EXPECT_EQ("c=-3 d=2.5 t=12345678901", text);
+  EXPECT_FALSE(rime::UserDbValue::IsBinary(text));
+  std::string binary = v.Pack(true);
+  EXPECT_EQ(rime::UserDbValue::kBinarySize, binary.length());
+  EXPECT_TRUE(rime::UserDbValue::IsBinary(binary));
+  for (const std::string& packed : {text, binary}) {
+    rime::UserDbValue u(packed);
+    EXPECT_EQ(v.commits, u.commits);
+    EXPECT_EQ(v.dee, u.dee);
+    EXPECT_EQ(v.tick, u.tick);
+  }
+  TestDb db("user_db_test");
+  EXPECT_FALSE(rime::UsesBinaryValues(&db));
+}
@@ -0,0 +1,245 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <rime/algo/syllabifier.h>
+#include <rime/dict/prism.h>
+#include <rime/dict/table.h>
+#include <rime/dict/text_db.h>
+#include <rime/dict/tree_db.h>
+#include <rime/dict/user_db.h>
+#include <rime/dict/user_dictionary.h>
+
+using namespace rime;
+
+class RimeUserDictionaryTest : public ::testing::Test {
+ public:
+  virtual void SetUp() {
+    table_ = New<Table>("user_dictionary_test.table.bin");
+    table_->Remove();
+    Syllabary syllabary{"a", "b", "c"};
+    Vocabulary vocabulary;
+    auto e = New<DictEntry>();
+    e->code.push_back(0);
+    e->text = "A";
+    vocabulary[0].entries.push_back(e);
+    ASSERT_TRUE(table_->Build(syllabary, vocabulary, 1));
+    ASSERT_TRUE(table_->Save());
+    ASSERT_TRUE(table_->Load());
+
+    db_ = New<UserDb<TextDb>>("user_dictionary_test");
+    if (db_->Exists())
+      db_->Remove();
+    index_ = New<UserDictIndex>();
+    dict_.reset(new UserDictionary(db_, index_));
+    ASSERT_TRUE(dict_->Load());
+    dict_->Attach(table_, New<Prism>("user_dictionary_test.prism.bin"));
+    Learn({0}, "A");
+    Learn({0, 1}, "AB");
+    Learn({1}, "B");
+    Learn({0, 1, 2}, "ABC");
+    Learn({1, 2}, "BC");
+    // not made of syllables in the table
+    db_->Update("d \tD", "c=1 d=1 t=1");
+    // one syllable 'a', three syllables 'b'/'c' spanning [1, 3)
+    SyllableGraphBuilder builder;
+    for (size_t i = 0; i <= 3; ++i) {
+      builder.AddVertex(i, kNormalSpelling);
+    }
+    SpellingProperties props;
+    props.end_pos = 1;
+    builder.AddSpelling(0, 0, props);
+    props.end_pos = 2;
+    builder.AddSpelling(1, 1, props);
+    props.end_pos = 3;
+    builder.AddSpelling(1, 2, props);
+    builder.AddSpelling(2, 2, props);
+    builder.Build(&graph_);
+    graph_.input_length = graph_.interpreted_length = 3;
+  }
+  virtual void TearDown() {
+    dict_.reset();
+    db_->Close();
+    table_->Close();
+  }
+
+ protected:
+  void Learn(const std::vector<SyllableId>& code, const std::string& text) {
+    DictEntry e;
+    e.code.assign(code.begin(), code.end());
+    e.text = text;
+    ASSERT_TRUE(dict_->UpdateEntry(e, 1));
+  }
+  std::set<std::string> Lookup(size_t start_pos) {
+    std::set<std::string> result;
+    auto collector = dict_->Lookup(graph_, start_pos);
+    if (collector) {
+      for (const auto& x : *collector) {
+        for (const auto& e : x.second) {
+          result.insert(std::to_string(x.first) + ":" + e->text);
+        }
+      }
+    }
+    return result;
+  }
+
+  shared_ptr<Table> table_;
+  shared_ptr<Db> db_;
+  shared_ptr<UserDictIndex> index_;
+  unique_ptr<UserDictionary> dict_;
+  SyllableGraph graph_;
+};
+
+TEST_F(RimeUserDictionaryTest, BuildIndex) {
+  ASSERT_TRUE(index_->Build(db_->QueryAll().get(), table_));
+  EXPECT_EQ(5, index_->size());
+  auto a = index_->Find(index_->root(), 0);
+  ASSERT_TRUE(a != NULL);
+  ASSERT_EQ(1, a->records.size());
+  EXPECT_EQ("A", a->records[0].text);
+  EXPECT_EQ(1, a->records[0].value.commits);
+  auto ab = index_->Find(a, 1);
+  ASSERT_TRUE(ab != NULL);
+  ASSERT_EQ(1, ab->records.size());
+  EXPECT_EQ("AB", ab->records[0].text);
+  EXPECT_TRUE(index_->Find(a, 2) == NULL);
+  EXPECT_TRUE(index_->Find(index_->root(), 3) == NULL);
+  // a table of another syllabary calls for its own index
+  EXPECT_FALSE(index_->Accepts(New<Table>("another_table.bin")));
+  EXPECT_TRUE(index_->Accepts(table_));
+}
+
+TEST_F(RimeUserDictionaryTest, LookupInIndex) {
+  std::set<std::string> from_db[3];
+  for (size_t i = 0; i < 3; ++i) {
+    from_db[i] = Lookup(i);
+  }
+  EXPECT_EQ(3, from_db[0].size());
+  EXPECT_EQ(1, from_db[0].count("3:ABC"));
+  EXPECT_FALSE(index_->built());
+  dict_->EnableIndex(true);
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(from_db[i], Lookup(i));
+  }
+  EXPECT_TRUE(index_->built());
+  // learning a new phrase updates the index in place
+  Learn({2}, "C");
+  Learn({1}, "B");
+  EXPECT_EQ(6, index_->size());
+  auto from_index = Lookup(2);
+  EXPECT_EQ(1, from_index.count("3:C"));
+  dict_->EnableIndex(false);
+  EXPECT_EQ(Lookup(2), from_index);
+}
+
+TEST(RimeUserDbWriteQueueTest, WriteBehind) {
+  auto db = New<UserDb<TreeDb>>("user_db_write_queue_test");
+  if (db->Exists())
+    db->Remove();
+  ASSERT_TRUE(db->Open());
+  ASSERT_TRUE(db->Update("a \tA", "c=1 d=1 t=1"));
+  UserDbWriteQueue queue(db);
+  queue.Update("b \tB", "c=2 d=1 t=2");
+  queue.UpdateTick(2);
+  std::string value;
+  EXPECT_FALSE(db->Fetch("b \tB", &value));
+  EXPECT_TRUE(queue.Fetch("b \tB", &value));
+  EXPECT_EQ("c=2 d=1 t=2", value);
+  // pending records are merged into db records in key order
+  {
+    auto accessor = queue.Merge(db->QueryAll(), "");
+    std::string key;
+    ASSERT_TRUE(accessor->GetNextRecord(&key, &value));
+    EXPECT_EQ("a \tA", key);
+    ASSERT_TRUE(accessor->GetNextRecord(&key, &value));
+    EXPECT_EQ("b \tB", key);
+    EXPECT_FALSE(accessor->GetNextRecord(&key, &value));
+    EXPECT_TRUE(accessor->exhausted());
+  }
+  // changes in an aborted transaction are forgotten
+  queue.BeginTransaction();
+  queue.Update("b \tB", "c=3 d=1 t=3");
+  queue.Update("c \tC", "c=1 d=1 t=3");
+  queue.UpdateTick(3);
+  EXPECT_TRUE(queue.AbortTransaction());
+  EXPECT_TRUE(queue.Fetch("b \tB", &value));
+  EXPECT_EQ("c=2 d=1 t=2", value);
+  EXPECT_FALSE(queue.Fetch("c \tC", &value));
+  TickCount tick = 0;
+  EXPECT_TRUE(queue.FetchTick(&tick));
+  EXPECT_EQ(2, tick);
+  // changes in a transaction are not written until committed
+  queue.BeginTransaction();
+  queue.Update("d \tD", "c=1 d=1 t=3");
+  queue.Flush(true);
+  EXPECT_EQ(1, queue.size());
+  EXPECT_TRUE(db->Fetch("b \tB", &value));
+  EXPECT_EQ("c=2 d=1 t=2", value);
+  EXPECT_TRUE(db->MetaFetch("/tick", &value));
+  EXPECT_EQ("2", value);
+  EXPECT_FALSE(db->Fetch("d \tD", &value));
+  queue.CommitTransaction();
+  queue.Flush(false);
+  queue.Flush(true);  // waits for the last flush
+  EXPECT_EQ(0, queue.size());
+  EXPECT_TRUE(db->Fetch("d \tD", &value));
+}
+
+TEST(RimeUserDbWriteQueueTest, FlushWhenIdle) {
+  auto db = New<UserDb<TreeDb>>("user_db_write_queue_test");
+  if (db->Exists())
+    db->Remove();
+  ASSERT_TRUE(db->Open());
+  UserDbWriteQueue queue(db, 1);
+  queue.Update("a \tA", "c=1 d=1 t=1");
+  // written by the timer within a few seconds, without another update
+  std::string value;
+  for (int i = 0; i < 30 && !db->Fetch("a \tA", &value); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  EXPECT_TRUE(db->Fetch("a \tA", &value));
+  EXPECT_EQ("c=1 d=1 t=1", value);
+}
+
+TEST(RimeUserDbWriteQueueTest, ConcurrentFlush) {
+  const int kNumThreads = 4;
+  const int kNumRecords = 50;
+  auto db = New<UserDb<TreeDb>>("user_db_write_queue_test");
+  if (db->Exists())
+    db->Remove();
+  ASSERT_TRUE(db->Open());
+  UserDbWriteQueue queue(db);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&queue, t]() {
+      for (int i = 0; i < kNumRecords; ++i) {
+        std::string key(std::to_string(t) + "-" + std::to_string(i) + " \tX");
+        queue.Update(key, "c=1 d=1 t=1");
+        if (i % 2)
+          queue.Flush(false);
+        else
+          queue.FlushIfDue();
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  queue.Flush(true);
+  EXPECT_EQ(0, queue.size());
+  std::string value;
+  for (int t = 0; t < kNumThreads; ++t) {
+    for (int i = 0; i < kNumRecords; ++i) {
+      std::string key(std::to_string(t) + "-" + std::to_string(i) + " \tX");
+      EXPECT_TRUE(db->Fetch(key, &value)) << key;
+    }
+  }
+}
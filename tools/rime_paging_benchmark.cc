@@ -0,0 +1,95 @@
+//
+// Copyleft RIME Developers
+// License: GPLv3
+//
+// 2026-10-16
+//
+// measures the cost of paging through candidates of ambiguous inputs,
+// with luna_pinyin and fuzzy spelling algebra.
+//
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <boost/filesystem.hpp>
+#include <rime_api.h>
+
+static const char* kFuzzyPinyinPatch =
+    "patch:\n"
+    "  \"speller/algebra/@next\": derive/^([zcs])h/$1/\n"
+    "  \"speller/algebra/@next\": derive/^([zcs])([^h])/$1h$2/\n"
+    "  \"speller/algebra/@next\": derive/([aei])n$/$1ng/\n"
+    "  \"speller/algebra/@next\": derive/([aei])ng$/$1n/\n"
+    "  \"speller/algebra/@next\": abbrev/^([a-z]).+$/$1/\n";
+
+static const char* kInputs[] = {
+  "z", "s", "zh", "ji", "shi", "zs", "zhs", "zgr", NULL
+};
+
+static const int kPageDown = 0xff56;  // XK_Page_Down
+
+static bool PrepareUserData(const std::string& user_data_dir) {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(user_data_dir, ec);
+  std::ofstream out(
+      (boost::filesystem::path(user_data_dir) /
+       "luna_pinyin.custom.yaml").string().c_str());
+  out << kFuzzyPinyinPatch;
+  return bool(out);
+}
+
+int main(int argc, char* argv[]) {
+  std::string shared_data_dir(argc > 1 ? argv[1] : ".");
+  std::string user_data_dir(argc > 2 ? argv[2] : "benchmark_user_data");
+  int max_pages = argc > 3 ? std::atoi(argv[3]) : 100;
+  if (!PrepareUserData(user_data_dir)) {
+    std::cerr << "error preparing user data in " << user_data_dir << std::endl;
+    return 1;
+  }
+
+  RIME_STRUCT(RimeTraits, traits);
+  traits.shared_data_dir = shared_data_dir.c_str();
+  traits.user_data_dir = user_data_dir.c_str();
+  traits.app_name = "rime.benchmark";
+  RimeSetup(&traits);
+  RimeInitialize(&traits);
+  if (RimeStartMaintenance(True))
+    RimeJoinMaintenanceThread();
+
+  RimeSessionId session_id = RimeCreateSession();
+  if (!session_id || !RimeSelectSchema(session_id, "luna_pinyin")) {
+    std::cerr << "error selecting schema luna_pinyin." << std::endl;
+    RimeFinalize();
+    return 1;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  for (const char** input = kInputs; *input; ++input) {
+    RimeClearComposition(session_id);
+    RimeSimulateKeySequence(session_id, *input);
+    int pages = 0;
+    Clock::duration elapsed(0);
+    for (; pages < max_pages; ++pages) {
+      RIME_STRUCT(RimeContext, context);
+      if (!RimeGetContext(session_id, &context))
+        break;
+      bool is_last_page = context.menu.is_last_page ||
+                          context.menu.num_candidates == 0;
+      RimeFreeContext(&context);
+      if (is_last_page)
+        break;
+      auto start = Clock::now();
+      RimeProcessKey(session_id, kPageDown, 0);
+      elapsed += Clock::now() - start;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+    std::cout << *input << "\t" << pages << " pages\t"
+              << us.count() << " us\t"
+              << (pages ? us.count() / pages : 0) << " us/page" << std::endl;
+  }
+
+  RimeDestroySession(session_id);
+  RimeFinalize();
+  return 0;
+}